@@ -9,6 +9,8 @@
 #ifndef _TOKEN_H_
 #define _TOKEN_H_
 
+#include <stddef.h>
+
 typedef enum
 {
     TOK_WORD,
@@ -16,13 +18,15 @@ typedef enum
     TOK_LESSTHAN,
     TOK_GREATERTHAN,
     TOK_PIPE,
+    TOK_AMPERSAND,
     TOK_END
 } TokenType;
 
 typedef struct
 {
     TokenType type; // Type of token (WORD, QUOTED_WORD, etc.)
-    char *value;    // The actual string value of the token
+    char *value;    // The actual string value of the token (NUL-terminated)
+    size_t len;     // Length of value, not counting the NUL
 } Token;
 
 #endif /* _TOKEN_H_ */
@@ -11,9 +11,16 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
 
-#include "clist.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOK_HAVE_X86 1
+#endif
+
+#include "arena.h"
+#include "tokvec.h"
 #include "Tokenize.h"
 #include "Token.h"
 #include <stddef.h>
@@ -34,6 +41,8 @@ const char *TT_to_str(TokenType tt)
         return "GREATERTHAN";
     case TOK_PIPE:
         return "PIPE";
+    case TOK_AMPERSAND:
+        return "AMPERSAND";
     case TOK_END:
         return "(end)";
     default:
@@ -65,34 +74,259 @@ char handle_escape_sequence(char next_char, char *errmsg, size_t errmsg_sz)
         return '<'; // Less than
     case '>':
         return '>'; // Greater than
+    case '&':
+        return '&'; // Ampersand
     default:
         snprintf(errmsg, errmsg_sz, "Unrecognized escape sequence: \\%c", next_char);
         return '\0'; // Indicate an error
     }
 }
 
-// This function checks if the current character marks the end of a word
-int is_at_end(const char current)
+// Byte classes for the scanners: what ends a run of plain word text
+// inside double quotes, and outside them
+#define TOK_ENDS_QUOTED   1  // NUL, " and backslash
+#define TOK_ENDS_UNQUOTED 2  // Those, blanks (isspace) and < > | &
+
+static const unsigned char _TOK_class[256] = {
+    ['\0'] = TOK_ENDS_QUOTED | TOK_ENDS_UNQUOTED,
+    ['"'] = TOK_ENDS_QUOTED | TOK_ENDS_UNQUOTED,
+    ['\\'] = TOK_ENDS_QUOTED | TOK_ENDS_UNQUOTED,
+    [' '] = TOK_ENDS_UNQUOTED,
+    ['\t'] = TOK_ENDS_UNQUOTED,
+    ['\n'] = TOK_ENDS_UNQUOTED,
+    ['\v'] = TOK_ENDS_UNQUOTED,
+    ['\f'] = TOK_ENDS_UNQUOTED,
+    ['\r'] = TOK_ENDS_UNQUOTED,
+    ['<'] = TOK_ENDS_UNQUOTED,
+    ['>'] = TOK_ENDS_UNQUOTED,
+    ['|'] = TOK_ENDS_UNQUOTED,
+    ['&'] = TOK_ENDS_UNQUOTED,
+};
+
+// A scanner: the length of the run of plain text at p, inside double
+// quotes or not. The run always ends, at the latest at the NUL.
+typedef size_t (*TokScanFn)(const char *p, int quoted);
+
+static size_t _TOK_scan_bytes(const char *p, int quoted)
+{
+    unsigned char ends = quoted ? TOK_ENDS_QUOTED : TOK_ENDS_UNQUOTED;
+    const char *start = p;
+
+    while (!(_TOK_class[(unsigned char)*p] & ends))
+        p++;
+
+    return p - start;
+}
+
+#ifdef TOK_HAVE_X86
+
+/*
+ * The vector scanners read whole aligned blocks, which may extend past
+ * the NUL but never into the next page. ASan would see the bytes after
+ * the string's end, so they are not instrumented.
+ */
+#define TOK_BLOCK_READ __attribute__((no_sanitize_address))
+
+// Bit i set if byte i of the 16 at block ends a run
+TOK_BLOCK_READ static inline unsigned _TOK_ends16(const char *block, int quoted)
+{
+    __m128i bytes = _mm_load_si128((const __m128i *)block);
+    __m128i hits = _mm_or_si128(_mm_or_si128(
+                       _mm_cmpeq_epi8(bytes, _mm_setzero_si128()),
+                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))),
+                       _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\')));
+
+    if (!quoted)
+    {
+        // \t to \r are one range: (byte - '\t') <= 4, unsigned
+        __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+        __m128i blank = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(4)), offset);
+        hits = _mm_or_si128(hits, _mm_or_si128(blank, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+        hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('<')),
+                                               _mm_cmpeq_epi8(bytes, _mm_set1_epi8('>'))));
+        hits = _mm_or_si128(hits, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')),
+                                               _mm_cmpeq_epi8(bytes, _mm_set1_epi8('&'))));
+    }
+
+    return (unsigned)_mm_movemask_epi8(hits);
+}
+
+TOK_BLOCK_READ static size_t _TOK_scan_sse2(const char *p, int quoted)
+{
+    size_t offset = (uintptr_t)p & 15;
+    const char *block = p - offset;
+    unsigned ends = _TOK_ends16(block, quoted) & (0xffffu << offset);
+
+    while (ends == 0)
+    {
+        block += 16;
+        ends = _TOK_ends16(block, quoted);
+    }
+
+    return block + __builtin_ctz(ends) - p;
+}
+
+// Bit i set if byte i of the 32 at block ends a run
+TOK_BLOCK_READ __attribute__((target("avx2")))
+static inline uint32_t _TOK_ends32(const char *block, int quoted)
+{
+    __m256i bytes = _mm256_load_si256((const __m256i *)block);
+    __m256i hits = _mm256_or_si256(_mm256_or_si256(
+                       _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()),
+                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'))),
+                       _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\')));
+
+    if (!quoted)
+    {
+        __m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+        __m256i blank = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(4)), offset);
+        hits = _mm256_or_si256(hits, _mm256_or_si256(blank, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))));
+        hits = _mm256_or_si256(hits, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('<')),
+                                                     _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('>'))));
+        hits = _mm256_or_si256(hits, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|')),
+                                                     _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('&'))));
+    }
+
+    return (uint32_t)_mm256_movemask_epi8(hits);
+}
+
+TOK_BLOCK_READ __attribute__((target("avx2")))
+static size_t _TOK_scan_avx2(const char *p, int quoted)
+{
+    size_t offset = (uintptr_t)p & 31;
+    const char *block = p - offset;
+    uint32_t ends = _TOK_ends32(block, quoted) & (0xffffffffu << offset);
+
+    while (ends == 0)
+    {
+        block += 32;
+        ends = _TOK_ends32(block, quoted);
+    }
+
+    return block + __builtin_ctz(ends) - p;
+}
+
+#endif // TOK_HAVE_X86
+
+static TokScanner scanner;
+static TokScanFn scan = NULL;
+
+// The fastest scanner this CPU has
+static TokScanner _TOK_best_scanner(void)
+{
+#ifdef TOK_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return TOK_SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return TOK_SCAN_SSE2;
+#endif
+    return TOK_SCAN_BYTES;
+}
+
+// Documented in .h file
+int TOK_set_scanner(TokScanner which)
+{
+    TokScanner best = _TOK_best_scanner();
+
+    if (which > best)
+        return -1;
+
+    switch (which)
+    {
+#ifdef TOK_HAVE_X86
+    case TOK_SCAN_AVX2:
+        scan = _TOK_scan_avx2;
+        break;
+    case TOK_SCAN_SSE2:
+        scan = _TOK_scan_sse2;
+        break;
+#endif
+    default:
+        which = TOK_SCAN_BYTES;
+        scan = _TOK_scan_bytes;
+        break;
+    }
+
+    scanner = which;
+    return 0;
+}
+
+// Documented in .h file
+TokScanner TOK_get_scanner(void)
+{
+    if (scan == NULL)
+        TOK_set_scanner(_TOK_best_scanner());
+    return scanner;
+}
+
+// Documented in .h file
+const char *TOK_scanner_name(TokScanner which)
+{
+    switch (which)
+    {
+    case TOK_SCAN_SSE2:
+        return "sse2";
+    case TOK_SCAN_AVX2:
+        return "avx2";
+    default:
+        return "bytes";
+    }
+}
+
+// Length of the run of plain text at p. Most runs in typed lines are
+// a few bytes, which are cheaper to look at one by one than to set up
+// a vector scan for.
+#define TOK_SHORT_RUN 16
+
+static inline size_t _TOK_span(const char *p, int quoted)
 {
-    // Check if it's one of the special characters (unescaped <, >, |, " or space)
-    if (current == '<' || current == '>' || current == '|' || current == '"')
-        return 1; // End of word
+    unsigned char ends = quoted ? TOK_ENDS_QUOTED : TOK_ENDS_UNQUOTED;
+
+    for (size_t n = 0; n < TOK_SHORT_RUN; n++)
+    {
+        if (_TOK_class[(unsigned char)p[n]] & ends)
+            return n;
+    }
+
+    return TOK_SHORT_RUN + scan(p + TOK_SHORT_RUN, quoted);
+}
 
-    // Check for unescaped whitespace
-    if (isspace(current))
-        return 1; // End of word
+// Upper bound on the number of tokens input can produce: every
+// operator is a token and may be followed by a word, a closing quote
+// ends a word so the next character may start another, every
+// whitespace-separated run starts at most one word, plus the final
+// TOK_END. Sizing the vector from this means it never has to grow.
+static size_t max_token_count(const char *input)
+{
+    size_t count = 1;
+    int in_space = 1;
 
-    // Check if we are at the end of the input string
-    if (current == '\0')
-        return 1; // End of word
+    for (const char *p = input; *p != '\0'; p++)
+    {
+        if (*p == '<' || *p == '>' || *p == '|' || *p == '&')
+            count += 2;
+        else if (*p == '"')
+            count++;
+        else if (isspace(*p))
+            in_space = 1;
+        else
+        {
+            if (in_space)
+                count++;
+            in_space = 0;
 
-    return 0; // Not at the end of the word yet
+            // The rest of a plain run changes nothing
+            p += _TOK_span(p + 1, 0);
+        }
+    }
+
+    return count;
 }
 
 // Documented in .h file
-CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
+TokVec TOK_tokenize_input(Arena *arena, const char *input, char *errmsg, size_t errmsg_sz)
 {
-    CList tokens = CL_new();
     size_t i = 0;
 
     if (input == NULL) {
@@ -100,6 +334,17 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
         return NULL;
     }
 
+    if (scan == NULL)
+        TOK_set_scanner(_TOK_best_scanner());
+
+    // All word text for the line goes into one block of the arena.
+    // Unescaping never lengthens a word, and each word's terminating
+    // NUL can be charged to the delimiter (or closing quote) that
+    // ended it, so strlen(input) + 1 bytes always suffice.
+    char *text = arena_alloc(arena, strlen(input) + 1);
+
+    TokVec tokens = TV_new(arena, max_token_count(input));
+
     while (input[i] != '\0')
     {
         // Skip whitespace
@@ -112,27 +357,34 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
         Token token = {0};
 
         // Handle special characters first
-        if (input[i] == '<' || input[i] == '>' || input[i] == '|')
+        if (input[i] == '<' || input[i] == '>' || input[i] == '|' || input[i] == '&')
         {
             switch (input[i])
             {
             case '<':
                 token.type = TOK_LESSTHAN;
+                token.value = "<";
                 break;
             case '>':
                 token.type = TOK_GREATERTHAN;
+                token.value = ">";
                 break;
             case '|':
                 token.type = TOK_PIPE;
+                token.value = "|";
+                break;
+            case '&':
+                token.type = TOK_AMPERSAND;
+                token.value = "&";
                 break;
             }
-            token.value = strdup(input[i] == '<' ? "<" : (input[i] == '>' ? ">" : "|"));
-            CL_append(tokens, token);
+            token.len = 1;
+            TV_append(tokens, token);
             i++;
             continue;
         }
 
-        char temp[256];
+        char *temp = text;
         size_t temp_idx = 0;
         int is_quoted = 0;
         int had_quote = 0;
@@ -140,6 +392,13 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
         // Improved quote handling
         while (1)
         {
+            // Plain text is copied a run at a time, up to the next
+            // byte that needs a decision below
+            size_t run = _TOK_span(input + i, is_quoted);
+            memcpy(temp + temp_idx, input + i, run);
+            temp_idx += run;
+            i += run;
+
             if (input[i] == '"')
             {
                 if (!is_quoted)
@@ -151,23 +410,23 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
                 }
                 else
                 {
-                    // Check for EOF while in quotes
-                    if (input[i + 1] == '\0') 
-                    {
-                        snprintf(errmsg, errmsg_sz, "Unterminated quote");
-                        free_token_values(tokens);
-                        return NULL;
-                    }
-                    
                     is_quoted = 0;
                     i++; // Skip closing quote
                     break;
                 }
             }
 
+            // Check for EOF while in quotes
+            if (input[i] == '\0' && is_quoted)
+            {
+                snprintf(errmsg, errmsg_sz, "Unterminated quote");
+                return NULL;
+            }
+
             // End of input or word conditions
             if (input[i] == '\0' ||
-                (!is_quoted && (input[i] == '<' || input[i] == '>' || input[i] == '|' || isspace(input[i]))))
+                (!is_quoted && (input[i] == '<' || input[i] == '>' || input[i] == '|' ||
+                                input[i] == '&' || isspace(input[i]))))
                 break;
 
             // Handle backslash
@@ -176,8 +435,7 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
                 if (input[i + 1] == '\0')
                 {
                     snprintf(errmsg, errmsg_sz, "Illegal escape character");
-                    free_token_values(tokens);
-                    return NULL;
+                        return NULL;
                 }
 
                 // Improved escape sequence handling
@@ -193,24 +451,19 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
                     }
                     
                     snprintf(errmsg, errmsg_sz, "Illegal escape character '\\%c'", input[i + 1]);
-                    free_token_values(tokens);
-                    return NULL;
+                        return NULL;
                 }
                 temp[temp_idx++] = escaped;
                 i += 2;
             }
-            else
-            {
-                temp[temp_idx++] = input[i];
-                i++;
-            }
         }
 
         // Create token if we have content
         if (temp_idx > 0)
         {
             temp[temp_idx] = '\0';
-            
+            text += temp_idx + 1;
+
             // Determine token type
             if (is_quoted || had_quote)
             {
@@ -221,79 +474,49 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
                 token.type = TOK_WORD;
             }
             
-            token.value = strdup(temp);
-            CL_append(tokens, token);
+            token.value = temp;
+            token.len = temp_idx;
+            TV_append(tokens, token);
         }
     }
 
     // Add end-of-input token
     Token end_token = {.type = TOK_END, .value = NULL};
-    CL_append(tokens, end_token);
+    TV_append(tokens, end_token);
     return tokens;
 }
 // Documented in .h file
-void free_token_values(CList tokens)
-{
-    if (tokens == NULL) 
-        return;
-
-    // Iterate through the tokens and free each token's value
-    size_t length = CL_length(tokens);
-    for (size_t i = 0; i < length; i++) 
-    {
-        Token token = CL_nth(tokens, i);
-        
-        // Free the dynamically allocated value string
-        // But only for tokens that have a non-NULL value
-        if (token.value != NULL) 
-        {
-            free(token.value);
-        }
-    }
-
-    // Optional: Clear the list after freeing values
-    CL_free(tokens);
-}
-// Documented in .h file
-TokenType TOK_next_type(CList tokens)
+TokenType TOK_next_type(TokVec tokens)
 {
-    if (CL_length(tokens) == 0)
-    {
-        return TOK_END;
-    }
-    Token token = CL_nth(tokens, 0);
-    return token.type;
+    return TV_nth(tokens, 0).type;
 }
 
 // Documented in .h file
-Token TOK_next(CList tokens)
+Token TOK_next(TokVec tokens)
 {
-    return CL_nth(tokens, 0);
+    return TV_nth(tokens, 0);
 }
 
 // Documented in .h file
-void TOK_consume(CList tokens)
+void TOK_consume(TokVec tokens)
 {
-    if (CL_length(tokens) > 0)
-    {
-        CL_pop(tokens);
-    }
+    TV_consume(tokens);
 }
 
-void printToken(int pos, CListElementType element, void *cb_data)
+// Documented in .h file
+void TOK_print(TokVec tokens)
 {
-    if (element.type == TOK_WORD || element.type == TOK_QUOTED_WORD)
-    {
-        printf("Position %d: Token type: %s, Text: %s\n", pos, TT_to_str(element.type), element.value);
-    }
-    else
+    int length = TV_length(tokens);
+    for (int pos = 0; pos < length; pos++)
     {
-        printf("Position %d: Token type: %s\n", pos, TT_to_str(element.type));
+        Token element = TV_nth(tokens, pos);
+        if (element.type == TOK_WORD || element.type == TOK_QUOTED_WORD)
+        {
+            printf("Position %d: Token type: %s, Text: %s\n", pos, TT_to_str(element.type), element.value);
+        }
+        else
+        {
+            printf("Position %d: Token type: %s\n", pos, TT_to_str(element.type));
+        }
     }
 }
-
-// Documented in .h file
-void TOK_print(CList tokens)
-{
-    CL_foreach(tokens, printToken, NULL);
-}
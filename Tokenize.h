@@ -9,7 +9,8 @@
 #ifndef _TOKENIZE_H_
 #define _TOKENIZE_H_
 
-#include "clist.h"
+#include "arena.h"
+#include "tokvec.h"
 #include "Token.h"
 #include <stddef.h>
 
@@ -28,20 +29,58 @@ const char *TT_to_str(TokenType tt);
 
 
 /*
- * Tokenize a string entered by the user
+ * Tokenize a string entered by the user. Word text is unescaped
+ * directly into the arena, once; each token's value/len is a slice
+ * of that text, and there is no limit on word length.
  *
  * Parameters:
+ *   arena      Line-scoped arena that receives the tokens and text
  *   input      The input as entered by the user
  *   errmsg     Return space for an error message, filled in in case of error
  *   errmsg_sz  The size of errmsg
  * 
- * Returns: A newly-created CList representing the tokenized input,
+ * Returns: A newly-created TokVec representing the tokenized input,
  *   with one token per list element. If an error is encountered,
  *   copies an error message into errmsg and returns NULL.
  * 
- *   It is up to the caller to call CL_free on the returned list.
+ *   The vector and the token values are allocated from arena and
+ *   remain valid until it is reset.
  */
-CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
+TokVec TOK_tokenize_input(Arena *arena, const char *input, char *errmsg, size_t errmsg_sz);
+
+
+
+/*
+ * How TOK_tokenize_input finds the end of a run of plain word text
+ * (the next blank, operator, quote, backslash or NUL): a byte at a
+ * time, or 16 or 32 bytes at a time with SSE2 or AVX2. The tokens are
+ * the same with each; by default the fastest the CPU supports is used.
+ */
+typedef enum TokScanner
+{
+    TOK_SCAN_BYTES,
+    TOK_SCAN_SSE2,
+    TOK_SCAN_AVX2
+} TokScanner;
+
+
+/*
+ * Select the scanner TOK_tokenize_input uses
+ *
+ * Parameters:
+ *   scanner  The scanner
+ *
+ * Returns: 0 on success, -1 if this CPU (or build) does not have it
+ */
+int TOK_set_scanner(TokScanner scanner);
+
+
+/*
+ * The scanner in use, and its printable name ("bytes", "sse2" or "avx2")
+ */
+TokScanner TOK_get_scanner(void);
+
+const char *TOK_scanner_name(TokScanner scanner);
 
 
 
@@ -55,7 +94,7 @@ CList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
  * Returns: The TokenType for the next token, or TOK_END if the list
  *   is empty.
  */
-TokenType TOK_next_type(CList tokens);
+TokenType TOK_next_type(TokVec tokens);
 
 
 /*
@@ -66,7 +105,7 @@ TokenType TOK_next_type(CList tokens);
  * 
  * Returns: The next token.
  */
-Token TOK_next(CList tokens);
+Token TOK_next(TokVec tokens);
 
 
 /*
@@ -77,7 +116,7 @@ Token TOK_next(CList tokens);
  * 
  * Returns: None
  */
-void TOK_consume(CList tokens);
+void TOK_consume(TokVec tokens);
 
 
 /*
@@ -88,8 +127,6 @@ void TOK_consume(CList tokens);
  * 
  * Returns: None
  */
-void TOK_print(CList tokens);
-
-void free_token_values(CList tokens);
+void TOK_print(TokVec tokens);
 
 #endif /* _TOKENIZE_H_ */
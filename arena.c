@@ -0,0 +1,184 @@
+/*
+ * arena.c
+ *
+ * Region (bump) allocator for per-command-line data
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+// Every allocation is rounded up to this, so that any type can be
+// placed at the returned address
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+struct ArenaChunk
+{
+    ArenaChunk *next;  // Previously filled chunk
+    size_t size;       // Usable bytes in data
+    size_t used;       // Bytes handed out so far
+    max_align_t data[];
+};
+
+
+/*
+ * Allocate a new chunk with at least 'size' usable bytes and push it
+ * onto the arena
+ *
+ * Parameters:
+ *   arena    The arena
+ *   size     Minimum usable size of the chunk
+ *
+ * Returns: The new chunk
+ */
+static ArenaChunk *_arena_new_chunk(Arena *arena, size_t size)
+{
+    ArenaChunk *chunk;
+
+    if (size <= arena->chunk_size && arena->spare != NULL)
+    {
+        // Recycle a chunk kept by arena_reset
+        chunk = arena->spare;
+        arena->spare = chunk->next;
+    }
+    else
+    {
+        if (size < arena->chunk_size)
+            size = arena->chunk_size;
+
+        chunk = malloc(sizeof(ArenaChunk) + size);
+        if (chunk == NULL)
+        {
+            perror("Failed to allocate memory for arena");
+            exit(EXIT_FAILURE);
+        }
+        chunk->size = size;
+        arena->sys_allocs++;
+    }
+
+    chunk->next = arena->head;
+    chunk->used = 0;
+    arena->head = chunk;
+
+    return chunk;
+}
+
+
+// Documented in .h file
+void arena_init(Arena *arena, size_t chunk_size)
+{
+    assert(arena);
+
+    arena->head = NULL;
+    arena->spare = NULL;
+    arena->chunk_size = chunk_size;
+    arena->alloc_calls = 0;
+    arena->sys_allocs = 0;
+}
+
+
+// Documented in .h file
+void *arena_alloc(Arena *arena, size_t size)
+{
+    assert(arena);
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena->alloc_calls++;
+
+    ArenaChunk *chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        chunk = _arena_new_chunk(arena, size);
+
+        // An oversized request gets a dedicated chunk; slot it behind
+        // the one in use so small allocations can keep filling that
+        if (size > arena->chunk_size && chunk->next != NULL)
+        {
+            ArenaChunk *current = chunk->next;
+            chunk->next = current->next;
+            current->next = chunk;
+            arena->head = current;
+        }
+    }
+
+    void *ptr = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+
+// Documented in .h file
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+    char *copy = arena_alloc(arena, len + 1);
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+
+// Documented in .h file
+void arena_reset(Arena *arena)
+{
+    assert(arena);
+
+    ArenaChunk *chunk = arena->head;
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+
+        if (chunk->size > arena->chunk_size)
+        {
+            free(chunk);
+        }
+        else
+        {
+            chunk->next = arena->spare;
+            arena->spare = chunk;
+        }
+        chunk = next;
+    }
+
+    arena->head = NULL;
+}
+
+
+/*
+ * Free every chunk on a chain
+ *
+ * Parameters:
+ *   chunk    The first chunk of the chain
+ *
+ * Returns: None
+ */
+static void _arena_free_chain(ArenaChunk *chunk)
+{
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+
+// Documented in .h file
+void arena_free(Arena *arena)
+{
+    assert(arena);
+
+    _arena_free_chain(arena->head);
+    _arena_free_chain(arena->spare);
+
+    arena->head = NULL;
+    arena->spare = NULL;
+}
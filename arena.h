@@ -0,0 +1,99 @@
+/*
+ * arena.h
+ *
+ * Region (bump) allocator for data whose lifetime is a single
+ * command line. Allocations are carved sequentially out of large
+ * chunks and are never freed individually; the whole arena is reset
+ * at once. Reset keeps the chunks for the next line, so once the
+ * arena has warmed up a line costs no calls to malloc at all.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+// struct ArenaChunk is defined in .c file
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena
+{
+    ArenaChunk *head;   // Chunk currently being allocated from
+    ArenaChunk *spare;  // Chunks kept by arena_reset for reuse
+    size_t chunk_size;  // Default size for new chunks
+
+    // Counters, for diagnostics and benchmarks. They accumulate
+    // across resets; clear them directly if needed.
+    size_t alloc_calls;  // Calls to arena_alloc
+    size_t sys_allocs;   // Calls to malloc made on the arena's behalf
+} Arena;
+
+
+/*
+ * Initialize an arena. No memory is allocated until the first call
+ * to arena_alloc.
+ *
+ * Parameters:
+ *   arena       The arena to initialize
+ *   chunk_size  Default size of each chunk; requests larger than this
+ *               get a chunk of their own
+ *
+ * Returns: None
+ */
+void arena_init(Arena *arena, size_t chunk_size);
+
+
+/*
+ * Allocate memory from the arena. The result is suitably aligned for
+ * any type, and remains valid until the arena is freed.
+ *
+ * Parameters:
+ *   arena    The arena
+ *   size     Number of bytes to allocate
+ *
+ * Returns: Pointer to the allocated memory. Aborts on out-of-memory,
+ *   like the rest of plaidsh.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+
+/*
+ * Copy len bytes of str into the arena and NUL-terminate the copy
+ *
+ * Parameters:
+ *   arena    The arena
+ *   str      The bytes to copy
+ *   len      Number of bytes to copy
+ *
+ * Returns: The NUL-terminated copy
+ */
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+
+
+/*
+ * Discard everything allocated from the arena, keeping its chunks
+ * for reuse. Chunks that were created for a single oversized request
+ * are returned to the system.
+ *
+ * Parameters:
+ *   arena    The arena
+ *
+ * Returns: None
+ */
+void arena_reset(Arena *arena);
+
+
+/*
+ * Release every chunk owned by the arena. The arena may be reused
+ * afterwards without calling arena_init again.
+ *
+ * Parameters:
+ *   arena    The arena
+ *
+ * Returns: None
+ */
+void arena_free(Arena *arena);
+
+#endif /* _ARENA_H_ */
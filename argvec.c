@@ -0,0 +1,64 @@
+/*
+ * argvec.c
+ *
+ * Arena-backed, NULL-terminated argument vector
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <string.h>
+
+#include "argvec.h"
+
+// Slots in a vector's first array
+#define AV_INITIAL_CAPACITY 8
+
+
+// Documented in .h file
+void AV_init(ArgVec *av)
+{
+    av->args = NULL;
+    av->count = 0;
+    av->capacity = 0;
+}
+
+
+// Make room for at least needed arguments in total
+static void _AV_grow(Arena *arena, ArgVec *av, size_t needed)
+{
+    size_t capacity = av->capacity ? (size_t)av->capacity * 2 : AV_INITIAL_CAPACITY;
+    while (capacity < needed)
+        capacity *= 2;
+
+    // One more slot for the NULL
+    char **args = arena_alloc(arena, sizeof(char *) * (capacity + 1));
+    if (av->count > 0)
+        memcpy(args, av->args, sizeof(char *) * av->count);
+    av->args = args;
+    av->capacity = (int)capacity;
+}
+
+
+// Documented in .h file
+void AV_append(Arena *arena, ArgVec *av, char *arg)
+{
+    if (av->count == av->capacity)
+        _AV_grow(arena, av, av->count + 1);
+
+    av->args[av->count++] = arg;
+    av->args[av->count] = NULL;
+}
+
+
+// Documented in .h file
+void AV_append_all(Arena *arena, ArgVec *av, char *const *args, size_t count)
+{
+    if (count == 0)
+        return;
+    if (av->count + count > (size_t)av->capacity)
+        _AV_grow(arena, av, av->count + count);
+
+    memcpy(av->args + av->count, args, sizeof(char *) * count);
+    av->count += (int)count;
+    av->args[av->count] = NULL;
+}
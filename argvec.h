@@ -0,0 +1,66 @@
+/*
+ * argvec.h
+ *
+ * Argument vector for a command: an array of borrowed strings in the
+ * line arena, grown geometrically and kept NULL-terminated after
+ * every change, so that it can be handed to execv or posix_spawn as
+ * it is at any time.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _ARGVEC_H_
+#define _ARGVEC_H_
+
+#include <stddef.h>
+#include "arena.h"
+
+typedef struct ArgVec
+{
+    char **args;    // NULL-terminated; NULL until the first append
+    int count;      // Arguments in args, not counting the NULL
+    int capacity;   // Slots for arguments, not counting the NULL
+} ArgVec;
+
+
+/*
+ * Initialize an empty vector. Nothing is allocated.
+ *
+ * Parameters:
+ *   av      The vector
+ *
+ * Returns: None
+ */
+void AV_init(ArgVec *av);
+
+
+/*
+ * Append an argument, doubling the storage if it is full (amortized
+ * O(1); the old array is abandoned to the arena). The string is
+ * borrowed, not copied: it must outlive the vector.
+ *
+ * Parameters:
+ *   arena   The arena to grow into
+ *   av      The vector
+ *   arg     The argument
+ *
+ * Returns: None
+ */
+void AV_append(Arena *arena, ArgVec *av, char *arg);
+
+
+/*
+ * Append a run of arguments with at most one growth and one copy, as
+ * for the matches of a glob. The strings are borrowed.
+ *
+ * Parameters:
+ *   arena   The arena to grow into
+ *   av      The vector
+ *   args    The arguments
+ *   count   How many
+ *
+ * Returns: None
+ */
+void AV_append_all(Arena *arena, ArgVec *av, char *const *args, size_t count);
+
+#endif /* _ARGVEC_H_ */
@@ -3,132 +3,214 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ast.h"
+#include "arena.h"
 
-// Function to create a new command
-Command *create_command()
+// Stages in a builder's first array
+#define PLAN_INITIAL_STAGES 8
+
+// Function to start an empty plan in the line arena
+void plan_builder_init(PlanBuilder *pb, Arena *arena)
 {
-    Command *cmd = malloc(sizeof(Command));
-    if (!cmd)
-    {
-        perror("Failed to allocate memory for command");
-        exit(EXIT_FAILURE);
-    }
-    cmd->args = NULL;
-    cmd->arg_count = 0; // Initialize argument count to 0
-    cmd->next = NULL;
-    return cmd;
+    pb->arena = arena;
+    AV_init(&pb->argv);
+    AV_init(&pb->redirects);
+    pb->stages = NULL;
+    pb->stage_count = 0;
+    pb->stage_capacity = 0;
+    pb->open = 0;
 }
 
-// Function to add an argument to a command
-void add_argument_to_command(Command *cmd, const char *arg)
+// Function to get the stage taking arguments. A new one starts where
+// the argv pool ends, with no redirections.
+Stage *plan_stage(PlanBuilder *pb)
 {
-    if (!cmd)
-        return; // Check for null command
+    if (pb->open)
+        return &pb->stages[pb->stage_count - 1];
 
-    cmd->args = realloc(cmd->args, sizeof(char *) * (cmd->arg_count + 1));
-    if (!cmd->args)
+    if (pb->stage_count == pb->stage_capacity)
     {
-        perror("Failed to allocate memory for command arguments");
-        exit(EXIT_FAILURE);
+        int capacity = pb->stage_capacity ? pb->stage_capacity * 2 : PLAN_INITIAL_STAGES;
+        Stage *stages = arena_alloc(pb->arena, sizeof(Stage) * capacity);
+        if (pb->stage_count > 0)
+            memcpy(stages, pb->stages, sizeof(Stage) * pb->stage_count);
+        pb->stages = stages;
+        pb->stage_capacity = capacity;
     }
 
-    cmd->args[cmd->arg_count] = strdup(arg); // Allocate and copy the argument string
-    if (!cmd->args[cmd->arg_count])
-    {
-        perror("Failed to duplicate argument string");
-        exit(EXIT_FAILURE);
-    }
+    Stage *stage = &pb->stages[pb->stage_count++];
+    memset(stage, 0, sizeof(Stage));
+    stage->argv = pb->argv.count;
+    stage->input = -1;
+    stage->output = -1;
+    pb->open = 1;
+    return stage;
+}
+
+// Function to add an argument to the open stage. The string is
+// borrowed, not copied: it must outlive the plan (normally it is a
+// token slice in the line arena).
+void plan_add_argument(PlanBuilder *pb, char *arg)
+{
+    Stage *stage = plan_stage(pb);
+    AV_append(pb->arena, &pb->argv, arg);
+    stage->argc++;
+}
+
+// Function to add several arguments to the open stage, with at most
+// one growth of the pool (see argvec.h)
+void plan_add_arguments(PlanBuilder *pb, char *const *args, size_t count)
+{
+    Stage *stage = plan_stage(pb);
+    AV_append_all(pb->arena, &pb->argv, args, count);
+    stage->argc += (int)count;
+}
 
-    cmd->arg_count++;
+// Function to get a stage's arguments while the plan is being built
+char **plan_stage_args(const PlanBuilder *pb, const Stage *stage)
+{
+    return pb->argv.args + stage->argv;
+}
+
+// Function to drop a stage's first arguments, as when a prefix such
+// as "timeout N" is consumed. Their slots are left behind in the
+// pool, and are not packed into the plan.
+void plan_drop_arguments(Stage *stage, int n)
+{
+    stage->argv += n;
+    stage->argc -= n;
 }
 
-// Function to add a command to the pipeline
-void add_command_to_pipeline(Pipeline *pipeline, Command *cmd)
+// Function to close the open stage; its redirections (borrowed, like
+// arguments) go in the redirect table
+void plan_end_stage(PlanBuilder *pb, char *input_file, char *output_file)
 {
-    if (!pipeline || !cmd)
-        return; // Check for null pointers
+    Stage *stage = plan_stage(pb);
 
-    if (pipeline->command == NULL)
+    if (input_file != NULL)
     {
-        pipeline->command = cmd; // Set first command in pipeline
+        stage->input = pb->redirects.count;
+        AV_append(pb->arena, &pb->redirects, input_file);
     }
-    else
+    if (output_file != NULL)
     {
-        Command *last = pipeline->command;
-        while (last->next != NULL)
-        {
-            last = last->next; // Traverse to the end of the command list
-        }
-        last->next = cmd; // Link new command at the end
+        stage->output = pb->redirects.count;
+        AV_append(pb->arena, &pb->redirects, output_file);
     }
+    pb->open = 0;
 }
 
-// Function to set the input file for the pipeline
-void set_input_file(Pipeline *pipeline, const char *input_file)
+// Function to pack the closed stages into one block: the Plan, then
+// the argv pool (every stage's arguments, each run followed by its
+// NULL), the redirect table and the stages. The builder's arrays are
+// left to the arena.
+Plan *plan_finish(PlanBuilder *pb)
 {
-    if (!pipeline || !input_file)
-        return; // Check for null pointers
-
-    if (pipeline->input_file == NULL)
+    int stage_count = pb->stage_count - pb->open;
+    int argv_count = 0;
+    for (int i = 0; i < stage_count; i++)
+        argv_count += pb->stages[i].argc + 1;
+
+    size_t size = sizeof(Plan) + sizeof(char *) * (argv_count + pb->redirects.count) +
+                  sizeof(Stage) * stage_count;
+    Plan *plan = arena_alloc(pb->arena, size);
+    plan->stage_count = stage_count;
+    plan->argv_count = argv_count;
+    plan->redirect_count = pb->redirects.count;
+    plan->background = 0;
+    plan->timeout_ms = 0;
+    plan->globs = 0;
+    plan->argv = (char **)(plan + 1);
+    plan->redirects = plan->argv + argv_count;
+    plan->stages = (Stage *)(plan->redirects + pb->redirects.count);
+
+    if (pb->redirects.count > 0)
+        memcpy(plan->redirects, pb->redirects.args, sizeof(char *) * pb->redirects.count);
+
+    // Stages copy as they are, but for where their arguments now start
+    int next = 0;
+    for (int i = 0; i < stage_count; i++)
     {
-        pipeline->input_file = strdup(input_file); // Allocate and copy the input file path
-        if (!pipeline->input_file)
-        {
-            perror("Failed to allocate memory for input file");
-            exit(EXIT_FAILURE);
-        }
+        Stage *stage = &plan->stages[i];
+        *stage = pb->stages[i];
+        if (stage->argc > 0)
+            memcpy(plan->argv + next, plan_stage_args(pb, stage), sizeof(char *) * stage->argc);
+        stage->argv = next;
+        next += stage->argc;
+        plan->argv[next++] = NULL;
     }
+    return plan;
 }
 
-// Function to set the output file for the pipeline
-void set_output_file(Pipeline *pipeline, const char *output_file)
+// Bytes of a plan's block, without its strings
+static size_t _plan_block_size(const Plan *plan)
 {
-    if (!pipeline || !output_file)
-        return; // Check for null pointers
+    return sizeof(Plan) + sizeof(char *) * (plan->argv_count + plan->redirect_count) +
+           sizeof(Stage) * plan->stage_count;
+}
 
-    if (pipeline->output_file == NULL)
+// Function to size a self-contained copy: the block, then every
+// string the argv pool and redirect table point to
+size_t plan_size(const Plan *plan)
+{
+    size_t size = _plan_block_size(plan);
+    for (int i = 0; i < plan->argv_count; i++)
     {
-        pipeline->output_file = strdup(output_file); // Allocate and copy the output file path
-        if (!pipeline->output_file)
-        {
-            perror("Failed to allocate memory for output file");
-            exit(EXIT_FAILURE);
-        }
+        if (plan->argv[i] != NULL)
+            size += strlen(plan->argv[i]) + 1;
     }
+    for (int i = 0; i < plan->redirect_count; i++)
+        size += strlen(plan->redirects[i]) + 1;
+    return size;
 }
 
-// Function to free allocated memory for a command
-void free_command(Command *cmd)
+// Function to make a self-contained copy of plan in mem, which must
+// have plan_size(plan) bytes
+Plan *plan_copy(void *mem, const Plan *plan)
 {
-    if (cmd)
+    Plan *copy = mem;
+    *copy = *plan;
+    copy->argv = (char **)(copy + 1);
+    copy->redirects = copy->argv + plan->argv_count;
+    copy->stages = (Stage *)(copy->redirects + plan->redirect_count);
+    memcpy(copy->stages, plan->stages, sizeof(Stage) * plan->stage_count);
+
+    char *text = (char *)mem + _plan_block_size(plan);
+    for (int i = 0; i < plan->argv_count; i++)
     {
-        for (int i = 0; i < cmd->arg_count; i++)
+        copy->argv[i] = NULL;
+        if (plan->argv[i] != NULL)
         {
-            free(cmd->args[i]); // Free each argument string
+            size_t len = strlen(plan->argv[i]) + 1;
+            copy->argv[i] = memcpy(text, plan->argv[i], len);
+            text += len;
         }
-        free(cmd->args); // Free the arguments array
-        free(cmd);       // Free the command structure itself
     }
+    for (int i = 0; i < plan->redirect_count; i++)
+    {
+        size_t len = strlen(plan->redirects[i]) + 1;
+        copy->redirects[i] = memcpy(text, plan->redirects[i], len);
+        text += len;
+    }
+    return copy;
 }
 
-// Function to free allocated memory for a pipeline
-void free_pipeline(Pipeline *pipeline)
+// Function to copy a self-contained plan to mem: one memcpy, then its
+// pointers are moved along with it
+Plan *plan_clone(void *mem, const Plan *plan, size_t size)
 {
-    while (pipeline != NULL)
+    const char *from = (const char *)plan;
+    char *to = mem;
+    Plan *copy = memcpy(mem, plan, size);
+
+    copy->argv = (char **)(copy + 1);
+    copy->redirects = copy->argv + plan->argv_count;
+    copy->stages = (Stage *)(copy->redirects + plan->redirect_count);
+    for (int i = 0; i < plan->argv_count; i++)
     {
-        Pipeline *next_pipeline = pipeline->next;
-
-        free_command(pipeline->command); // Free the command in this pipeline
-
-        // Free input and output file paths if they exist
-        if (pipeline->input_file)
-            free(pipeline->input_file);
-
-        if (pipeline->output_file)
-            free(pipeline->output_file);
-
-        free(pipeline); // Free the pipeline structure itself
-
-        pipeline = next_pipeline; // Move to next pipeline segment
+        if (plan->argv[i] != NULL)
+            copy->argv[i] = to + (plan->argv[i] - from);
     }
+    for (int i = 0; i < plan->redirect_count; i++)
+        copy->redirects[i] = to + (plan->redirects[i] - from);
+    return copy;
 }
@@ -2,38 +2,89 @@
 #define AST_H
 
 #include <stddef.h>
-#include "clist.h"  // Assuming CList is defined in clist.h
-
-// Structure to represent a single command
-typedef struct Command {
-    char *command;         // The command itself (e.g., "cat")
-    CList arguments;       // A linked list of arguments
-    char **args;           // List of arguments (e.g., ["file1.txt"])
-    int arg_count;         // The count of arguments
-    struct Command *next;  // Pointer to the next command in the pipeline
-} Command;
-
-// Structure to represent the entire pipeline
-typedef struct Pipeline {
-    Command *command;      // A command in the pipeline
-    struct Pipeline *next; // Pointer to the next command in the pipeline
-    char *input_file;      // Input file for the pipeline (if any)
-    char *output_file;     // Output file for the pipeline
-} Pipeline;
-
-// Abstract Syntax Tree (AST) node
-typedef struct ASTNode {
-    Pipeline *pipeline;    // Pointer to the pipeline
-    char *command;         // Valid if type == COMMAND_NODE
-    char **args;           // Arguments for the command
-    struct ASTNode *next;  // Pointer to the next AST node
-} ASTNode;
-
-// Function prototypes
-Command *create_command();                  // Create a new command
-void add_argument_to_command(Command *cmd, const char *arg);  // Add an argument to a command
-void add_command_to_pipeline(Pipeline *pipeline, Command *cmd);  // Add a command to the pipeline
-void set_input_file(Pipeline *pipeline, const char *input_file);  // Set input file for the pipeline
-void set_output_file(Pipeline *pipeline, const char *output_file);  // Set output file for the pipeline
+#include "arena.h"
+#include "argvec.h"
+
+// One stage of a pipeline. Everything it refers to is an offset into
+// its plan's tables, so stages are plain values: a pipeline is walked
+// by indexing, never by following pointers.
+typedef struct Stage {
+    int argv;              // Offset of its arguments in the plan's argv pool
+    int argc;              // How many (e.g., 2 for ["cat", "file1.txt"]); the
+                           // pool holds a NULL right after them, for exec
+    int input;             // Index of its < file in the redirect table, or -1
+    int output;            // Index of its > file, or -1
+    int batch;             // Leading "batch": run as often as the arguments
+                           // need to fit in ARG_MAX (see batch.h)
+    int batch_jobs;        // Runs at once: 1, or batch -P N's N (0 for one per CPU)
+    int batch_stdin;       // batch -0: more arguments from stdin, NUL-separated
+    int split_start;       // argv[split_start..split_end) are divided among
+    int split_end;         // the runs; every run gets the others
+} Stage;
+
+// A parsed command line, ready to run: the stages in pipeline order
+// and the tables they index, all in one arena block
+typedef struct Plan {
+    int stage_count;
+    int argv_count;        // Slots in argv, the stages' NULLs included
+    int redirect_count;
+    int background;        // Trailing &: run without waiting
+    long timeout_ms;       // Leading "timeout N": kill after N, or 0
+    int globs;             // Words that were patterns (see globcache.h): the
+                           // plan holds what they matched when it was made
+    Stage *stages;         // stage_count stages
+    char **argv;           // The argv pool: each stage's arguments, then a NULL
+    char **redirects;      // The redirect table: file names of < and >
+} Plan;
+
+// A stage's arguments, NULL-terminated: its argv for exec
+static inline char **plan_args(const Plan *plan, const Stage *stage)
+{
+    return plan->argv + stage->argv;
+}
+
+// A stage's < file, or NULL
+static inline char *plan_input_file(const Plan *plan, const Stage *stage)
+{
+    return stage->input >= 0 ? plan->redirects[stage->input] : NULL;
+}
+
+// A stage's > file, or NULL
+static inline char *plan_output_file(const Plan *plan, const Stage *stage)
+{
+    return stage->output >= 0 ? plan->redirects[stage->output] : NULL;
+}
+
+// A plan under construction. Stages are opened, given arguments and
+// closed one at a time; the open stage's arguments are always the
+// tail of the argv pool. plan_finish then packs everything into one
+// block.
+typedef struct PlanBuilder {
+    Arena *arena;
+    ArgVec argv;           // The argv pool so far, without the NULLs
+    ArgVec redirects;      // The redirect table so far
+    Stage *stages;         // The stages so far, the open one last
+    int stage_count;
+    int stage_capacity;
+    int open;              // Nonzero while the last stage takes arguments
+} PlanBuilder;
+
+// Function prototypes. Everything is allocated from the line arena
+// and released when it is reset; there are no free functions.
+void plan_builder_init(PlanBuilder *pb, Arena *arena);  // Start an empty plan
+Stage *plan_stage(PlanBuilder *pb);  // The open stage, opening a new one if there is none
+void plan_add_argument(PlanBuilder *pb, char *arg);  // Add a (borrowed) argument to the open stage
+void plan_add_arguments(PlanBuilder *pb, char *const *args, size_t count);  // Add several, in one copy
+char **plan_stage_args(const PlanBuilder *pb, const Stage *stage);  // A stage's arguments so far (not NULL-terminated)
+void plan_drop_arguments(Stage *stage, int n);  // Drop a stage's first n arguments
+void plan_end_stage(PlanBuilder *pb, char *input_file, char *output_file);  // Close the open stage with its (borrowed) redirections
+Plan *plan_finish(PlanBuilder *pb);  // Pack the closed stages into a plan
+
+// Copies of a plan that keep it beyond the line arena (see plancache.h).
+// A self-contained plan carries its strings in the same block, after
+// the stages, so that the block can be copied as it is.
+size_t plan_size(const Plan *plan);  // Bytes for a self-contained copy of plan
+Plan *plan_copy(void *mem, const Plan *plan);  // Make one in mem, plan_size bytes
+Plan *plan_clone(void *mem, const Plan *plan, size_t size);  // Copy a self-contained plan of size bytes to mem
 
 #endif // AST_H
@@ -0,0 +1,226 @@
+// batch.c
+#define _GNU_SOURCE  // O_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "batch.h"
+#include "linereader.h"
+
+extern char **environ;
+
+// Left free below ARG_MAX, as xargs does, for what the kernel adds
+#define BATCH_HEADROOM 2048
+
+// One command's runs
+typedef struct Batch {
+    const Stage *stage;
+    char **args;           // The stage's arguments
+    const char *exe_path;
+    int null_stdin;        // Runs get /dev/null as stdin (-0)
+    size_t budget;         // Bytes the divided arguments of one run may take
+    int max_jobs;          // Runs at once
+    int running;
+    int stopped;           // A run could not be started; start no more
+    int status;            // As batch_run returns it, so far
+    char **items;          // The next run's divided arguments
+    int count;
+    int capacity;
+    int owned;             // items were allocated here, and are freed
+    size_t bytes;          // What items take
+} Batch;
+
+// What an argument takes of ARG_MAX: its bytes, its NUL, its pointer
+static size_t arg_cost(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+// Fold a run's outcome into the batch's status
+static void note_status(Batch *b, int code) {
+    if (code == 0)
+        return;
+    if (code < 126)
+        code = BATCH_FAILED;
+    if (code > b->status)
+        b->status = code;
+}
+
+// Reap one finished run. A run killed by a signal stops the batch,
+// as it does xargs: no more runs are started.
+static void reap_one(Batch *b) {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, 0)) == -1 && errno == EINTR)
+        ;
+    if (pid == -1) {
+        b->running = 0;
+        return;
+    }
+    b->running--;
+    if (WIFSIGNALED(status)) {
+        b->stopped = 1;
+        note_status(b, 128 + WTERMSIG(status));
+    } else {
+        note_status(b, WEXITSTATUS(status));
+    }
+}
+
+// Start a run with the collected items, once a slot is free
+static void start_run(Batch *b) {
+    const Stage *stage = b->stage;
+    int suffix = stage->argc - stage->split_end;
+    char **argv = malloc((stage->split_start + b->count + suffix + 1) * sizeof(char *));
+    if (argv == NULL) {
+        perror("batch");
+        b->stopped = 1;
+        note_status(b, 126);
+        return;
+    }
+
+    memcpy(argv, b->args, stage->split_start * sizeof(char *));
+    memcpy(argv + stage->split_start, b->items, b->count * sizeof(char *));
+    memcpy(argv + stage->split_start + b->count, b->args + stage->split_end,
+           suffix * sizeof(char *));
+    argv[stage->split_start + b->count + suffix] = NULL;
+
+    while (b->running >= b->max_jobs)
+        reap_one(b);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (b->null_stdin)
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    pid_t pid;
+    int err;
+    if (b->exe_path != NULL)
+        err = posix_spawn(&pid, b->exe_path, &actions, NULL, argv, environ);
+    else
+        err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        fprintf(stderr, "batch: %s: %s\n", argv[0], strerror(err));
+        b->stopped = 1;
+        note_status(b, err == ENOENT ? 127 : 126);
+    } else {
+        b->running++;
+    }
+
+    // posix_spawn has returned, so the child has its own copies
+    free(argv);
+    if (b->owned) {
+        for (int i = 0; i < b->count; i++)
+            free(b->items[i]);
+    }
+    b->count = 0;
+    b->bytes = 0;
+}
+
+// Add an argument to the next run, first starting the current one if
+// it would not fit. Takes ownership of item if b->owned.
+static void add_item(Batch *b, char *item) {
+    size_t cost = arg_cost(item);
+
+    if (cost > b->budget) {
+        fprintf(stderr, "batch: an argument of %zu bytes does not fit in ARG_MAX\n",
+                strlen(item));
+        b->stopped = 1;
+        note_status(b, 126);
+    } else if (b->count > 0 && b->bytes + cost > b->budget) {
+        start_run(b);
+    }
+    if (b->stopped) {
+        if (b->owned)
+            free(item);
+        return;
+    }
+
+    if (b->count == b->capacity) {
+        int capacity = b->capacity ? b->capacity * 2 : 1024;
+        char **items = realloc(b->items, capacity * sizeof(char *));
+        if (items == NULL) {
+            perror("batch");
+            b->stopped = 1;
+            note_status(b, 126);
+            if (b->owned)
+                free(item);
+            return;
+        }
+        b->items = items;
+        b->capacity = capacity;
+    }
+    b->items[b->count++] = item;
+    b->bytes += cost;
+}
+
+// Documented in .h file
+int batch_run(const Plan *plan, const Stage *stage, const char *exe_path) {
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.stage = stage;
+    b.args = plan_args(plan, stage);
+    b.exe_path = exe_path;
+    b.null_stdin = b.owned = stage->batch_stdin;
+    b.max_jobs = stage->batch_jobs;
+    if (b.max_jobs == 0) {   // -P 0
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        b.max_jobs = n > 0 ? (int)n : 1;
+    }
+
+    // Every run carries the environment and the undivided arguments
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t fixed = BATCH_HEADROOM + 2 * sizeof(char *);
+    for (char **env = environ; *env != NULL; env++)
+        fixed += arg_cost(*env);
+    for (int i = 0; i < stage->argc; i++) {
+        if (i < stage->split_start || i >= stage->split_end)
+            fixed += arg_cost(b.args[i]);
+    }
+    if (arg_max <= 0 || fixed >= (size_t)arg_max) {
+        fprintf(stderr, "batch: the environment and fixed arguments alone exceed ARG_MAX\n");
+        return 126;
+    }
+    b.budget = arg_max - fixed;
+
+    if (stage->batch_stdin) {
+        LineReader lr = LR_new(STDIN_FILENO);
+        if (lr == NULL) {
+            perror("batch");
+            return 126;
+        }
+        LR_set_delimiter(lr, '\0');
+        char *item;
+        while (!b.stopped && (item = LR_next(lr, NULL)) != NULL) {
+            char *copy = strdup(item);
+            if (copy == NULL) {
+                perror("batch");
+                note_status(&b, 126);
+                break;
+            }
+            add_item(&b, copy);
+        }
+        LR_free(lr);
+    } else {
+        for (int i = stage->split_start; i < stage->split_end && !b.stopped; i++)
+            add_item(&b, b.args[i]);
+    }
+
+    // The last, partial run; without -0 there is always at least one
+    if (!b.stopped && (b.count > 0 || !stage->batch_stdin))
+        start_run(&b);
+    while (b.running > 0)
+        reap_one(&b);
+
+    if (b.owned) {
+        for (int i = 0; i < b.count; i++)
+            free(b.items[i]);
+    }
+    free(b.items);
+    return b.status;
+}
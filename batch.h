@@ -0,0 +1,46 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ast.h"
+
+/*
+ * batch [-P N] [-0] command [args...]: run a command whose arguments
+ * may be too many for one execve, as xargs would. The parser strips
+ * the prefix and marks the command (see parse.h); globs under it are
+ * not limited to ARG_MAX.
+ *
+ * The arguments that came from the command's largest glob expansion
+ * (or, without one, all of them) are divided among as few runs as fit:
+ * each run gets as many as ARG_MAX allows after the environment and the
+ * arguments every run gets, in order, and the runs are started in
+ * order. The undivided arguments before and after the divided ones
+ * keep their places, so "batch cp *.log dest/" gives every run its
+ * dest/. With -P N up to N runs go at once (0: one per online CPU);
+ * the default is one at a time. With -0 the divided arguments are read
+ * from stdin instead, separated by NULs (find -print0), and each run
+ * starts as soon as it is full; the runs then get /dev/null as stdin,
+ * and with no input the command is not run at all.
+ */
+
+// Exit status when a run failed, as xargs
+#define BATCH_FAILED 123
+
+/*
+ * Run a batch command to completion. Called in a child of the shell
+ * that is the pipeline stage, with its stdin and stdout in place.
+ *
+ * Parameters:
+ *   plan      The plan the stage is in
+ *   stage     The stage, with batch set
+ *   exe_path  The resolved executable, or NULL to search $PATH
+ *
+ * Returns: 0 if every run succeeded; otherwise the highest of 123 (a
+ *   run failed), 126 or 127 (the command could not be run, or an
+ *   argument can never fit) and 128+N (a run was killed by signal N;
+ *   no more runs were started). The caller is the stage, and should
+ *   then die of signal N itself, so that it is reported as any other
+ *   stage killed by that signal.
+ */
+int batch_run(const Plan *plan, const Stage *stage, const char *exe_path);
+
+#endif // BATCH_H
@@ -0,0 +1,602 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks for the shell's hot paths: the tokenizer, the
+ * parser (including glob expansion) and pipeline execution.
+ *
+ * Built by "make bench" without ASan, from its own -O2 objects.
+ *
+ * Usage: bench [-n rounds] [--json] [-o file] [--compare baseline.json [--threshold pct]]
+ *
+ *   -n rounds     How many times each corpus is run (default 50)
+ *   --json        Print results as JSON, one benchmark per line, to be
+ *                 saved as a baseline
+ *   -o file       Write the results to file instead of stdout
+ *   --compare f   Print each result next to the one in baseline f and
+ *                 exit with status 1 if any time or allocation count
+ *                 regressed by more than the threshold (default 10%)
+ *
+ * For each front-end corpus, "tokenize" times TOK_tokenize_input alone
+ * and "parse" times tokenize + parse_tokens, i.e. everything between
+ * readline and execute_pipeline; "cached" times the same lines served
+ * from the plan cache instead, as when they are run again. Both report
+ * ns and heap allocations (malloc/calloc/realloc calls, libc's own
+ * included) per line, with the line arena reset after each line as
+ * plaidsh does.
+ *
+ * The "exec" benchmarks time execute_pipeline from start to the last
+ * stage being reaped, for each launch backend and for an in-process
+ * builtin, and report the median and 99th percentile too.
+ */
+
+#define _GNU_SOURCE  // mkdtemp
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "tokvec.h"
+#include "Tokenize.h"
+#include "parse.h"
+#include "plancache.h"
+#include "pipeline.h"
+
+// Exec benchmarks run this many pipelines per launcher
+#define EXEC_RUNS 300
+
+// Longest benchmark name and how many results one run produces
+#define NAME_LEN 64
+#define MAX_RESULTS 32
+
+typedef struct Result {
+    char name[NAME_LEN];
+    double ns_per_op;
+    double allocs_per_op;
+    double p50_ns;  // 0 when not measured
+    double p99_ns;
+} Result;
+
+typedef struct Corpus {
+    const char *name;
+    char **lines;
+    int count;
+} Corpus;
+
+static Result results[MAX_RESULTS];
+static int result_count = 0;
+
+/*
+ * Allocation counting: malloc, calloc and realloc are interposed for
+ * the whole process and forwarded to glibc's implementation, so calls
+ * made inside libc (glob, stdio) are counted as well
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_calls = 0;
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+static unsigned long allocs_now(void) {
+    return __atomic_load_n(&alloc_calls, __ATOMIC_RELAXED);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Value at fraction q (0..1) of sorted samples
+static double percentile(const double *sorted, int n, double q) {
+    int i = (int)(q * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static Result *add_result(const char *name) {
+    if (result_count == MAX_RESULTS) {
+        fprintf(stderr, "bench: too many results\n");
+        exit(2);
+    }
+    Result *r = &results[result_count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    return r;
+}
+
+/*
+ * Corpora
+ */
+
+static void corpus_add(Corpus *c, const char *line) {
+    c->lines = realloc(c->lines, (c->count + 1) * sizeof(char *));
+    c->lines[c->count++] = strdup(line);
+}
+
+// What people type at the prompt
+static void build_short(Corpus *c) {
+    static const char *lines[] = {
+        "ls -l",
+        "pwd",
+        "echo hello world",
+        "cd /tmp",
+        "cat \"best sitcoms.txt\" | grep Seinfeld | wc -l",
+        "sed -ne \"s/The Simpsons/I Love Lucy/p\" < best\\ sitcoms.txt > output",
+        "grep -v foo < input.txt | sort | uniq -c | sort -rn | head",
+        "ps aux | grep plaidsh",
+        "make -j4 all",
+        "git log --oneline -n 20",
+    };
+    c->name = "short";
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+        corpus_add(c, lines[i]);
+}
+
+// One command with 10,000 arguments
+static void build_args10k(Corpus *c) {
+    size_t cap = 16 + 10000 * 8;
+    char *line = malloc(cap);
+    size_t len = snprintf(line, cap, "echo");
+    for (int i = 0; i < 10000; i++)
+        len += snprintf(line + len, cap - len, " arg%d", i);
+
+    c->name = "args10k";
+    corpus_add(c, line);
+    free(line);
+}
+
+// One pipeline of 256 stages, some redirected
+static void build_pipe256(Corpus *c) {
+    size_t cap = 256 * 32;
+    char *line = malloc(cap);
+    size_t len = snprintf(line, cap, "cat < in.txt");
+    for (int i = 1; i < 256; i++)
+        len += snprintf(line + len, cap - len, (i % 16 == 0) ? " | tee t%d.log" : " | grep -v x%d", i);
+    snprintf(line + len, cap - len, " > out.txt");
+
+    c->name = "pipe256";
+    corpus_add(c, line);
+    free(line);
+}
+
+// A generated command line of about a megabyte: long words, a few
+// of them quoted or escaped
+static void build_long(Corpus *c) {
+    size_t cap = (1 << 20) + 4096;
+    char *line = malloc(cap);
+    size_t len = snprintf(line, cap, "printf %%s");
+    for (int i = 0; len + 2200 < cap - 4096; i++) {
+        line[len++] = ' ';
+        if (i % 8 == 0)
+            line[len++] = '"';
+        for (int j = 0; j < 2000; j++)
+            line[len++] = 'a' + (i + j) % 26;
+        if (i % 8 == 0)
+            line[len++] = '"';
+        else if (i % 8 == 1)
+            len += snprintf(line + len, cap - len, "\\ x");
+    }
+    line[len] = '\0';
+
+    c->name = "long";
+    corpus_add(c, line);
+    free(line);
+}
+
+// Quoting and escapes on every word
+static void build_escaped(Corpus *c) {
+    c->name = "escaped";
+    for (int i = 0; i < 10; i++) {
+        char line[1024];
+        size_t len = snprintf(line, sizeof(line), "printf");
+        for (int j = 0; j < 12; j++)
+            len += snprintf(line + len, sizeof(line) - len,
+                            " \"a\\\"b\\\\c\\td %d\" x\\ y\\|z%d\\<\\>", i, j);
+        corpus_add(c, line);
+    }
+}
+
+// Patterns over a directory of 600 files; parse expands them
+static void build_glob(Corpus *c) {
+    static const char *lines[] = {
+        "ls *.c",
+        "wc -l *.c *.h",
+        "echo f1??.c",
+        "cat [a-f]*.txt | wc -l",
+        "rm -f *.o",
+    };
+    c->name = "glob";
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+        corpus_add(c, lines[i]);
+}
+
+// Create the directory build_glob's patterns run in, and enter it
+static char *make_glob_dir(void) {
+    static char dir[] = "/tmp/plaidsh_benchXXXXXX";
+    static const char *exts[] = { ".c", ".h", ".o", ".txt" };
+
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        perror("bench: glob directory");
+        exit(2);
+    }
+    for (int i = 0; i < 150; i++) {
+        for (int e = 0; e < 4; e++) {
+            char name[32];
+            snprintf(name, sizeof(name), "f%03d%s", i, exts[e]);
+            int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+    return dir;
+}
+
+static void remove_glob_dir(const char *dir) {
+    static const char *exts[] = { ".c", ".h", ".o", ".txt" };
+
+    for (int i = 0; i < 150; i++) {
+        for (int e = 0; e < 4; e++) {
+            char name[32];
+            snprintf(name, sizeof(name), "f%03d%s", i, exts[e]);
+            unlink(name);
+        }
+    }
+    if (chdir("/") == 0)
+        rmdir(dir);
+}
+
+/*
+ * Front end
+ */
+
+// Run the corpus through the tokenizer (and the parser if parse is
+// set) for the given number of rounds and record ns and allocations
+// per line
+static void bench_frontend(const Corpus *c, int parse, int rounds) {
+    char errmsg[256];
+    char name[NAME_LEN];
+    Arena arena;
+
+    arena_init(&arena, 4096);
+
+    // One warm-up round so the arena has reached its steady size
+    for (int i = 0; i < c->count; i++) {
+        TokVec tokens = TOK_tokenize_input(&arena, c->lines[i], errmsg, sizeof(errmsg));
+        if (tokens == NULL || (parse && parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)) == NULL)) {
+            fprintf(stderr, "bench: %s line %d: %s\n", c->name, i, errmsg);
+            exit(2);
+        }
+        arena_reset(&arena);
+    }
+
+    double *round_ns = malloc(rounds * sizeof(double));
+    unsigned long allocs = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a0 = allocs_now();
+        long long t0 = now_ns();
+        for (int i = 0; i < c->count; i++) {
+            TokVec tokens = TOK_tokenize_input(&arena, c->lines[i], errmsg, sizeof(errmsg));
+            if (parse)
+                parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+            arena_reset(&arena);
+        }
+        round_ns[r] = (double)(now_ns() - t0) / c->count;
+        allocs += allocs_now() - a0;
+    }
+
+    // The median round is the figure least disturbed by the machine
+    qsort(round_ns, rounds, sizeof(double), compare_doubles);
+
+    snprintf(name, sizeof(name), "%s/%s", parse ? "parse" : "tokenize", c->name);
+    Result *res = add_result(name);
+    res->ns_per_op = percentile(round_ns, rounds, 0.5);
+    res->allocs_per_op = (double)allocs / ((double)rounds * c->count);
+
+    free(round_ns);
+    arena_free(&arena);
+}
+
+// Run the corpus through the plan cache, once it holds every line,
+// and record ns and allocations per line. Lines the cache does not
+// keep (globs) are left out.
+static void bench_cached(const Corpus *c, int rounds) {
+    char errmsg[256];
+    char name[NAME_LEN];
+    Arena arena;
+    int kept = 0;
+
+    arena_init(&arena, 4096);
+    PLC_clear();
+    for (int i = 0; i < c->count; i++) {
+        TokVec tokens = TOK_tokenize_input(&arena, c->lines[i], errmsg, sizeof(errmsg));
+        PLC_store(c->lines[i], parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)));
+        arena_reset(&arena);
+        if (PLC_lookup(&arena, c->lines[i]) != NULL)
+            kept++;
+        arena_reset(&arena);
+    }
+    if (kept == 0) {
+        arena_free(&arena);
+        return;
+    }
+
+    double *round_ns = malloc(rounds * sizeof(double));
+    unsigned long allocs = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        unsigned long a0 = allocs_now();
+        long long t0 = now_ns();
+        for (int i = 0; i < c->count; i++) {
+            PLC_lookup(&arena, c->lines[i]);
+            arena_reset(&arena);
+        }
+        round_ns[r] = (double)(now_ns() - t0) / c->count;
+        allocs += allocs_now() - a0;
+    }
+
+    qsort(round_ns, rounds, sizeof(double), compare_doubles);
+
+    snprintf(name, sizeof(name), "cached/%s", c->name);
+    Result *res = add_result(name);
+    res->ns_per_op = percentile(round_ns, rounds, 0.5);
+    res->allocs_per_op = (double)allocs / ((double)rounds * c->count);
+
+    free(round_ns);
+    arena_free(&arena);
+    PLC_clear();
+}
+
+/*
+ * Execution
+ */
+
+// Time execute_pipeline on line, EXEC_RUNS times, with the given
+// launch backend
+static void bench_exec(const char *name, const char *line, LaunchMode mode) {
+    char errmsg[256];
+    Arena arena;
+    double samples[EXEC_RUNS];
+    unsigned long allocs = 0;
+
+    set_launch_mode(mode);
+    arena_init(&arena, 4096);
+
+    TokVec tokens = TOK_tokenize_input(&arena, line, errmsg, sizeof(errmsg));
+    Plan *plan = tokens ? parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)) : NULL;
+    if (plan == NULL) {
+        fprintf(stderr, "bench: %s: %s\n", line, errmsg);
+        exit(2);
+    }
+
+    // Keep the stages' diagnostics off the results
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDERR_FILENO);
+    close(devnull);
+
+    for (int i = 0; i < EXEC_RUNS; i++) {
+        unsigned long a0 = allocs_now();
+        long long t0 = now_ns();
+        execute_pipeline(plan, errmsg, sizeof(errmsg));
+        samples[i] = (double)(now_ns() - t0);
+        allocs += allocs_now() - a0;
+    }
+
+    fflush(stderr);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+
+    double total = 0;
+    for (int i = 0; i < EXEC_RUNS; i++)
+        total += samples[i];
+    qsort(samples, EXEC_RUNS, sizeof(double), compare_doubles);
+
+    Result *res = add_result(name);
+    res->ns_per_op = total / EXEC_RUNS;
+    res->allocs_per_op = (double)allocs / EXEC_RUNS;
+    res->p50_ns = percentile(samples, EXEC_RUNS, 0.5);
+    res->p99_ns = percentile(samples, EXEC_RUNS, 0.99);
+
+    arena_free(&arena);
+}
+
+/*
+ * Output and comparison
+ */
+
+static void print_json(void) {
+    printf("[\n");
+    for (int i = 0; i < result_count; i++) {
+        const Result *r = &results[i];
+        printf("{\"name\": \"%s\", \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "
+               "\"p50_ns\": %.1f, \"p99_ns\": %.1f}%s\n",
+               r->name, r->ns_per_op, r->allocs_per_op, r->p50_ns, r->p99_ns,
+               i + 1 < result_count ? "," : "");
+    }
+    printf("]\n");
+}
+
+static void print_table(void) {
+    printf("%-24s %14s %14s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "p50 ns", "p99 ns");
+    for (int i = 0; i < result_count; i++) {
+        const Result *r = &results[i];
+        printf("%-24s %14.1f %14.2f", r->name, r->ns_per_op, r->allocs_per_op);
+        if (r->p50_ns > 0)
+            printf(" %12.0f %12.0f", r->p50_ns, r->p99_ns);
+        printf("\n");
+    }
+}
+
+// Read a file written by --json. Returns the number of results read
+// into base, or -1 if the file can't be opened.
+static int load_baseline(const char *path, Result *base, int max) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    int n = 0;
+    char line[512];
+    while (n < max && fgets(line, sizeof(line), f) != NULL) {
+        Result *r = &base[n];
+        if (sscanf(line, "{\"name\": \"%63[^\"]\", \"ns_per_op\": %lf, \"allocs_per_op\": %lf",
+                   r->name, &r->ns_per_op, &r->allocs_per_op) == 3)
+            n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// Change from old to new in percent; positive is worse
+static double change(double old, double new) {
+    if (old == 0)
+        return new == 0 ? 0 : 100;
+    return (new - old) * 100 / old;
+}
+
+// Print the comparison table. Returns the number of regressions.
+static int compare(const Result *base, int base_count, double threshold) {
+    int regressions = 0;
+
+    printf("%-24s %12s %12s %8s %10s %10s %8s\n", "benchmark",
+           "base ns", "ns", "change", "base alloc", "alloc", "change");
+    for (int i = 0; i < result_count; i++) {
+        const Result *r = &results[i];
+        const Result *b = NULL;
+        for (int j = 0; j < base_count && b == NULL; j++) {
+            if (strcmp(base[j].name, r->name) == 0)
+                b = &base[j];
+        }
+        if (b == NULL) {
+            printf("%-24s %12s %12.1f\n", r->name, "-", r->ns_per_op);
+            continue;
+        }
+
+        double dt = change(b->ns_per_op, r->ns_per_op);
+        double da = change(b->allocs_per_op, r->allocs_per_op);
+        int bad = (dt > threshold) || (da > threshold && r->allocs_per_op - b->allocs_per_op >= 0.5);
+        printf("%-24s %12.1f %12.1f %+7.1f%% %10.2f %10.2f %+7.1f%%%s\n", r->name,
+               b->ns_per_op, r->ns_per_op, dt, b->allocs_per_op, r->allocs_per_op, da,
+               bad ? "  REGRESSION" : "");
+        regressions += bad;
+    }
+    return regressions;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench [-n rounds] [--json] [-o file] [--compare baseline.json [--threshold pct]]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 50;
+    int json = 0;
+    const char *baseline = NULL;
+    const char *output = NULL;
+    double threshold = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            baseline = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else
+            usage();
+    }
+    if (rounds < 1)
+        usage();
+
+    Corpus corpora[6];
+    memset(corpora, 0, sizeof(corpora));
+    build_short(&corpora[0]);
+    build_args10k(&corpora[1]);
+    build_escaped(&corpora[2]);
+    build_glob(&corpora[3]);
+    build_pipe256(&corpora[4]);
+    build_long(&corpora[5]);
+
+    char *glob_dir = make_glob_dir();
+
+    for (int parse = 0; parse <= 1; parse++) {
+        for (int c = 0; c < 6; c++)
+            bench_frontend(&corpora[c], parse, rounds);
+    }
+    for (int c = 0; c < 6; c++)
+        bench_cached(&corpora[c], rounds);
+
+    // The long line again with each slower scanner, for comparison
+    TokScanner best = TOK_get_scanner();
+    for (TokScanner scanner = TOK_SCAN_BYTES; scanner < best; scanner++) {
+        char name[NAME_LEN];
+        Corpus alt = corpora[5];
+        snprintf(name, sizeof(name), "long-%s", TOK_scanner_name(scanner));
+        alt.name = name;
+        if (TOK_set_scanner(scanner) == 0)
+            bench_frontend(&alt, 0, rounds);
+    }
+    TOK_set_scanner(best);
+
+    bench_exec("exec/fork", "/bin/true", LAUNCH_FORK);
+    bench_exec("exec/spawn", "/bin/true", LAUNCH_SPAWN);
+    bench_exec("exec/spawn-pipe3", "/bin/true | /bin/true | /bin/true", LAUNCH_SPAWN);
+    bench_exec("exec/builtin", "true", LAUNCH_SPAWN);
+
+    remove_glob_dir(glob_dir);
+
+    for (int c = 0; c < 6; c++) {
+        for (int i = 0; i < corpora[c].count; i++)
+            free(corpora[c].lines[i]);
+        free(corpora[c].lines);
+    }
+
+    if (output != NULL && freopen(output, "w", stdout) == NULL) {
+        fprintf(stderr, "bench: %s: %s\n", output, strerror(errno));
+        return 2;
+    }
+
+    if (baseline != NULL) {
+        Result base[MAX_RESULTS];
+        int base_count = load_baseline(baseline, base, MAX_RESULTS);
+        if (base_count < 0) {
+            fprintf(stderr, "bench: %s: %s\n", baseline, strerror(errno));
+            return 2;
+        }
+        return compare(base, base_count, threshold) > 0 ? 1 : 0;
+    }
+
+    if (json)
+        print_json();
+    else
+        print_table();
+    return 0;
+}
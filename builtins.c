@@ -0,0 +1,221 @@
+// builtins.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "pipeline.h"
+#include "pathcache.h"
+#include "plancache.h"
+#include "fastpath.h"
+#include "parallel.h"
+#include "jobs.h"
+#include "stats.h"
+#include "trace.h"
+
+// pwd: print the current directory
+static int builtin_pwd(int argc, char **argv, int in_fd, int out_fd) {
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        dprintf(out_fd, "%s\n", cwd);
+        return 0;
+    }
+    perror("pwd");
+    return 1;
+}
+
+// author: print the author's name
+static int builtin_author(int argc, char **argv, int in_fd, int out_fd) {
+    dprintf(out_fd, "Uwase Pauline\n");
+    return 0;
+}
+
+// cd [dir]: change directory, to $HOME by default
+static int builtin_cd(int argc, char **argv, int in_fd, int out_fd) {
+    const char *target_dir = (argc > 1) ? argv[1] : getenv("HOME");
+    if (target_dir == NULL || chdir(target_dir) != 0) {
+        perror("cd");
+        return 1;
+    }
+    return 0;
+}
+
+// hash: list the path cache; hash -r: empty it;
+// hash name...: look the names up and remember them
+static int builtin_hash(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1) {
+        PC_print(out_fd);
+        return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        PC_clear();
+        return 0;
+    }
+    int result = 0;
+    for (int i = 1; i < argc; i++) {
+        if (PC_lookup(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// plancache: list the cached lines and the hit rate; plancache -r:
+// empty it; plancache on|off: switch it
+static int builtin_plancache(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1) {
+        if (!PLC_enabled())
+            dprintf(out_fd, "plan cache off\n");
+        PLC_print(out_fd);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        PLC_clear();
+    } else if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        PLC_set_enabled(1);
+    } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        PLC_set_enabled(0);
+    } else {
+        fprintf(stderr, "usage: plancache [-r|on|off]\n");
+        return 2;
+    }
+    return 0;
+}
+
+// stats: show per-phase timings; stats -r: discard them
+static int builtin_stats(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1)
+        return stats_print(out_fd);
+    if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        stats_reset();
+        return 0;
+    }
+    fprintf(stderr, "usage: stats [-r]\n");
+    return 2;
+}
+
+// trace: show whether a trace is being written; trace FILE: start
+// writing one; trace off: finish it
+static int builtin_trace(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1) {
+        if (trace_enabled())
+            dprintf(out_fd, "tracing to %s\n", trace_path());
+        else
+            dprintf(out_fd, "tracing off\n");
+        return 0;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: trace [FILE|off]\n");
+        return 2;
+    }
+    if (strcmp(argv[1], "off") == 0) {
+        trace_stop();
+        return 0;
+    }
+    if (trace_start(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
+
+// set -o pipefail / set +o pipefail; set -o lists the options
+static int builtin_set(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 2 && strcmp(argv[1], "-o") == 0) {
+        dprintf(out_fd, "pipefail\t%s\n", get_pipefail() ? "on" : "off");
+        return 0;
+    }
+    if (argc != 3 || (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0)) {
+        fprintf(stderr, "usage: set [-o|+o] [pipefail]\n");
+        return 2;
+    }
+    if (strcmp(argv[2], "pipefail") != 0) {
+        fprintf(stderr, "set: %s: unknown option\n", argv[2]);
+        return 1;
+    }
+    set_pipefail(argv[1][0] == '-');
+    return 0;
+}
+
+// launcher: show how externals are started; launcher fork|spawn: choose
+static int builtin_launcher(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1) {
+        dprintf(out_fd, "%s\n", launch_mode_name(get_launch_mode()));
+        return 0;
+    }
+    LaunchMode mode;
+    if (parse_launch_mode(argv[1], &mode) != 0) {
+        fprintf(stderr, "launcher: expected fork or spawn\n");
+        return 1;
+    }
+    set_launch_mode(mode);
+    return 0;
+}
+
+// fastpath: show whether echo/cat/true/false/wc run in-process;
+// fastpath on|off: switch them
+static int builtin_fastpath(int argc, char **argv, int in_fd, int out_fd) {
+    if (argc == 1) {
+        dprintf(out_fd, "%s\n", fastpath_enabled() ? "on" : "off");
+        return 0;
+    }
+    if (strcmp(argv[1], "on") == 0) {
+        set_fastpath_enabled(1);
+    } else if (strcmp(argv[1], "off") == 0) {
+        set_fastpath_enabled(0);
+    } else {
+        fprintf(stderr, "fastpath: expected on or off\n");
+        return 1;
+    }
+    return 0;
+}
+
+// exit [n], quit [n]: leave the shell, with status n (default 0).
+// The shell itself ends in execute_pipeline (see Builtin.ends_shell).
+static int builtin_exit(int argc, char **argv, int in_fd, int out_fd) {
+    return argc > 1 ? atoi(argv[1]) & 0xff : 0;
+}
+
+static const Builtin builtins[] = {
+    { "pwd", builtin_pwd },
+    { "author", builtin_author },
+    { "cd", builtin_cd, .shell = 1 },
+    { "hash", builtin_hash, .shell = 1 },
+    { "plancache", builtin_plancache },
+    { "launcher", builtin_launcher },
+    { "set", builtin_set, .shell = 1 },
+    { "fastpath", builtin_fastpath },
+    { "stats", builtin_stats },
+    { "trace", builtin_trace },
+    { "parallel", builtin_parallel },
+    { "jobs", builtin_jobs },
+    { "fg", builtin_fg, .shell = 1 },
+    { "bg", builtin_bg, .shell = 1 },
+    { "wait", builtin_wait, .shell = 1 },
+    { "exit", builtin_exit, .shell = 1, .ends_shell = 1 },
+    { "quit", builtin_exit, .shell = 1, .ends_shell = 1 },
+
+    // Fork-free stand-ins for external utilities
+    { "echo", fastpath_echo, fastpath_echo_accepts, 1 },
+    { "cat", fastpath_cat, fastpath_cat_accepts, 1 },
+    { "true", fastpath_true, NULL, 1 },
+    { "false", fastpath_false, NULL, 1 },
+    { "wc", fastpath_wc, fastpath_wc_accepts, 1 },
+};
+
+// Documented in .h file
+const Builtin *find_builtin(int argc, char **argv) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        const Builtin *b = &builtins[i];
+
+        if (strcmp(b->name, argv[0]) != 0)
+            continue;
+        if (b->fastpath && !fastpath_enabled())
+            return NULL;
+        if (b->accepts != NULL && !b->accepts(argc, argv))
+            return NULL;
+        return b;
+    }
+    return NULL;
+}
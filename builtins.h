@@ -0,0 +1,55 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+/*
+ * A builtin command. Builtins run inside the shell process, either
+ * directly (when they are the last stage of a pipeline) or on a
+ * thread, or else in a child of their own (see Builtin.shell), and
+ * talk to the rest of the pipeline only through the file descriptors
+ * they are given.
+ *
+ * Parameters:
+ *   argc     Number of arguments, including the command name
+ *   argv     NULL-terminated argument vector
+ *   in_fd    Descriptor to read input from
+ *   out_fd   Descriptor to write output to
+ *
+ * Returns: The exit status of the builtin (0 for success)
+ */
+typedef int (*BuiltinFn)(int argc, char **argv, int in_fd, int out_fd);
+
+typedef struct Builtin {
+    const char *name;  // Command name
+    BuiltinFn fn;      // Implementation
+
+    // For fork-free stand-ins of external utilities (see fastpath.h):
+    // whether the builtin can handle this argv; NULL for shell builtins
+    int (*accepts)(int argc, char **argv);
+    int fastpath;      // Nonzero for stand-ins, which can be switched off
+
+    // Nonzero for builtins that change the shell itself (cd, set,
+    // hash, fg, ...). Only a lone stage runs in the shell, where the
+    // change sticks; in a pipeline such a stage gets a child of its
+    // own, as in a subshell, instead of racing the other stages.
+    int shell;
+
+    // Nonzero for exit: run by the shell as the whole command line,
+    // the builtin's status ends the shell. Anywhere else (a pipeline
+    // stage, a background job) it is only the stage's status.
+    int ends_shell;
+} Builtin;
+
+/*
+ * Look up the builtin that should run a command
+ *
+ * Parameters:
+ *   argc     Number of arguments, including the command name
+ *   argv     The command's argument vector
+ *
+ * Returns: The builtin, or NULL if the command should be run as an
+ *   external program (not a builtin, a fast path that is switched
+ *   off, or arguments the fast path does not handle)
+ */
+const Builtin *find_builtin(int argc, char **argv);
+
+#endif // BUILTINS_H
@@ -15,7 +15,10 @@
 #include "Token.h"
 
 
+// Debug checks; release builds define NDEBUG and compile them out
+#ifndef NDEBUG
 #define DEBUG
+#endif
 
 struct _cl_node {
   CListElementType element;
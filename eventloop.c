@@ -0,0 +1,296 @@
+// eventloop.c
+#define _GNU_SOURCE  // pidfd_open
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "eventloop.h"
+#include "jobs.h"
+#include "stats.h"
+
+// epoll tags for the non-stage descriptors
+#define TAG_TIMER   (-1)
+#define TAG_SIGCHLD (-2)
+
+// Process group of the running foreground pipeline, for the handlers;
+// 0 while there is none
+static volatile sig_atomic_t fg_pgid = 0;
+static volatile sig_atomic_t interrupted = 0;
+static volatile sig_atomic_t alarm_fired = 0;
+
+// Ctrl-C belongs to the pipeline, not to the shell
+static void sigint_handler(int sig) {
+    int saved_errno = errno;
+    interrupted = 1;
+    if (fg_pgid > 0)
+        kill(-fg_pgid, SIGINT);
+    errno = saved_errno;
+}
+
+// The fallback loop's timeout
+static void sigalrm_handler(int sig) {
+    int saved_errno = errno;
+    alarm_fired = 1;
+    if (fg_pgid > 0)
+        kill(-fg_pgid, SIGTERM);
+    errno = saved_errno;
+}
+
+// Documented in .h file
+void eventloop_init(void) {
+    // A builtin writing to a closed pipe gets EPIPE rather than taking
+    // the shell down; children get the default back
+    signal(SIGPIPE, SIG_IGN);
+
+    // Not restarting: a builtin running in the shell, blocked reading
+    // the terminal, must see its read fail with EINTR to stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigint_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+
+    sa.sa_handler = sigalrm_handler;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+}
+
+// Documented in .h file
+int eventloop_interrupted(void) {
+    int was = interrupted;
+    interrupted = 0;
+    return was;
+}
+
+// Documented in .h file
+int eventloop_interrupt_pending(void) {
+    return interrupted;
+}
+
+// Nonzero while stage is a child that has not been reaped
+static int stage_running(const StageStatus *stage) {
+    return stage->pid > 0 && stage->exit_ns == 0;
+}
+
+// Nonzero if stage i is the only one of the pipeline still running
+static int last_running(const StageStatus *stages, int count, int i) {
+    for (int j = 0; j < count; j++) {
+        if (j != i && stage_running(&stages[j]))
+            return 0;
+    }
+    return 1;
+}
+
+// Tear down stages whose reader has gone. A stage writing into the
+// pipe of a stage that has ended would get SIGPIPE on its next write;
+// it gets it now, so that a producer that is busy computing, or
+// blocked on its own input, does not keep running for nothing (the
+// "producer | head -1" case). Stages that ignore SIGPIPE go on, as they
+// would have anyway. A stage leading the pipeline's group, once no
+// other stage is left in it, gets it as a group, so that what it
+// started (the command under sh -c) goes with it.
+static void cut_off_upstream(pid_t pgid, StageStatus *stages, int count) {
+    for (int i = count - 2; i >= 0; i--) {
+        if (stage_running(&stages[i]) && stages[i].to_next && !stages[i].cut_off &&
+            !stage_running(&stages[i + 1])) {
+            int group = pgid > 0 && stages[i].pid == pgid &&
+                        last_running(stages, count, i);
+            kill(group ? -pgid : stages[i].pid, SIGPIPE);
+            stages[i].cut_off = 1;
+        }
+    }
+}
+
+// Collect every stage that has exited or stopped, without blocking.
+// Returns the number still running; sets *stopped if one stopped.
+static int reap_stages(pid_t pgid, StageStatus *stages, int count, int *pidfds,
+                       int *stopped) {
+    int running = 0;
+
+    for (int i = 0; i < count; i++) {
+        // Not a child, or already reaped
+        if (!stage_running(&stages[i]))
+            continue;
+
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(stages[i].pid, &status, WNOHANG | WUNTRACED, &usage);
+        if (pid == 0 || (pid == -1 && errno == EINTR)) {
+            running++;
+        } else if (pid > 0 && WIFSTOPPED(status)) {
+            *stopped = 1;
+            running++;
+        } else {
+            // Exited, or (pid -1) reaped by someone else: either way done
+            if (pid > 0) {
+                stages[i].status = status;
+                stages[i].usage = usage;
+            }
+            stages[i].exit_ns = stats_now();
+            if (pidfds != NULL && pidfds[i] != -1) {
+                close(pidfds[i]);
+                pidfds[i] = -1;
+            }
+        }
+    }
+
+    cut_off_upstream(pgid, stages, count);
+    return running;
+}
+
+// Without pidfds: block in wait4 on the group, with SIGALRM for the
+// timeout
+static WaitResult wait_fallback(pid_t pgid, StageStatus *stages, int count,
+                                uint64_t timeout_ns) {
+    int running = 0;
+    for (int i = 0; i < count; i++)
+        running += (stages[i].pid > 0);
+
+    cut_off_upstream(pgid, stages, count);
+
+    alarm_fired = 0;
+    if (timeout_ns != 0) {
+        struct itimerval it = { { 0, 0 }, { timeout_ns / 1000000000,
+                                            (timeout_ns % 1000000000) / 1000 } };
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+
+    WaitResult result = WAIT_EXITED;
+    while (running > 0) {
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(pgid > 0 ? -pgid : 0, &status, WUNTRACED, &usage);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("wait4");
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (stages[i].pid == pid) {
+                if (WIFSTOPPED(status)) {
+                    result = WAIT_STOPPED;
+                } else {
+                    stages[i].status = status;
+                    stages[i].exit_ns = stats_now();
+                    stages[i].usage = usage;
+                    running--;
+                    cut_off_upstream(pgid, stages, count);
+                }
+                break;
+            }
+        }
+        if (result == WAIT_STOPPED)
+            break;
+    }
+
+    if (timeout_ns != 0) {
+        struct itimerval off = { { 0, 0 }, { 0, 0 } };
+        setitimer(ITIMER_REAL, &off, NULL);
+    }
+    if (result == WAIT_EXITED && alarm_fired)
+        result = WAIT_TIMED_OUT;
+    return result;
+}
+
+// Add fd to the epoll set under tag
+static int watch(int epfd, int fd, int tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)tag;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Documented in .h file
+WaitResult eventloop_wait(pid_t pgid, StageStatus *stages, int count,
+                          uint64_t timeout_ns) {
+    int pidfds[count];
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = -1;
+    int ok = (epfd != -1);
+
+    for (int i = 0; i < count; i++) {
+        pidfds[i] = -1;
+        if (ok && stages[i].pid > 0) {
+            pidfds[i] = pidfd_open(stages[i].pid, 0);
+            if (pidfds[i] == -1 || watch(epfd, pidfds[i], i) == -1)
+                ok = 0;
+        }
+    }
+
+    // SIGCHLD wakes us for stages that stop, which pidfds do not report
+    int sigchld_fd = jobs_sigchld_fd();
+    if (ok && sigchld_fd != -1 && watch(epfd, sigchld_fd, TAG_SIGCHLD) == -1)
+        ok = 0;
+
+    if (ok && timeout_ns != 0) {
+        struct itimerspec it;
+        memset(&it, 0, sizeof(it));
+        it.it_value.tv_sec = timeout_ns / 1000000000;
+        it.it_value.tv_nsec = timeout_ns % 1000000000;
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (timer_fd == -1 || timerfd_settime(timer_fd, 0, &it, NULL) == -1 ||
+            watch(epfd, timer_fd, TAG_TIMER) == -1)
+            ok = 0;
+    }
+
+    fg_pgid = (pgid > 0) ? pgid : 0;
+
+    WaitResult result;
+    if (!ok) {
+        for (int i = 0; i < count; i++) {
+            if (pidfds[i] != -1)
+                close(pidfds[i]);
+        }
+        result = wait_fallback(pgid, stages, count, timeout_ns);
+    } else {
+        int timed_out = 0, stopped = 0;
+        int running = reap_stages(pgid, stages, count, pidfds, &stopped);
+
+        while (running > 0 && !stopped) {
+            struct epoll_event events[16];
+            int n = epoll_wait(epfd, events, 16, -1);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int e = 0; e < n; e++) {
+                int tag = (int)events[e].data.u32;
+                if (tag == TAG_TIMER) {
+                    timed_out = 1;
+                    kill(-pgid, SIGTERM);
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, timer_fd, NULL);
+                } else if (tag == TAG_SIGCHLD) {
+                    // Drains the pipe, and collects background jobs too
+                    jobs_reap();
+                }
+            }
+            running = reap_stages(pgid, stages, count, pidfds, &stopped);
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (pidfds[i] != -1)
+                close(pidfds[i]);
+        }
+        result = stopped ? WAIT_STOPPED : timed_out ? WAIT_TIMED_OUT : WAIT_EXITED;
+    }
+
+    fg_pgid = 0;
+    if (timer_fd != -1)
+        close(timer_fd);
+    if (epfd != -1)
+        close(epfd);
+    return result;
+}
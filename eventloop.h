@@ -0,0 +1,92 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "pipeline.h"
+
+/*
+ * Waiting on a foreground pipeline. Every stage's pidfd goes into one
+ * epoll set, together with a timerfd for the pipeline's timeout and
+ * the SIGCHLD self-pipe (for stages that stop rather than exit), so a
+ * stage is reaped with its rusage the moment it exits, in any order.
+ * Kernels without pidfd_open fall back to a blocking wait4 loop, with
+ * the timeout delivered by SIGALRM.
+ *
+ * When a stage exits, the stages writing into its pipe are sent
+ * SIGPIPE at once instead of at their next write, so "producer | head"
+ * ends when head does. Only the stage process itself is signalled,
+ * unless it leads the pipeline's process group and is the last stage
+ * left in it; then the group is. Otherwise, what a stage started (the
+ * command under "sh -c", say) lives on until its own next write.
+ *
+ * Ctrl-C never kills the shell: SIGINT is caught, and forwarded to
+ * the pipeline's process group while one is running. It interrupts
+ * system calls rather than restarting them, so a builtin running in
+ * the shell stops too: its reads and writes fail with EINTR, and it
+ * gives up if eventloop_interrupt_pending says so. SIGPIPE is ignored
+ * by the shell.
+ */
+
+// How a wait ended
+typedef enum WaitResult {
+    WAIT_EXITED,     // Every stage has exited
+    WAIT_TIMED_OUT,  // The timeout fired; the group got SIGTERM and
+                     // every stage has exited since
+    WAIT_STOPPED     // A stage stopped (^Z); the rest were not waited for
+} WaitResult;
+
+
+/*
+ * Install the shell's signal handling. Call once, early.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void eventloop_init(void);
+
+
+/*
+ * Wait for the stages of a foreground pipeline. Stages with a pid of
+ * -1 (builtins, failed launches) are skipped. As each stage exits, its
+ * status, exit_ns and usage are filled in and its pid is left as is.
+ *
+ * Parameters:
+ *   pgid        The pipeline's process group, or -1 if its stages run
+ *               in the shell's own; SIGINT and the timeout's SIGTERM go
+ *               to this group
+ *   stages      The pipeline's stages
+ *   count       Number of stages
+ *   timeout_ns  Kill the pipeline after this long; 0 for no limit.
+ *               Needs a process group of its own.
+ *
+ * Returns: How the wait ended
+ */
+WaitResult eventloop_wait(pid_t pgid, StageStatus *stages, int count,
+                          uint64_t timeout_ns);
+
+
+/*
+ * Whether a SIGINT arrived since the last call, for a script to stop
+ * at the line that was interrupted
+ *
+ * Parameters: None
+ *
+ * Returns: Nonzero if interrupted; the flag is cleared
+ */
+int eventloop_interrupted(void);
+
+
+/*
+ * Whether a SIGINT arrived that eventloop_interrupted has not yet
+ * taken, for a builtin whose system call failed with EINTR: it should
+ * stop (with status 128 + SIGINT) rather than try again
+ *
+ * Parameters: None
+ *
+ * Returns: Nonzero if interrupted; the flag is left as it is
+ */
+int eventloop_interrupt_pending(void);
+
+#endif // EVENTLOOP_H
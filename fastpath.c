@@ -0,0 +1,534 @@
+// fastpath.c
+#define _GNU_SOURCE  // copy_file_range, splice, F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "fastpath.h"
+#include "eventloop.h"
+
+// Size of the buffer used when the kernel cannot move the data itself
+#define FASTPATH_BUFSZ (64 * 1024)
+
+// Largest chunk handed to copy_file_range/sendfile in one call
+#define FASTPATH_CHUNK (1 << 30)
+
+static int fastpath_on = 1;
+
+// Documented in .h file
+void set_fastpath_enabled(int enabled) {
+    fastpath_on = enabled;
+}
+
+// Documented in .h file
+int fastpath_enabled(void) {
+    return fastpath_on;
+}
+
+// Whether a call that failed should be made again: after a signal,
+// unless it was ^C, which stops the builtin (see eventloop.h)
+static int try_again(void) {
+    return errno == EINTR && !eventloop_interrupt_pending();
+}
+
+// Write all of buf, retrying after short writes and EINTR.
+// Returns 0 on success, -1 with errno set on error.
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (try_again())
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Exit status for a failed write, matching what the real utility
+// would report: a reader that went away means death by SIGPIPE, and
+// ^C death by SIGINT
+static int write_failure_status(const char *name) {
+    if (errno == EPIPE)
+        return 128 + SIGPIPE;
+    if (errno == EINTR)
+        return 128 + SIGINT;
+    fprintf(stderr, "%s: write error: %s\n", name, strerror(errno));
+    return 1;
+}
+
+// Largest pipe buffer fit_pipe_to asks for; bigger buffers only pin
+// more kernel memory without making the copy any faster
+#define PIPE_GROW_MAX (1 << 20)
+
+// The system limit on pipe buffers for unprivileged processes,
+// read once from /proc
+static long pipe_max_size(void) {
+    static long max = 0;
+
+    if (max == 0) {
+        FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (f == NULL || fscanf(f, "%ld", &max) != 1 || max <= 0)
+            max = PIPE_GROW_MAX;
+        if (f != NULL)
+            fclose(f);
+    }
+    return max;
+}
+
+// Documented in .h file
+void fit_pipe_to(int pipe_fd, off_t size) {
+    long want = PIPE_GROW_MAX;
+    if (want > pipe_max_size())
+        want = pipe_max_size();
+    if (size < want)
+        want = size;
+
+    int current = fcntl(pipe_fd, F_GETPIPE_SZ);
+    if (current < 0 || current >= want)
+        return;
+
+    // Only a hint: if the kernel says no we keep the default size
+    (void)fcntl(pipe_fd, F_SETPIPE_SZ, (int)want);
+}
+
+// Move everything from in_fd to out_fd with splice, one end of which
+// must be a pipe. The bytes go page by page from one kernel buffer to
+// the other without being copied into user space.
+// Returns 0 at EOF, -1 with errno set on error; errno is EINVAL if
+// the pair cannot be spliced and nothing has been moved yet.
+static int splice_copy(int in_fd, int out_fd) {
+    ssize_t n;
+
+    while ((n = splice(in_fd, NULL, out_fd, NULL, FASTPATH_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_MORE)) != 0) {
+        if (n < 0) {
+            if (try_again())
+                continue;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Documented in .h file
+int fd_copy(int in_fd, int out_fd) {
+    char buf[FASTPATH_BUFSZ];
+    struct stat in_st, out_st;
+    ssize_t n;
+
+    int in_ok = (fstat(in_fd, &in_st) == 0);
+    int out_ok = (fstat(out_fd, &out_st) == 0);
+    int in_pipe = in_ok && S_ISFIFO(in_st.st_mode);
+    int out_pipe = out_ok && S_ISFIFO(out_st.st_mode);
+
+    // A large file going into a pipe fills the default 64KiB buffer
+    // quickly; a bigger one means fewer wakeups for both sides
+    if (out_pipe && in_ok && S_ISREG(in_st.st_mode))
+        fit_pipe_to(out_fd, in_st.st_size);
+
+    // Either end a pipe: splice. Errors that just mean "this pair
+    // can't be spliced" (an O_APPEND file, a tty) fall through below;
+    // no data has moved when that happens.
+    if (in_pipe || out_pipe) {
+        if (splice_copy(in_fd, out_fd) == 0)
+            return 0;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+    }
+
+    // Both ends regular files (or anything the filesystem supports):
+    // copy_file_range may not move the data through memory at all
+    while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, FASTPATH_CHUNK, 0)) > 0)
+        ;
+    if (n == 0)
+        return 0;
+    if (errno != EINVAL && errno != EXDEV && errno != ENOSYS &&
+        errno != EBADF && errno != EOPNOTSUPP)
+        return -1;
+
+    // A regular (mmap-able) input can go to any output with sendfile
+    while ((n = sendfile(out_fd, in_fd, NULL, FASTPATH_CHUNK)) > 0)
+        ;
+    if (n == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return -1;
+
+    // Plain copy through user space
+    while (1) {
+        n = read(in_fd, buf, sizeof(buf));
+        if (n == 0)
+            return 0;
+        if (n < 0) {
+            if (try_again())
+                continue;
+            return -1;
+        }
+        if (write_all(out_fd, buf, n) != 0)
+            return -1;
+    }
+}
+
+// Documented in .h file
+size_t count_newlines(const char *buf, size_t len) {
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        count += __builtin_popcount(mask);
+    }
+#endif
+
+    for (; i < len; i++)
+        count += (buf[i] == '\n');
+
+    return count;
+}
+
+/*
+ * echo
+ */
+
+// Documented in .h file
+int fastpath_echo_accepts(int argc, char **argv) {
+    // Options are leading words of the form -[neE]+; only -n (in any
+    // repetition) is handled here
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0' || arg[strspn(arg + 1, "neE") + 1] != '\0')
+            break;
+        if (arg[strspn(arg + 1, "n") + 1] != '\0')
+            return 0;
+    }
+
+    // coreutils' echo answers a lone --help/--version
+    if (argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "--version") == 0))
+        return 0;
+
+    return 1;
+}
+
+// Documented in .h file
+int fastpath_echo(int argc, char **argv, int in_fd, int out_fd) {
+    int newline = 1;
+    int i = 1;
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] == 'n' &&
+           argv[i][strspn(argv[i] + 1, "n") + 1] == '\0'; i++)
+        newline = 0;
+
+    // Build the line so it goes out in a single write
+    size_t len = 0;
+    for (int j = i; j < argc; j++)
+        len += strlen(argv[j]) + 1;
+
+    char *line = malloc(len + 1);
+    if (line == NULL) {
+        perror("echo");
+        return 1;
+    }
+
+    char *p = line;
+    for (int j = i; j < argc; j++) {
+        if (j > i)
+            *p++ = ' ';
+        size_t arg_len = strlen(argv[j]);
+        memcpy(p, argv[j], arg_len);
+        p += arg_len;
+    }
+    if (newline)
+        *p++ = '\n';
+
+    int status = 0;
+    if (write_all(out_fd, line, p - line) != 0)
+        status = write_failure_status("echo");
+
+    free(line);
+    return status;
+}
+
+/*
+ * cat
+ */
+
+// Documented in .h file
+int fastpath_cat_accepts(int argc, char **argv) {
+    // No options; "-" alone means standard input
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0')
+            return 0;
+    }
+    return 1;
+}
+
+// Documented in .h file
+int fastpath_cat(int argc, char **argv, int in_fd, int out_fd) {
+    int status = 0;
+
+    if (argc == 1) {
+        if (fd_copy(in_fd, out_fd) != 0)
+            return write_failure_status("cat");
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        int fd = in_fd;
+        if (strcmp(argv[i], "-") != 0) {
+            fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        int result = fd_copy(fd, out_fd);
+        int saved_errno = errno;
+        if (fd != in_fd)
+            close(fd);
+
+        if (result != 0) {
+            errno = saved_errno;
+            if (errno == EPIPE || errno == EINTR)
+                return write_failure_status("cat");
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * true, false
+ */
+
+// Documented in .h file
+int fastpath_true(int argc, char **argv, int in_fd, int out_fd) {
+    return 0;
+}
+
+// Documented in .h file
+int fastpath_false(int argc, char **argv, int in_fd, int out_fd) {
+    return 1;
+}
+
+/*
+ * wc
+ */
+
+// What wc was asked to count
+typedef struct WcOptions {
+    int lines;
+    int words;
+    int bytes;
+} WcOptions;
+
+// Counts for one input
+typedef struct WcCounts {
+    unsigned long long lines;
+    unsigned long long words;
+    unsigned long long bytes;
+} WcCounts;
+
+// Parse wc's options. Returns the index of the first file operand,
+// or -1 if an option is not supported here.
+static int wc_parse_options(int argc, char **argv, WcOptions *opts) {
+    int i;
+
+    memset(opts, 0, sizeof(*opts));
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        for (const char *c = argv[i] + 1; *c != '\0'; c++) {
+            if (*c == 'l')
+                opts->lines = 1;
+            else if (*c == 'w')
+                opts->words = 1;
+            else if (*c == 'c')
+                opts->bytes = 1;
+            else
+                return -1;
+        }
+    }
+
+    // Files that look like options would be options to the real wc
+    for (int j = i; j < argc; j++) {
+        if (argv[j][0] == '-' && argv[j][1] != '\0')
+            return -1;
+    }
+
+    if (!opts->lines && !opts->words && !opts->bytes)
+        opts->lines = opts->words = opts->bytes = 1;
+
+    return i;
+}
+
+// Documented in .h file
+int fastpath_wc_accepts(int argc, char **argv) {
+    WcOptions opts;
+    return wc_parse_options(argc, argv, &opts) >= 0;
+}
+
+// Count one input. Returns 0 on success, -1 with errno set on error.
+static int wc_count(int fd, const WcOptions *opts, WcCounts *counts) {
+    char buf[FASTPATH_BUFSZ];
+    int in_word = 0;
+    struct stat st;
+
+    memset(counts, 0, sizeof(*counts));
+
+    // Only the size was asked for and the file knows it
+    if (!opts->lines && !opts->words && fstat(fd, &st) == 0 &&
+        S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) == 0) {
+        counts->bytes = st.st_size;
+        return 0;
+    }
+
+    while (1) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0)
+            return 0;
+        if (n < 0) {
+            if (try_again())
+                continue;
+            return -1;
+        }
+
+        counts->bytes += n;
+        if (opts->lines)
+            counts->lines += count_newlines(buf, n);
+        if (opts->words) {
+            for (ssize_t i = 0; i < n; i++) {
+                int space = isspace((unsigned char)buf[i]);
+                counts->words += (!space && !in_word);
+                in_word = !space;
+            }
+        }
+    }
+}
+
+// Print one line of wc output
+static int wc_print(int out_fd, const WcOptions *opts, int width,
+                    const WcCounts *counts, const char *name) {
+    char line[128 + 4096];
+    int len = 0;
+    const char *sep = "";
+
+    if (opts->lines) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*llu", sep, width, counts->lines);
+        sep = " ";
+    }
+    if (opts->words) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*llu", sep, width, counts->words);
+        sep = " ";
+    }
+    if (opts->bytes) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%*llu", sep, width, counts->bytes);
+    }
+    if (name != NULL)
+        len += snprintf(line + len, sizeof(line) - len, " %s", name);
+    if (len > (int)sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+
+    return write_all(out_fd, line, len);
+}
+
+// Documented in .h file
+int fastpath_wc(int argc, char **argv, int in_fd, int out_fd) {
+    WcOptions opts;
+    int first = wc_parse_options(argc, argv, &opts);
+    int nfiles = (first < argc) ? argc - first : 1;
+    int *fds = malloc(nfiles * sizeof(int));
+    int status = 0;
+
+    if (fds == NULL) {
+        perror("wc");
+        return 1;
+    }
+
+    // Open everything first: like coreutils, the column width depends
+    // on the total size of the inputs
+    unsigned long long regular_total = 0;
+    int minimum_width = 1;
+    for (int i = 0; i < nfiles; i++) {
+        const char *name = (first < argc) ? argv[first + i] : "-";
+        struct stat st;
+
+        fds[i] = (strcmp(name, "-") == 0) ? in_fd : open(name, O_RDONLY | O_CLOEXEC);
+        if (fds[i] == -1) {
+            fprintf(stderr, "wc: %s: %s\n", name, strerror(errno));
+            status = 1;
+        } else if (fstat(fds[i], &st) == 0 && S_ISREG(st.st_mode)) {
+            regular_total += st.st_size;
+        } else {
+            minimum_width = 7;
+        }
+    }
+
+    int width = 1;
+    int single_count = opts.lines + opts.words + opts.bytes == 1;
+    if (!(nfiles == 1 && single_count) && fds[0] != -1) {
+        for (; regular_total >= 10; regular_total /= 10)
+            width++;
+        if (width < minimum_width)
+            width = minimum_width;
+    }
+
+    WcCounts total = {0, 0, 0};
+    for (int i = 0; i < nfiles; i++) {
+        const char *name = (first < argc) ? argv[first + i] : NULL;
+        WcCounts counts;
+
+        if (fds[i] == -1)
+            continue;
+
+        if (wc_count(fds[i], &opts, &counts) != 0) {
+            if (errno == EINTR) {
+                status = 128 + SIGINT;
+                break;
+            }
+            fprintf(stderr, "wc: %s: %s\n", name ? name : "-", strerror(errno));
+            status = 1;
+        } else {
+            total.lines += counts.lines;
+            total.words += counts.words;
+            total.bytes += counts.bytes;
+            if (wc_print(out_fd, &opts, width, &counts, name) != 0) {
+                status = write_failure_status("wc");
+                break;
+            }
+        }
+
+        if (fds[i] != in_fd)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+
+    if (nfiles > 1 && status != 128 + SIGPIPE && status != 128 + SIGINT) {
+        if (wc_print(out_fd, &opts, width, &total, "total") != 0)
+            status = write_failure_status("wc");
+    }
+
+    for (int i = 0; i < nfiles; i++) {
+        if (fds[i] != -1 && fds[i] != in_fd)
+            close(fds[i]);
+    }
+    free(fds);
+    return status;
+}
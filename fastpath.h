@@ -0,0 +1,92 @@
+#ifndef FASTPATH_H
+#define FASTPATH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * In-process replacements for tiny, frequently used utilities: echo,
+ * cat, true, false and wc. They are registered in the builtin table
+ * (builtins.c) and behave like the coreutils programs for the option
+ * subset they accept; for anything else the accepts function says no
+ * and the real binary is run instead.
+ *
+ * Each utility has the BuiltinFn signature, plus an accepts function:
+ *
+ *   int fastpath_X(int argc, char **argv, int in_fd, int out_fd);
+ *   int fastpath_X_accepts(int argc, char **argv);
+ *
+ * where accepts returns nonzero if fastpath_X can handle argv exactly
+ * as the real utility would.
+ */
+
+int fastpath_echo(int argc, char **argv, int in_fd, int out_fd);
+int fastpath_echo_accepts(int argc, char **argv);
+
+int fastpath_cat(int argc, char **argv, int in_fd, int out_fd);
+int fastpath_cat_accepts(int argc, char **argv);
+
+int fastpath_true(int argc, char **argv, int in_fd, int out_fd);
+int fastpath_false(int argc, char **argv, int in_fd, int out_fd);
+
+int fastpath_wc(int argc, char **argv, int in_fd, int out_fd);
+int fastpath_wc_accepts(int argc, char **argv);
+
+
+/*
+ * Copy everything from in_fd to out_fd, letting the kernel move the
+ * data where it can (splice when either end is a pipe, then
+ * copy_file_range, sendfile) and falling back to read/write otherwise
+ *
+ * Parameters:
+ *   in_fd    Descriptor to read until EOF
+ *   out_fd   Descriptor to write to
+ *
+ * Returns: 0 on success, -1 with errno set on error
+ */
+int fd_copy(int in_fd, int out_fd);
+
+
+/*
+ * Grow a pipe's buffer so that it can hold up to size bytes, within
+ * the system's pipe-max-size and a 1MiB cap. Does nothing if pipe_fd
+ * is not a pipe, its buffer is already that large, or the kernel
+ * refuses.
+ *
+ * Parameters:
+ *   pipe_fd  Either end of a pipe
+ *   size     Number of bytes expected to flow through it
+ *
+ * Returns: None
+ */
+void fit_pipe_to(int pipe_fd, off_t size);
+
+
+/*
+ * Count the newlines in a buffer, 16 bytes at a time where SSE2 is
+ * available
+ *
+ * Parameters:
+ *   buf      The bytes to scan
+ *   len      Number of bytes
+ *
+ * Returns: The number of '\n' bytes in buf
+ */
+size_t count_newlines(const char *buf, size_t len);
+
+
+/*
+ * Turn the fork-free utilities on or off. When off, echo, cat, true,
+ * false and wc always run the real binaries. plaidsh sets this from
+ * $PLAIDSH_FASTPATH at startup; the fastpath builtin changes it.
+ *
+ * Parameters:
+ *   enabled  Nonzero to enable
+ *
+ * Returns: None
+ */
+void set_fastpath_enabled(int enabled);
+
+int fastpath_enabled(void);
+
+#endif // FASTPATH_H
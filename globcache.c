@@ -0,0 +1,1337 @@
+/*
+ * globcache.c
+ *
+ * Glob patterns compiled to a small op list and matched against
+ * directory listings read with getdents64 and kept, sorted, until the
+ * directory changes
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#define _GNU_SOURCE  // getdents64, strchrnul
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "globcache.h"
+
+// Directories whose listings are kept; the least recently used goes
+#define GC_MAX_DIRS 64
+
+// getdents64 buffer size
+#define GC_READ_SIZE (64 * 1024)
+
+// A directory's mtime only moves on a timestamp tick, so a listing read
+// within a tick of the last change could have missed a change made
+// later in that same tick. Such a listing is used once and not trusted
+// again; it is re-read until the directory has been still this long.
+#define GC_RACY_NS 50000000L
+
+// Patterns whose matches are remembered per listing
+#define GC_MEMO_PATTERNS 4
+
+// Threads walking a tree for **, at most
+#define GC_WALK_MAX_THREADS 8
+
+// Expansion limit where sysconf cannot say
+#define GC_DEFAULT_ARG_MAX (128 * 1024)
+
+typedef struct
+{
+    char *name;          // Into the listing's names buffer
+    unsigned short len;  // strlen(name)
+    unsigned char type;  // d_type from getdents64
+} DirEntry;
+
+// The matches of one path component in a listing, which hold for as
+// long as the listing does
+typedef struct
+{
+    char *key;           // The component as written; NULL if unused
+    size_t *indices;     // Matching entries, in order
+    size_t count;
+    unsigned long last_used;
+} GC_Memo;
+
+typedef struct
+{
+    dev_t dev;              // Identity of the directory
+    ino_t ino;
+    struct timespec mtime;  // Its mtime when it was read
+    int racy;               // Read too soon after a change to trust
+    char *names;            // Every name, NUL-terminated, back to back
+    DirEntry *entries;      // Sorted by name
+    size_t count;
+    unsigned long last_used;
+    GC_Memo memo[GC_MEMO_PATTERNS];
+} DirListing;
+
+static DirListing listings[GC_MAX_DIRS];
+static size_t listing_count = 0;
+static unsigned long use_clock = 0;
+
+static size_t total_hits = 0;
+static size_t total_misses = 0;
+
+
+// Out of memory is fatal here, as in the rest of the shell
+static void *_GC_xrealloc(void *ptr, size_t size)
+{
+    void *p = realloc(ptr, size);
+    if (p == NULL)
+    {
+        perror("Failed to allocate memory for glob");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+
+// Drop the remembered matches of a listing
+static void _GC_forget(DirListing *listing)
+{
+    for (int i = 0; i < GC_MEMO_PATTERNS; i++)
+    {
+        free(listing->memo[i].key);
+        free(listing->memo[i].indices);
+    }
+    memset(listing->memo, 0, sizeof(listing->memo));
+}
+
+
+static int _GC_compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+
+/*
+ * Read a whole directory into listing, replacing what was there
+ *
+ * Parameters:
+ *   fd       The open directory
+ *   listing  Where to put it
+ *
+ * Returns: None
+ */
+static void _GC_read_dir(int fd, DirListing *listing)
+{
+    static char *buffer = NULL;
+    size_t names_size = 0, names_capacity = 0;
+    size_t count = 0, capacity = 0;
+    size_t *offsets = NULL;
+
+    if (buffer == NULL)
+        buffer = _GC_xrealloc(NULL, GC_READ_SIZE);
+
+    _GC_forget(listing);
+    free(listing->names);
+    free(listing->entries);
+    listing->names = NULL;
+    listing->entries = NULL;
+
+    ssize_t n;
+    while ((n = getdents64(fd, buffer, GC_READ_SIZE)) > 0)
+    {
+        for (ssize_t off = 0; off < n; )
+        {
+            struct dirent64 *d = (struct dirent64 *)(buffer + off);
+            size_t len = strlen(d->d_name) + 1;
+            off += d->d_reclen;
+
+            if (names_size + len > names_capacity)
+            {
+                names_capacity = (names_capacity + len) * 2;
+                listing->names = _GC_xrealloc(listing->names, names_capacity);
+            }
+            if (count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 256;
+                offsets = _GC_xrealloc(offsets, capacity * sizeof(size_t));
+                listing->entries = _GC_xrealloc(listing->entries, capacity * sizeof(DirEntry));
+            }
+
+            memcpy(listing->names + names_size, d->d_name, len);
+            offsets[count] = names_size;
+            listing->entries[count].len = len - 1;
+            listing->entries[count].type = d->d_type;
+            names_size += len;
+            count++;
+        }
+    }
+
+    // Names only have fixed addresses once the buffer stops growing
+    for (size_t i = 0; i < count; i++)
+        listing->entries[i].name = listing->names + offsets[i];
+    free(offsets);
+
+    qsort(listing->entries, count, sizeof(DirEntry), _GC_compare_entries);
+    listing->count = count;
+}
+
+
+/*
+ * Get the listing of a directory, from the cache when it is current
+ *
+ * Parameters:
+ *   dir     The directory's path
+ *
+ * Returns: The listing, or NULL if dir cannot be read. It stays valid
+ *   until the next call.
+ */
+static DirListing *_GC_listing(const char *dir)
+{
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    DirListing *listing = NULL;
+    for (size_t i = 0; i < listing_count; i++)
+    {
+        if (listings[i].dev == st.st_dev && listings[i].ino == st.st_ino)
+        {
+            listing = &listings[i];
+            break;
+        }
+    }
+
+    if (listing == NULL)
+    {
+        // A free slot, or else the least recently used one
+        if (listing_count < GC_MAX_DIRS)
+        {
+            listing = &listings[listing_count++];
+        }
+        else
+        {
+            listing = &listings[0];
+            for (size_t i = 1; i < listing_count; i++)
+            {
+                if (listings[i].last_used < listing->last_used)
+                    listing = &listings[i];
+            }
+        }
+        listing->racy = 1;
+    }
+    listing->last_used = ++use_clock;
+
+    if (!listing->racy &&
+        listing->mtime.tv_sec == st.st_mtim.tv_sec &&
+        listing->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        total_hits++;
+        return listing;
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    // The mtime goes with what was read, so take it from the open
+    // directory, before reading
+    struct timespec now;
+    fstat(fd, &st);
+    clock_gettime(CLOCK_REALTIME, &now);
+    _GC_read_dir(fd, listing);
+    close(fd);
+
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->racy = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000L +
+                    (now.tv_nsec - st.st_mtim.tv_nsec) < GC_RACY_NS;
+    total_misses++;
+    return listing;
+}
+
+
+// Documented in .h file
+void GC_clear(void)
+{
+    for (size_t i = 0; i < listing_count; i++)
+    {
+        _GC_forget(&listings[i]);
+        free(listings[i].names);
+        free(listings[i].entries);
+    }
+    memset(listings, 0, sizeof(listings));
+    listing_count = 0;
+}
+
+
+// Documented in .h file
+void GC_counters(size_t *hits, size_t *misses)
+{
+    *hits = total_hits;
+    *misses = total_misses;
+}
+
+
+/* Compiled patterns */
+
+typedef enum
+{
+    GC_OP_CHAR,  // One given byte
+    GC_OP_ANY,   // ?
+    GC_OP_STAR,  // *
+    GC_OP_SET    // [...]: a byte in set
+} GC_OpType;
+
+typedef struct
+{
+    GC_OpType type;
+    unsigned char c;   // GC_OP_CHAR
+    uint64_t set[4];   // GC_OP_SET: bit per byte value
+} GC_Op;
+
+typedef struct
+{
+    GC_Op *ops;
+    size_t count;
+    char *literal;        // literal[i] is ops[i].c where that is a GC_OP_CHAR
+    size_t prefix_len;    // GC_OP_CHARs at the start
+    size_t suffix_start;  // GC_OP_CHARs from here on end it; only if has_star
+    size_t min_len;       // Ops other than stars: a match has at least
+                          // this many bytes, or exactly if !has_star
+    int has_star;
+} GC_Pattern;
+
+
+static void _GC_set_add(uint64_t *set, unsigned char c)
+{
+    set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+
+// Add the bytes of the character class named by name[0..len) to set.
+// Returns 0, or -1 if there is no such class.
+static int _GC_set_add_class(uint64_t *set, const char *name, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+        { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+        { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+        { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+    {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0)
+        {
+            for (int c = 1; c < 256; c++)
+            {
+                if (classes[i].test(c))
+                    _GC_set_add(set, c);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * Compile a bracket expression
+ *
+ * Parameters:
+ *   p       Just past the '['
+ *   end     End of the path component
+ *   op      The op to fill in
+ *
+ * Returns: Just past the closing ']', or NULL if there is none (the
+ *   '[' is then an ordinary character)
+ */
+static const char *_GC_compile_set(const char *p, const char *end, GC_Op *op)
+{
+    int negate = (p < end && (*p == '!' || *p == '^'));
+    p += negate;
+
+    memset(op->set, 0, sizeof(op->set));
+    op->type = GC_OP_SET;
+
+    // A ']' straight after the '[' (or '[!') is a member
+    for (int first = 1; p < end && (*p != ']' || first); first = 0)
+    {
+        if (p[0] == '[' && p + 1 < end && p[1] == ':')
+        {
+            const char *close = p + 2;
+            while (close + 1 < end && !(close[0] == ':' && close[1] == ']'))
+                close++;
+            if (close + 1 < end && _GC_set_add_class(op->set, p + 2, close - (p + 2)) == 0)
+            {
+                p = close + 2;
+                continue;
+            }
+        }
+
+        unsigned char lo = *p++;
+        if (lo == '\\' && p < end)
+            lo = *p++;
+
+        // A range, unless the '-' is last
+        unsigned char hi = lo;
+        if (p + 1 < end && p[0] == '-' && p[1] != ']')
+        {
+            p++;
+            hi = *p++;
+            if (hi == '\\' && p < end)
+                hi = *p++;
+        }
+        for (unsigned int c = lo; c <= hi; c++)
+            _GC_set_add(op->set, c);
+    }
+
+    if (p >= end)
+        return NULL;
+
+    if (negate)
+    {
+        for (int i = 0; i < 4; i++)
+            op->set[i] = ~op->set[i];
+    }
+    // Never '/', never NUL
+    op->set[0] &= ~(((uint64_t)1 << '/') | 1);
+    return p + 1;
+}
+
+
+/*
+ * Compile one path component of a pattern
+ *
+ * Parameters:
+ *   pat     The component
+ *   end     Its end
+ *   out     The compiled pattern; free out->ops when done
+ *
+ * Returns: Nonzero if the component has any wildcard; if not, it is
+ *   all GC_OP_CHAR and matches only its unquoted self
+ */
+static int _GC_compile(const char *pat, const char *end, GC_Pattern *out)
+{
+    int magic = 0;
+
+    out->ops = _GC_xrealloc(NULL, (end - pat + 1) * sizeof(GC_Op));
+    out->literal = _GC_xrealloc(NULL, end - pat + 1);
+    out->count = 0;
+    out->has_star = 0;
+    out->min_len = 0;
+
+    while (pat < end)
+    {
+        GC_Op *op = &out->ops[out->count];
+        const char *next;
+
+        if (*pat == '*')
+        {
+            pat++;
+            // Runs of stars are one star
+            if (out->count > 0 && op[-1].type == GC_OP_STAR)
+                continue;
+            op->type = GC_OP_STAR;
+            out->has_star = magic = 1;
+        }
+        else if (*pat == '?')
+        {
+            pat++;
+            op->type = GC_OP_ANY;
+            magic = 1;
+        }
+        else if (*pat == '[' && (next = _GC_compile_set(pat + 1, end, op)) != NULL)
+        {
+            pat = next;
+            magic = 1;
+        }
+        else
+        {
+            if (*pat == '\\' && pat + 1 < end)
+                pat++;
+            op->type = GC_OP_CHAR;
+            op->c = *pat++;
+            out->literal[out->count] = op->c;
+        }
+        out->min_len += (op->type != GC_OP_STAR);
+        out->count++;
+    }
+
+    // The literal ends narrow down which names need matching at all
+    out->prefix_len = 0;
+    while (out->prefix_len < out->count && out->ops[out->prefix_len].type == GC_OP_CHAR)
+        out->prefix_len++;
+    out->suffix_start = out->count;
+    while (out->suffix_start > out->prefix_len &&
+           out->ops[out->suffix_start - 1].type == GC_OP_CHAR)
+        out->suffix_start--;
+    return magic;
+}
+
+
+static void _GC_free_pattern(GC_Pattern *pattern)
+{
+    free(pattern->ops);
+    free(pattern->literal);
+}
+
+
+// Does op match byte c?
+static inline int _GC_op_matches(const GC_Op *op, unsigned char c)
+{
+    switch (op->type)
+    {
+    case GC_OP_CHAR:
+        return op->c == c;
+    case GC_OP_ANY:
+        return 1;
+    case GC_OP_SET:
+        return (op->set[c >> 6] >> (c & 63)) & 1;
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * Match a name against a compiled component. A leading '.' has to be
+ * matched by a literal '.'. Stars backtrack only to the most recent
+ * star, which is enough as every other op is a single byte.
+ *
+ * Parameters:
+ *   pattern The compiled component
+ *   name    The name
+ *
+ * Returns: Nonzero on a match
+ */
+static int _GC_match(const GC_Pattern *pattern, const char *name)
+{
+    const GC_Op *ops = pattern->ops;
+    size_t n = pattern->count;
+
+    if (name[0] == '.' && (n == 0 || ops[0].type != GC_OP_CHAR || ops[0].c != '.'))
+        return 0;
+
+    size_t p = 0, star_p = 0;
+    const char *s = name, *star_s = NULL;
+
+    while (*s != '\0')
+    {
+        if (p < n && ops[p].type == GC_OP_STAR)
+        {
+            star_p = ++p;
+            star_s = s;
+        }
+        else if (p < n && _GC_op_matches(&ops[p], (unsigned char)*s))
+        {
+            p++;
+            s++;
+        }
+        else if (star_s != NULL)
+        {
+            p = star_p;
+            s = ++star_s;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (p < n && ops[p].type == GC_OP_STAR)
+        p++;
+    return p == n;
+}
+
+
+/*
+ * Find the entries of a listing that a component matches. Only names
+ * sharing the pattern's literal prefix are looked at, found by binary
+ * search, and those with the wrong length or literal suffix are passed
+ * over before matching. The result is remembered with the listing, so
+ * the same component over the same unchanged directory costs a lookup.
+ *
+ * Parameters:
+ *   listing   The listing
+ *   pattern   The compiled component
+ *   key       The component as written
+ *   key_len   Its length
+ *
+ * Returns: The matching entries, valid until the listing is next
+ *   read or dropped
+ */
+static const GC_Memo *_GC_find(DirListing *listing, const GC_Pattern *pattern,
+                               const char *key, size_t key_len)
+{
+    GC_Memo *memo = &listing->memo[0];
+    for (int i = 0; i < GC_MEMO_PATTERNS; i++)
+    {
+        GC_Memo *m = &listing->memo[i];
+        if (m->key != NULL && strncmp(m->key, key, key_len) == 0 && m->key[key_len] == '\0')
+        {
+            m->last_used = use_clock;
+            return m;
+        }
+        if (m->key == NULL || (memo->key != NULL && m->last_used < memo->last_used))
+            memo = m;
+    }
+
+    free(memo->key);
+    free(memo->indices);
+    memo->key = _GC_xrealloc(NULL, key_len + 1);
+    memcpy(memo->key, key, key_len);
+    memo->key[key_len] = '\0';
+    memo->indices = NULL;
+    memo->count = 0;
+    memo->last_used = use_clock;
+
+    // First entry not sorting before the prefix
+    const char *prefix = pattern->literal;
+    size_t prefix_len = pattern->prefix_len;
+    size_t lo = 0, hi = listing->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(listing->entries[mid].name, prefix, prefix_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    const char *suffix = pattern->literal + pattern->suffix_start;
+    size_t suffix_len = pattern->has_star ? pattern->count - pattern->suffix_start : 0;
+    size_t capacity = 0;
+
+    for (size_t i = lo; i < listing->count; i++)
+    {
+        const DirEntry *entry = &listing->entries[i];
+        if (strncmp(entry->name, prefix, prefix_len) != 0)
+            break;
+        if (pattern->has_star ? entry->len < pattern->min_len : entry->len != pattern->min_len)
+            continue;
+        if (suffix_len > 0 && memcmp(entry->name + entry->len - suffix_len, suffix, suffix_len) != 0)
+            continue;
+        if (!_GC_match(pattern, entry->name))
+            continue;
+
+        if (memo->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            memo->indices = _GC_xrealloc(memo->indices, capacity * sizeof(size_t));
+        }
+        memo->indices[memo->count++] = i;
+    }
+    return memo;
+}
+
+
+/* Recursive walk, for ** */
+
+// What a walk reports
+typedef enum
+{
+    GC_WALK_MATCHES,  // Entries the leaf pattern matches, in every directory
+    GC_WALK_ALL,      // Every visible entry below the base
+    GC_WALK_DIRS      // The base and every visible directory below it
+} GC_WalkMode;
+
+// A directory waiting to be read: its path relative to the walk's
+// base, "" for the base itself, otherwise ending in '/'
+typedef struct
+{
+    char *path;
+    size_t len;
+} GC_WalkDir;
+
+typedef struct GC_Walk GC_Walk;
+
+typedef struct
+{
+    GC_Walk *walk;
+    pthread_mutex_t lock;   // Guards the deque
+    GC_WalkDir *dirs;       // Deque: the owner works at the back,
+    size_t head, tail;      // thieves take from the front
+    size_t capacity;
+    char **found;           // Paths reported, relative to the base
+    size_t found_count;
+    size_t found_capacity;
+    char *buffer;           // getdents64 buffer
+} GC_Worker;
+
+struct GC_Walk
+{
+    int base_fd;
+    GC_WalkMode mode;
+    const GC_Pattern *leaf;    // GC_WALK_MATCHES only
+    size_t prefix_len;         // Bytes each path gains in front of it
+    GC_Worker *workers;
+    int worker_count;
+
+    pthread_mutex_t idle_lock; // Guards the three below
+    pthread_cond_t idle_cond;
+    size_t pending;            // Directories queued or being read
+    unsigned long generation;  // Bumped on every push, for idle workers
+
+    atomic_size_t bytes;       // Argument bytes reported so far
+    size_t byte_limit;
+    atomic_int too_long;       // byte_limit was passed; stop
+};
+
+static int walk_threads = 0;
+
+
+// Documented in .h file
+void GC_set_walk_threads(int threads)
+{
+    walk_threads = threads;
+}
+
+
+// Queue a directory on a worker; takes ownership of path
+static void _GC_push(GC_Worker *worker, char *path, size_t len)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->tail == worker->capacity)
+    {
+        // Slide what is left to the front before growing
+        memmove(worker->dirs, worker->dirs + worker->head,
+                (worker->tail - worker->head) * sizeof(GC_WalkDir));
+        worker->tail -= worker->head;
+        worker->head = 0;
+        if (worker->tail * 2 > worker->capacity || worker->capacity == 0)
+        {
+            worker->capacity = worker->capacity ? worker->capacity * 2 : 64;
+            worker->dirs = _GC_xrealloc(worker->dirs, worker->capacity * sizeof(GC_WalkDir));
+        }
+    }
+    worker->dirs[worker->tail].path = path;
+    worker->dirs[worker->tail].len = len;
+    worker->tail++;
+    pthread_mutex_unlock(&worker->lock);
+
+    GC_Walk *walk = worker->walk;
+    pthread_mutex_lock(&walk->idle_lock);
+    walk->pending++;
+    walk->generation++;
+    pthread_cond_signal(&walk->idle_cond);
+    pthread_mutex_unlock(&walk->idle_lock);
+}
+
+
+// Take a directory from the back of our own deque, or else steal one
+// from the front of another's. Returns 0 if every deque is empty.
+static int _GC_pop(GC_Worker *self, GC_WalkDir *out)
+{
+    GC_Walk *walk = self->walk;
+    int index = (int)(self - walk->workers);
+
+    for (int n = 0; n < walk->worker_count; n++)
+    {
+        GC_Worker *victim = &walk->workers[(index + n) % walk->worker_count];
+        int got = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail)
+        {
+            *out = (victim == self) ? victim->dirs[--victim->tail]
+                                    : victim->dirs[victim->head++];
+            got = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (got)
+            return 1;
+    }
+    return 0;
+}
+
+
+// Report a path, charging its bytes against the walk's limit
+static void _GC_report(GC_Worker *worker, const char *dir, size_t dir_len,
+                       const char *name, size_t name_len, int slash)
+{
+    GC_Walk *walk = worker->walk;
+    size_t len = dir_len + name_len + slash;
+
+    size_t cost = walk->prefix_len + len + 1 + sizeof(char *);
+    if (atomic_fetch_add(&walk->bytes, cost) + cost > walk->byte_limit)
+    {
+        atomic_store(&walk->too_long, 1);
+        return;
+    }
+
+    if (worker->found_count == worker->found_capacity)
+    {
+        worker->found_capacity = worker->found_capacity ? worker->found_capacity * 2 : 64;
+        worker->found = _GC_xrealloc(worker->found, worker->found_capacity * sizeof(char *));
+    }
+    char *path = _GC_xrealloc(NULL, len + 1);
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, name, name_len);
+    if (slash)
+        path[len - 1] = '/';
+    path[len] = '\0';
+    worker->found[worker->found_count++] = path;
+}
+
+
+// Read one directory: report what the mode asks for and queue the
+// visible subdirectories. Symbolic links are not followed, and
+// directories that cannot be read are passed over.
+static void _GC_read_walk_dir(GC_Worker *worker, const GC_WalkDir *dir)
+{
+    GC_Walk *walk = worker->walk;
+
+    if (walk->mode == GC_WALK_DIRS)
+        _GC_report(worker, dir->path, dir->len, "", 0, 0);
+
+    int fd = openat(walk->base_fd, dir->len > 0 ? dir->path : ".",
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    ssize_t n;
+    while (!atomic_load(&walk->too_long) &&
+           (n = getdents64(fd, worker->buffer, GC_READ_SIZE)) > 0)
+    {
+        for (ssize_t off = 0; off < n; )
+        {
+            struct dirent64 *d = (struct dirent64 *)(worker->buffer + off);
+            const char *name = d->d_name;
+            off += d->d_reclen;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            struct stat st;
+            int is_dir = (d->d_type == DT_DIR) ||
+                         (d->d_type == DT_UNKNOWN &&
+                          fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                          S_ISDIR(st.st_mode));
+            size_t name_len = strlen(name);
+
+            // A link to a directory counts as one, but is not entered
+            if (walk->mode == GC_WALK_DIRS && name[0] != '.' && !is_dir &&
+                (d->d_type == DT_LNK || d->d_type == DT_UNKNOWN) &&
+                fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode))
+                _GC_report(worker, dir->path, dir->len, name, name_len, 1);
+
+            if (walk->mode == GC_WALK_MATCHES)
+            {
+                if (_GC_match(walk->leaf, name))
+                    _GC_report(worker, dir->path, dir->len, name, name_len, 0);
+            }
+            else if (walk->mode == GC_WALK_ALL && name[0] != '.')
+            {
+                _GC_report(worker, dir->path, dir->len, name, name_len, 0);
+            }
+
+            if (is_dir && name[0] != '.')
+            {
+                char *path = _GC_xrealloc(NULL, dir->len + name_len + 2);
+                memcpy(path, dir->path, dir->len);
+                memcpy(path + dir->len, name, name_len);
+                path[dir->len + name_len] = '/';
+                path[dir->len + name_len + 1] = '\0';
+                _GC_push(worker, path, dir->len + name_len + 1);
+            }
+        }
+    }
+    close(fd);
+}
+
+
+// Body of each worker, the calling thread included: take directories
+// until none are queued or being read anywhere
+static void *_GC_walk_worker(void *arg)
+{
+    GC_Worker *self = arg;
+    GC_Walk *walk = self->walk;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&walk->idle_lock);
+        unsigned long seen = walk->generation;
+        pthread_mutex_unlock(&walk->idle_lock);
+
+        GC_WalkDir dir;
+        if (_GC_pop(self, &dir))
+        {
+            _GC_read_walk_dir(self, &dir);
+            free(dir.path);
+
+            pthread_mutex_lock(&walk->idle_lock);
+            if (--walk->pending == 0)
+                pthread_cond_broadcast(&walk->idle_cond);
+            pthread_mutex_unlock(&walk->idle_lock);
+            continue;
+        }
+
+        // Nothing to take: wait for a push, or for the walk to end
+        pthread_mutex_lock(&walk->idle_lock);
+        while (walk->pending > 0 && walk->generation == seen)
+            pthread_cond_wait(&walk->idle_cond, &walk->idle_lock);
+        int done = (walk->pending == 0);
+        pthread_mutex_unlock(&walk->idle_lock);
+        if (done)
+            return NULL;
+    }
+}
+
+
+/*
+ * Walk the tree below a directory with a pool of threads, each reading
+ * directories with openat and getdents64 from its own deque of
+ * directories and stealing from the others' when it runs dry. Hidden
+ * directories are not entered.
+ *
+ * Parameters:
+ *   base        The directory, "" for the current one
+ *   mode        What to report
+ *   leaf        The pattern for GC_WALK_MATCHES
+ *   prefix_len  Bytes each reported path will be given in front, for
+ *               the limit
+ *   bytes       Argument bytes already used
+ *   limit       Give up once the reported paths take the argument
+ *               bytes past this
+ *   count       Return space for the number of paths
+ *   too_long    Return space for whether it gave up
+ *
+ * Returns: The reported paths relative to base, unsorted, each and the
+ *   array itself to be freed; NULL if there are none
+ */
+static char **_GC_walk_tree(const char *base, GC_WalkMode mode, const GC_Pattern *leaf,
+                            size_t prefix_len, size_t bytes, size_t limit,
+                            size_t *count, int *too_long)
+{
+    *count = 0;
+    *too_long = 0;
+    int base_fd = open(base[0] != '\0' ? base : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd == -1)
+        return NULL;
+
+    int threads = walk_threads;
+    if (threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > GC_WALK_MAX_THREADS ? GC_WALK_MAX_THREADS : cpus > 0 ? (int)cpus : 1;
+    }
+
+    GC_Walk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.base_fd = base_fd;
+    walk.mode = mode;
+    walk.leaf = leaf;
+    walk.prefix_len = prefix_len;
+    walk.worker_count = threads;
+    walk.workers = _GC_xrealloc(NULL, threads * sizeof(GC_Worker));
+    memset(walk.workers, 0, threads * sizeof(GC_Worker));
+    walk.byte_limit = limit;
+    atomic_init(&walk.bytes, bytes);
+    atomic_init(&walk.too_long, 0);
+    pthread_mutex_init(&walk.idle_lock, NULL);
+    pthread_cond_init(&walk.idle_cond, NULL);
+
+    for (int i = 0; i < threads; i++)
+    {
+        walk.workers[i].walk = &walk;
+        walk.workers[i].buffer = _GC_xrealloc(NULL, GC_READ_SIZE);
+        pthread_mutex_init(&walk.workers[i].lock, NULL);
+    }
+
+    char *root = _GC_xrealloc(NULL, 1);
+    root[0] = '\0';
+    _GC_push(&walk.workers[0], root, 0);
+
+    // Threads that fail to start just leave more for the rest
+    pthread_t tids[GC_WALK_MAX_THREADS];
+    int started[GC_WALK_MAX_THREADS] = { 0 };
+    for (int i = 1; i < threads && i < GC_WALK_MAX_THREADS; i++)
+        started[i] = (pthread_create(&tids[i], NULL, _GC_walk_worker, &walk.workers[i]) == 0);
+    _GC_walk_worker(&walk.workers[0]);
+    for (int i = 1; i < threads && i < GC_WALK_MAX_THREADS; i++)
+    {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+
+    *too_long = atomic_load(&walk.too_long);
+    char **paths = NULL;
+    for (int i = 0; i < threads; i++)
+    {
+        GC_Worker *worker = &walk.workers[i];
+        if (!*too_long && worker->found_count > 0)
+        {
+            paths = _GC_xrealloc(paths, (*count + worker->found_count) * sizeof(char *));
+            memcpy(paths + *count, worker->found, worker->found_count * sizeof(char *));
+            *count += worker->found_count;
+        }
+        else
+        {
+            for (size_t j = 0; j < worker->found_count; j++)
+                free(worker->found[j]);
+        }
+        free(worker->found);
+        free(worker->dirs);
+        free(worker->buffer);
+        pthread_mutex_destroy(&worker->lock);
+    }
+    free(walk.workers);
+    pthread_mutex_destroy(&walk.idle_lock);
+    pthread_cond_destroy(&walk.idle_cond);
+    close(base_fd);
+    return paths;
+}
+
+
+/* Expansion */
+
+typedef struct
+{
+    Arena *arena;        // Matches are allocated from it
+    char *path;          // Path built so far
+    size_t capacity;
+    char **matches;
+    size_t count;
+    size_t match_capacity;
+    int listings_used;   // Listings that produced a match
+    int presorted;       // Matches came straight from one sorted listing
+    size_t bytes;        // What the matches take as execve arguments
+    size_t byte_limit;
+    int too_long;        // The matches would pass byte_limit
+} GC_Expansion;
+
+
+// Make room for len more bytes (and a NUL) after the first used bytes
+static void _GC_reserve(GC_Expansion *g, size_t used, size_t len)
+{
+    if (used + len + 1 > g->capacity)
+    {
+        g->capacity = (used + len + 1) * 2;
+        g->path = _GC_xrealloc(g->path, g->capacity);
+    }
+}
+
+
+static void _GC_add_match(GC_Expansion *g, size_t len)
+{
+    size_t cost = len + 1 + sizeof(char *);
+    if (g->too_long || g->bytes + cost > g->byte_limit)
+    {
+        g->too_long = 1;
+        return;
+    }
+    g->bytes += cost;
+
+    if (g->count == g->match_capacity)
+    {
+        g->match_capacity = g->match_capacity ? g->match_capacity * 2 : 16;
+        g->matches = _GC_xrealloc(g->matches, g->match_capacity * sizeof(char *));
+    }
+    g->matches[g->count++] = arena_strndup(g->arena, g->path, len);
+}
+
+
+static void _GC_walk(GC_Expansion *g, size_t len, const char *rest, int need_check);
+
+
+static int _GC_compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/*
+ * Expand a ** component: it matches the directory it is in and every
+ * visible directory below, so the rest of the pattern is applied in
+ * each. A ** at the end matches every visible entry below, and one
+ * with only a '/' after it every directory. The common forms need only
+ * one walk of the tree; anything after a further '/' is expanded in
+ * each directory found.
+ *
+ * Parameters:
+ *   g           The expansion
+ *   len         Length of g->path, as for _GC_walk
+ *   next        The pattern after the ** and its '/'s
+ *   dir_only    Nonzero if the ** was followed by a '/'
+ *
+ * Returns: None
+ */
+static void _GC_globstar(GC_Expansion *g, size_t len, const char *next, int dir_only)
+{
+    GC_WalkMode mode;
+    GC_Pattern leaf;
+    int have_leaf = 0;
+
+    if (*next == '\0')
+    {
+        mode = dir_only ? GC_WALK_DIRS : GC_WALK_ALL;
+    }
+    else if (strchr(next, '/') == NULL)
+    {
+        _GC_compile(next, next + strlen(next), &leaf);
+        have_leaf = 1;
+        mode = GC_WALK_MATCHES;
+    }
+    else
+    {
+        mode = GC_WALK_DIRS;
+    }
+
+    // The directories walked for a longer pattern are not arguments
+    int paths_are_matches = (*next == '\0' || have_leaf);
+    size_t count;
+    int too_long;
+    g->path[len] = '\0';
+    char **paths = _GC_walk_tree(g->path, mode, have_leaf ? &leaf : NULL, len,
+                                 g->bytes, paths_are_matches ? g->byte_limit : SIZE_MAX,
+                                 &count, &too_long);
+    if (have_leaf)
+        _GC_free_pattern(&leaf);
+    if (too_long)
+        g->too_long = 1;
+
+    g->presorted = 0;
+    if (!paths_are_matches && count > 1)
+        qsort(paths, count, sizeof(char *), _GC_compare_paths);
+
+    // As in bash, a trailing ** matches the directory it is in too,
+    // unless that is the current one
+    struct stat st;
+    size_t before = g->count;
+    if (*next == '\0' && len > 0 && stat(g->path, &st) == 0 && S_ISDIR(st.st_mode))
+        _GC_add_match(g, len);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t path_len = strlen(paths[i]);
+        if (path_len > 0 || !paths_are_matches)
+        {
+            _GC_reserve(g, len, path_len);
+            memcpy(g->path + len, paths[i], path_len + 1);
+            if (paths_are_matches)
+                _GC_add_match(g, len + path_len);
+            else if (!g->too_long)
+                _GC_walk(g, len + path_len, next, 1);
+        }
+        free(paths[i]);
+    }
+    free(paths);
+
+    if (g->count > before)
+        g->listings_used++;
+}
+
+
+/*
+ * Expand the rest of a pattern below the path built so far
+ *
+ * Parameters:
+ *   g           The expansion
+ *   len         Length of g->path; it ends in '/' unless empty
+ *   rest        The remaining pattern, without leading '/'
+ *   need_check  Nonzero if a path made only of literal components must
+ *               be checked for existence
+ *
+ * Returns: None
+ */
+static void _GC_walk(GC_Expansion *g, size_t len, const char *rest, int need_check)
+{
+    if (*rest == '\0')
+    {
+        struct stat st;
+        g->path[len] = '\0';
+        if (!need_check || lstat(g->path, &st) == 0)
+            _GC_add_match(g, len);
+        return;
+    }
+
+    const char *seg_end = strchrnul(rest, '/');
+    const char *next = seg_end;
+    while (*next == '/')
+        next++;
+    int last = (*next == '\0');
+    int dir_only = !last || seg_end != next;  // More follows, or a trailing '/'
+
+    if (seg_end - rest == 2 && rest[0] == '*' && rest[1] == '*')
+    {
+        _GC_globstar(g, len, next, dir_only);
+        return;
+    }
+
+    GC_Pattern pattern;
+    if (!_GC_compile(rest, seg_end, &pattern))
+    {
+        // Literal component: no listing needed
+        _GC_reserve(g, len, pattern.count + 1);
+        for (size_t i = 0; i < pattern.count; i++)
+            g->path[len++] = pattern.ops[i].c;
+        if (dir_only)
+            g->path[len++] = '/';
+        _GC_free_pattern(&pattern);
+        _GC_walk(g, len, next, need_check);
+        return;
+    }
+
+    g->path[len] = '\0';
+    DirListing *listing = _GC_listing(len > 0 ? g->path : ".");
+    if (listing == NULL)
+    {
+        _GC_free_pattern(&pattern);
+        return;
+    }
+
+    const GC_Memo *found = _GC_find(listing, &pattern, rest, seg_end - rest);
+    _GC_free_pattern(&pattern);
+    size_t before = g->count;
+
+    if (!dir_only)
+    {
+        // The common case, a pattern in the last component: matches
+        // are the listing's names, already in order
+        for (size_t i = 0; i < found->count; i++)
+        {
+            const DirEntry *entry = &listing->entries[found->indices[i]];
+            _GC_reserve(g, len, entry->len);
+            memcpy(g->path + len, entry->name, entry->len + 1);
+            _GC_add_match(g, len + entry->len);
+        }
+    }
+    else
+    {
+        // Descending reads other listings, which may evict this one,
+        // so the matching directories are copied out first
+        size_t nmatch = found->count;
+        DirEntry *dirs = _GC_xrealloc(NULL, (nmatch + 1) * sizeof(DirEntry));
+        for (size_t i = 0; i < nmatch; i++)
+        {
+            const DirEntry *entry = &listing->entries[found->indices[i]];
+            dirs[i] = *entry;
+            dirs[i].name = arena_strndup(g->arena, entry->name, entry->len);
+        }
+
+        // Sorted names give sorted paths only if nothing follows them
+        g->presorted = 0;
+
+        for (size_t i = 0; i < nmatch; i++)
+        {
+            size_t name_len = dirs[i].len;
+            _GC_reserve(g, len, name_len + 1);
+            memcpy(g->path + len, dirs[i].name, name_len + 1);
+
+            struct stat st;
+            int is_dir = (dirs[i].type == DT_DIR) ||
+                         ((dirs[i].type == DT_LNK || dirs[i].type == DT_UNKNOWN) &&
+                          stat(g->path, &st) == 0 && S_ISDIR(st.st_mode));
+            if (is_dir)
+            {
+                g->path[len + name_len] = '/';
+                _GC_walk(g, len + name_len + 1, next, 1);
+            }
+        }
+        free(dirs);
+    }
+
+    if (g->count > before)
+        g->listings_used++;
+}
+
+
+// Documented in .h file
+int GC_has_magic(const char *word)
+{
+    return word[0] == '~' || strpbrk(word, "*?[") != NULL;
+}
+
+
+// Documented in .h file
+size_t GC_expand(Arena *arena, const char *pattern, size_t limit, GC_AddFn add, void *ctx)
+{
+    // ARG_MAX follows the stack limit, so it is asked each time
+    if (limit == 0)
+    {
+        long n = sysconf(_SC_ARG_MAX);
+        limit = n > 0 ? (size_t)n : GC_DEFAULT_ARG_MAX;
+    }
+
+    GC_Expansion g = { arena, NULL, 0, NULL, 0, 0, 0, 1, 0, limit, 0 };
+    size_t len = 0;
+    int need_check = 1;
+
+    // ~ or ~user up to the first '/'. Like the shell, and unlike
+    // glob(3), the result need not exist.
+    if (pattern[0] == '~')
+    {
+        const char *user_end = strchrnul(pattern, '/');
+        const char *home = NULL;
+
+        if (user_end == pattern + 1)
+        {
+            home = getenv("HOME");
+            if (home == NULL)
+            {
+                struct passwd *pw = getpwuid(getuid());
+                home = pw ? pw->pw_dir : NULL;
+            }
+        }
+        else
+        {
+            char user[256];
+            if ((size_t)(user_end - pattern - 1) < sizeof(user))
+            {
+                snprintf(user, sizeof(user), "%.*s", (int)(user_end - pattern - 1), pattern + 1);
+                struct passwd *pw = getpwnam(user);
+                home = pw ? pw->pw_dir : NULL;
+            }
+        }
+        if (home == NULL)
+            return 0;
+
+        len = strlen(home);
+        _GC_reserve(&g, 0, len + 1);
+        memcpy(g.path, home, len);
+        pattern = user_end;
+        need_check = 0;
+        if (*pattern == '/' && (len == 0 || g.path[len - 1] != '/'))
+            g.path[len++] = '/';
+    }
+    else if (pattern[0] == '/')
+    {
+        _GC_reserve(&g, 0, 1);
+        g.path[len++] = '/';
+    }
+    else
+    {
+        _GC_reserve(&g, 0, 0);
+    }
+    while (*pattern == '/')
+        pattern++;
+
+    _GC_walk(&g, len, pattern, need_check);
+
+    if (g.too_long)
+    {
+        free(g.matches);
+        free(g.path);
+        return GC_TOO_LONG;
+    }
+
+    if (g.count > 1 && !(g.presorted && g.listings_used == 1))
+        qsort(g.matches, g.count, sizeof(char *), _GC_compare_paths);
+
+    if (g.count > 0)
+        add(ctx, g.matches, g.count);
+    free(g.matches);
+    free(g.path);
+    return g.count;
+}
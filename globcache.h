@@ -0,0 +1,110 @@
+/*
+ * globcache.h
+ *
+ * Pathname expansion (*, ?, [...] and a leading ~) done by the shell
+ * itself, over a cache of directory listings. A directory is read once
+ * with getdents64 and its sorted listing kept until the directory's
+ * mtime changes, so globbing the same large directories over and over
+ * costs a stat and a pass of compiled-pattern matching, not a re-read
+ * and re-sort of the whole directory. A ** component walks the whole
+ * subtree instead, on several threads.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _GLOBCACHE_H_
+#define _GLOBCACHE_H_
+
+#include <stddef.h>
+#include "arena.h"
+
+// GC_expand's result when the matches would not fit in an execve
+#define GC_TOO_LONG ((size_t)-1)
+
+/*
+ * Callback receiving every path a pattern expands to, at once
+ *
+ * Parameters:
+ *   ctx     The ctx passed to GC_expand
+ *   paths   The paths in sorted order, each allocated from the arena
+ *           passed to GC_expand; the array itself is only valid
+ *           during the call
+ *   count   How many, at least one
+ *
+ * Returns: None
+ */
+typedef void (*GC_AddFn)(void *ctx, char **paths, size_t count);
+
+
+/*
+ * Whether a word is subject to expansion: it contains *, ? or [, or
+ * starts with ~
+ *
+ * Parameters:
+ *   word    The word
+ *
+ * Returns: Nonzero if GC_expand should be tried on it
+ */
+int GC_has_magic(const char *word);
+
+
+/*
+ * Expand a pattern as glob(3) with GLOB_TILDE_CHECK would: ~ and ~user
+ * at the start, then *, ? and [...] (with ranges, ! or ^ negation and
+ * [:class:]) in each path component, a backslash quoting the next
+ * character. Names starting with '.' only match a component that
+ * starts with a literal '.'. A component that is just ** matches zero
+ * or more directories, as with bash's globstar: with ** between src
+ * and *.c, a pattern finds the .c files anywhere under src. Hidden
+ * directories are not entered and symbolic links to directories are
+ * not followed. Matches are sorted by byte value.
+ *
+ * Parameters:
+ *   arena   Arena the matched paths are allocated from
+ *   pattern The pattern
+ *   limit   Most bytes the matches may take as execve arguments; 0 for
+ *           ARG_MAX
+ *   add     Called with the matches, unless there are none
+ *   ctx     Passed to add
+ *
+ * Returns: The number of matches; 0 if there were none (the caller
+ *   keeps the word as it is), including for an unknown ~user; or
+ *   GC_TOO_LONG, with add never called, if the matches would take more
+ *   than limit
+ */
+size_t GC_expand(Arena *arena, const char *pattern, size_t limit, GC_AddFn add, void *ctx);
+
+
+/*
+ * Forget every cached directory listing
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void GC_clear(void);
+
+
+/*
+ * Set how many threads walk a tree for **
+ *
+ * Parameters:
+ *   threads   The number, at most 8; 0 (the default) for one per CPU
+ *
+ * Returns: None
+ */
+void GC_set_walk_threads(int threads);
+
+
+/*
+ * Retrieve the listing counters
+ *
+ * Parameters:
+ *   hits      Return space for the number of listings served from the cache
+ *   misses    Return space for the number of directories read
+ *
+ * Returns: None
+ */
+void GC_counters(size_t *hits, size_t *misses);
+
+#endif /* _GLOBCACHE_H_ */
@@ -0,0 +1,456 @@
+// jobs.c
+#define _GNU_SOURCE  // pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <readline/readline.h>
+#include "jobs.h"
+#include "eventloop.h"
+
+typedef enum JobState {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct Job {
+    int number;      // Job number, as in %n
+    pid_t pgid;
+    int npids;
+    pid_t *pids;     // Stage pids; -1 once reaped (or never started)
+    int *status;     // Stage status as from waitpid, once reaped
+    JobState state;
+    char *command;
+} Job;
+
+// Live jobs, oldest first; the last one is the current job (%+)
+static Job **jobs = NULL;
+static int job_count = 0;
+static int job_capacity = 0;
+
+static int sigchld_pipe[2] = { -1, -1 };
+static int interactive_shell = 0;
+static pid_t shell_pgid;
+
+static const char *state_names[] = { "Running", "Stopped", "Done" };
+
+// Without a terminal nobody is told that jobs finished, so they would
+// pile up until jobs or wait ran; only this many are kept for wait
+#define JOBS_KEEP_DONE 32
+
+// SIGCHLD: just note that something happened; the main loop reaps
+static void sigchld_handler(int sig) {
+    int saved_errno = errno;
+    char c = 0;
+    if (write(sigchld_pipe[1], &c, 1) < 0) {
+        // Pipe full: a wakeup is already pending
+    }
+    errno = saved_errno;
+}
+
+// Readline's input function: while waiting for a key, also wake up on
+// SIGCHLD so that background jobs are reaped at the prompt
+static int jobs_getc(FILE *stream) {
+    int in_fd = fileno(stream);
+
+    while (1) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(in_fd, &fds);
+        FD_SET(sigchld_pipe[0], &fds);
+        int max_fd = in_fd > sigchld_pipe[0] ? in_fd : sigchld_pipe[0];
+
+        if (select(max_fd + 1, &fds, NULL, NULL, NULL) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (FD_ISSET(sigchld_pipe[0], &fds))
+            jobs_reap();
+        if (FD_ISSET(in_fd, &fds))
+            break;
+    }
+    return rl_getc(stream);
+}
+
+// Documented in .h file
+void jobs_init(int interactive) {
+    interactive_shell = interactive;
+    shell_pgid = getpgrp();
+
+    if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("jobs: pipe");
+        return;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    if (interactive) {
+        // fg hands the terminal to a job and takes it back afterwards,
+        // which from the background would stop the shell; and ^Z and
+        // ^\ are for the job in the foreground, never for the shell
+        signal(SIGTTOU, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        rl_getc_function = jobs_getc;
+    }
+}
+
+// Documented in .h file
+int jobs_interactive(void) {
+    return interactive_shell;
+}
+
+// Documented in .h file
+void jobs_set_foreground(pid_t pgid) {
+    if (interactive_shell && isatty(STDIN_FILENO))
+        tcsetpgrp(STDIN_FILENO, pgid ? pgid : shell_pgid);
+}
+
+// Documented in .h file
+int jobs_sigchld_fd(void) {
+    return sigchld_pipe[0];
+}
+
+// Shell-style exit code of a waitpid status
+static int exit_code(int status) {
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+// A job's status is its last stage's
+static int job_exit_code(const Job *job) {
+    return exit_code(job->status[job->npids - 1]);
+}
+
+static void free_job(Job *job) {
+    free(job->pids);
+    free(job->status);
+    free(job->command);
+    free(job);
+}
+
+// Remove jobs[i] from the table
+static void remove_job(int i) {
+    free_job(jobs[i]);
+    memmove(&jobs[i], &jobs[i + 1], (job_count - i - 1) * sizeof(Job *));
+    job_count--;
+}
+
+// Forget every finished job without announcing it
+static void forget_done_jobs(void) {
+    for (int i = 0; i < job_count; ) {
+        if (jobs[i]->state == JOB_DONE)
+            remove_job(i);
+        else
+            i++;
+    }
+}
+
+// Forget the oldest finished jobs beyond the JOBS_KEEP_DONE newest
+static void forget_old_done_jobs(void) {
+    int done = 0;
+    for (int i = 0; i < job_count; i++)
+        done += (jobs[i]->state == JOB_DONE);
+
+    for (int i = 0; i < job_count && done > JOBS_KEEP_DONE; ) {
+        if (jobs[i]->state == JOB_DONE) {
+            remove_job(i);
+            done--;
+        } else {
+            i++;
+        }
+    }
+}
+
+// Documented in .h file
+int jobs_add(pid_t pgid, const pid_t *pids, const int *status, int npids,
+             const char *command, int stopped) {
+    if (job_count == job_capacity) {
+        int capacity = job_capacity ? job_capacity * 2 : 8;
+        Job **grown = realloc(jobs, capacity * sizeof(Job *));
+        if (grown == NULL)
+            return -1;
+        jobs = grown;
+        job_capacity = capacity;
+    }
+
+    Job *job = calloc(1, sizeof(Job));
+    if (job == NULL)
+        return -1;
+    job->pids = malloc(npids * sizeof(pid_t));
+    job->status = malloc(npids * sizeof(int));
+    job->command = strdup(command);
+    if (job->pids == NULL || job->status == NULL || job->command == NULL) {
+        free_job(job);
+        return -1;
+    }
+    memcpy(job->pids, pids, npids * sizeof(pid_t));
+    memcpy(job->status, status, npids * sizeof(int));
+    job->npids = npids;
+    job->pgid = pgid;
+    job->state = JOB_DONE;
+    for (int i = 0; i < npids; i++) {
+        if (pids[i] != -1)
+            job->state = stopped ? JOB_STOPPED : JOB_RUNNING;
+    }
+    job->number = (job_count > 0) ? jobs[job_count - 1]->number + 1 : 1;
+
+    jobs[job_count++] = job;
+    if (stopped)
+        fprintf(stderr, "\n[%d]+  Stopped                 %s\n", job->number, command);
+    else if (interactive_shell)
+        fprintf(stderr, "[%d] %d\n", job->number, (int)pgid);
+    return job->number;
+}
+
+// Record a waitpid result for one of job's stages. Returns nonzero if
+// pid belonged to the job.
+static int update_job(Job *job, pid_t pid, int status) {
+    int i;
+    for (i = 0; i < job->npids && job->pids[i] != pid; i++)
+        ;
+    if (i == job->npids)
+        return 0;
+
+    if (WIFSTOPPED(status)) {
+        job->state = JOB_STOPPED;
+    } else if (WIFCONTINUED(status)) {
+        job->state = JOB_RUNNING;
+    } else {
+        job->pids[i] = -1;
+        job->status[i] = status;
+
+        int running = 0;
+        for (int j = 0; j < job->npids; j++)
+            running += (job->pids[j] != -1);
+        if (running == 0)
+            job->state = JOB_DONE;
+    }
+    return 1;
+}
+
+// Documented in .h file
+void jobs_reap(void) {
+    char buf[64];
+    while (sigchld_pipe[0] != -1 && read(sigchld_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    // Each job is its own process group, so waiting on -pgid only
+    // ever collects background children, never a foreground stage or
+    // a parallel worker
+    for (int j = 0; j < job_count; j++) {
+        Job *job = jobs[j];
+        while (job->state != JOB_DONE) {
+            int status;
+            pid_t pid = waitpid(-job->pgid, &status, WNOHANG | WUNTRACED | WCONTINUED);
+            if (pid <= 0)
+                break;
+            update_job(job, pid, status);
+        }
+    }
+
+    if (!interactive_shell)
+        forget_old_done_jobs();
+}
+
+// Documented in .h file
+void jobs_notify(int out_fd) {
+    for (int i = 0; i < job_count; ) {
+        Job *job = jobs[i];
+        if (job->state != JOB_DONE) {
+            i++;
+            continue;
+        }
+
+        int code = job_exit_code(job);
+        char current = (i == job_count - 1) ? '+' : ' ';
+        if (code == 0)
+            dprintf(out_fd, "[%d]%c  %-24s%s\n", job->number, current, "Done", job->command);
+        else
+            dprintf(out_fd, "[%d]%c  Exit %-19d%s\n", job->number, current, code, job->command);
+        remove_job(i);
+    }
+}
+
+// Documented in .h file
+void jobs_forget(void) {
+    // The child exits soon after, so the table itself can stay
+    job_count = 0;
+    interactive_shell = 0;
+}
+
+// Find the job named by spec ("%n", "n", or NULL for the current job).
+// Returns its index, or -1 after printing an error.
+static int find_job(const char *name, const char *spec) {
+    if (spec == NULL || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0) {
+        if (job_count == 0) {
+            fprintf(stderr, "%s: no current job\n", name);
+            return -1;
+        }
+        return job_count - 1;
+    }
+
+    const char *digits = (spec[0] == '%') ? spec + 1 : spec;
+    char *end;
+    long number = strtol(digits, &end, 10);
+    if (*digits != '\0' && *end == '\0') {
+        for (int i = 0; i < job_count; i++) {
+            if (jobs[i]->number == number)
+                return i;
+        }
+    }
+    fprintf(stderr, "%s: %s: no such job\n", name, spec);
+    return -1;
+}
+
+// Block until the job has finished or stopped, or ^C
+static void wait_job(Job *job) {
+    while (job->state == JOB_RUNNING) {
+        int status;
+        pid_t pid = waitpid(-job->pgid, &status, WUNTRACED);
+        if (pid == -1) {
+            if (errno == EINTR && eventloop_interrupt_pending())
+                break;
+            if (errno == EINTR)
+                continue;
+            // Nothing left to wait for; whatever is unaccounted for
+            // was reaped elsewhere
+            job->state = JOB_DONE;
+            break;
+        }
+        update_job(job, pid, status);
+    }
+}
+
+// Documented in .h file
+int builtin_jobs(int argc, char **argv, int in_fd, int out_fd) {
+    jobs_reap();
+    for (int i = 0; i < job_count; i++) {
+        Job *job = jobs[i];
+        char current = (i == job_count - 1) ? '+' : (i == job_count - 2) ? '-' : ' ';
+        dprintf(out_fd, "[%d]%c  %-24s%s%s\n", job->number, current,
+                state_names[job->state], job->command,
+                job->state == JOB_RUNNING ? " &" : "");
+    }
+
+    // Finished jobs have now been reported
+    forget_done_jobs();
+    return 0;
+}
+
+// Documented in .h file
+int builtin_fg(int argc, char **argv, int in_fd, int out_fd) {
+    jobs_reap();
+    int i = find_job("fg", argc > 1 ? argv[1] : NULL);
+    if (i == -1)
+        return 1;
+
+    Job *job = jobs[i];
+    dprintf(out_fd, "%s\n", job->command);
+
+    // The job gets the terminal, so ^C and ^Z reach it and not us
+    jobs_set_foreground(job->pgid);
+
+    if (job->state == JOB_STOPPED) {
+        kill(-job->pgid, SIGCONT);
+        job->state = JOB_RUNNING;
+    }
+    wait_job(job);
+
+    jobs_set_foreground(0);
+
+    // Only a SIGINT sent to the shell itself ends the wait early (the
+    // terminal's goes to the job); the job carries on in the background
+    if (job->state == JOB_RUNNING)
+        return 128 + SIGINT;
+
+    if (job->state == JOB_STOPPED) {
+        fprintf(stderr, "\n[%d]+  Stopped                 %s\n", job->number, job->command);
+        // The stopped job becomes the current one
+        memmove(&jobs[i], &jobs[i + 1], (job_count - i - 1) * sizeof(Job *));
+        jobs[job_count - 1] = job;
+        return 128 + SIGTSTP;
+    }
+
+    int code = job_exit_code(job);
+    remove_job(i);
+    return code;
+}
+
+// Documented in .h file
+int builtin_bg(int argc, char **argv, int in_fd, int out_fd) {
+    jobs_reap();
+    int i = find_job("bg", argc > 1 ? argv[1] : NULL);
+    if (i == -1)
+        return 1;
+
+    Job *job = jobs[i];
+    if (job->state == JOB_STOPPED) {
+        kill(-job->pgid, SIGCONT);
+        job->state = JOB_RUNNING;
+    }
+    dprintf(out_fd, "[%d]+ %s &\n", job->number, job->command);
+    return 0;
+}
+
+// Documented in .h file
+int builtin_wait(int argc, char **argv, int in_fd, int out_fd) {
+    jobs_reap();
+
+    // No argument: every running job. Jobs waited for are not
+    // announced as Done afterwards.
+    if (argc == 1) {
+        for (int i = 0; i < job_count && !eventloop_interrupt_pending(); i++)
+            wait_job(jobs[i]);
+        forget_done_jobs();
+        return eventloop_interrupt_pending() ? 128 + SIGINT : 0;
+    }
+
+    int code = 0;
+    for (int a = 1; a < argc; a++) {
+        const char *spec = argv[a];
+        int found = -1;
+
+        // A pid names the job it belongs to
+        if (spec[0] != '%') {
+            pid_t pid = atoi(spec);
+            for (int i = 0; i < job_count && found == -1; i++) {
+                for (int s = 0; s < jobs[i]->npids; s++) {
+                    if (jobs[i]->pgid == pid || jobs[i]->pids[s] == pid)
+                        found = i;
+                }
+            }
+        }
+        if (found == -1 && (found = find_job("wait", spec)) == -1) {
+            code = 127;
+            continue;
+        }
+
+        Job *job = jobs[found];
+        wait_job(job);
+        if (eventloop_interrupt_pending())
+            return 128 + SIGINT;
+        if (job->state == JOB_DONE) {
+            code = job_exit_code(job);
+            remove_job(found);
+        } else {
+            code = 128 + SIGTSTP;
+        }
+    }
+    return code;
+}
@@ -0,0 +1,130 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+
+/*
+ * Background jobs. A pipeline ending in & is started in a process
+ * group of its own and registered here; the prompt returns at once.
+ *
+ * Children are reaped asynchronously: SIGCHLD only writes a byte to a
+ * self-pipe, and jobs_reap, run from the main loop (and, interactively,
+ * from readline's input hook while the prompt waits), collects every
+ * background child that changed state. Finished jobs are announced
+ * before the next prompt, as in other shells. Without a terminal they
+ * are kept for wait, but only the most recent few.
+ *
+ * Builtins: jobs, fg [%n], bg [%n], wait [%n|pid].
+ */
+
+/*
+ * Set up job handling: the SIGCHLD self-pipe and, for an interactive
+ * shell, the readline hook and terminal handling. Call once, early.
+ *
+ * Parameters:
+ *   interactive  Nonzero if reading commands from a terminal
+ *
+ * Returns: None
+ */
+void jobs_init(int interactive);
+
+
+/*
+ * Whether job control is on, i.e. jobs_init was told the shell is
+ * interactive. Without it, a background job's stdin is /dev/null.
+ *
+ * Parameters: None
+ *
+ * Returns: Nonzero if interactive
+ */
+int jobs_interactive(void);
+
+
+/*
+ * Register a pipeline that was just started in the background. At
+ * least one of its stages must be running (or stopped).
+ *
+ * Parameters:
+ *   pgid     The job's process group
+ *   pids     The pid of each stage, in pipeline order; -1 for a stage
+ *            that failed to start
+ *   npids    Number of stages
+ *   status   Status of each stage as from waitpid, used for stages
+ *            that failed to start
+ *   command  Text of the command line, for jobs listings
+ *   stopped  Nonzero for a foreground pipeline that was just stopped
+ *            (^Z) rather than started with &
+ *
+ * Returns: The job number, or -1 if out of memory
+ */
+int jobs_add(pid_t pgid, const pid_t *pids, const int *status, int npids,
+             const char *command, int stopped);
+
+
+/*
+ * Give the terminal to a process group, or take it back for the
+ * shell. Does nothing unless the shell is interactive.
+ *
+ * Parameters:
+ *   pgid     The group to put in the foreground; 0 for the shell's
+ *
+ * Returns: None
+ */
+void jobs_set_foreground(pid_t pgid);
+
+
+/*
+ * The read end of the SIGCHLD self-pipe, for an event loop to watch.
+ * jobs_reap drains it.
+ *
+ * Parameters: None
+ *
+ * Returns: The descriptor, or -1 before jobs_init
+ */
+int jobs_sigchld_fd(void);
+
+
+/*
+ * Collect every background child that has exited, stopped or been
+ * continued, without blocking
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void jobs_reap(void);
+
+
+/*
+ * Announce jobs that finished since the last call ("[1]+  Done  cmd")
+ * and forget them. Only the interactive shell calls this.
+ *
+ * Parameters:
+ *   out_fd   Where to print
+ *
+ * Returns: None
+ */
+void jobs_notify(int out_fd);
+
+
+/*
+ * In a child of the shell that runs a builtin: the jobs belong to the
+ * shell, not to this process, so drop them and job control with them.
+ * fg, bg and wait then find no jobs, as in a subshell.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void jobs_forget(void);
+
+
+/*
+ * Job control builtins, with the BuiltinFn signature (see builtins.h)
+ */
+int builtin_jobs(int argc, char **argv, int in_fd, int out_fd);
+int builtin_fg(int argc, char **argv, int in_fd, int out_fd);
+int builtin_bg(int argc, char **argv, int in_fd, int out_fd);
+int builtin_wait(int argc, char **argv, int in_fd, int out_fd);
+
+#endif // JOBS_H
@@ -0,0 +1,204 @@
+/*
+ * linereader.c
+ *
+ * Block-buffered line reader
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "linereader.h"
+
+// Initial buffer size, and the smallest read we issue
+#define LR_BLOCK (64 * 1024)
+
+struct _linereader
+{
+    int fd;
+    char *buf;
+    size_t capacity;
+    size_t start;   // First byte not yet returned
+    size_t scan;    // Bytes before this offset are known not to be delim
+    size_t end;     // One past the last byte read
+    int eof;
+    char delim;     // What ends a line
+    int shared;     // The commands run between lines read fd too
+    int seekable;   // fd is a file, so read-ahead can be given back
+    off_t offset;   // Where fd was left after the last line, or -1
+};
+
+
+// Documented in .h file
+LineReader LR_new(int fd)
+{
+    LineReader lr = malloc(sizeof(struct _linereader));
+    if (lr == NULL)
+        return NULL;
+
+    lr->buf = malloc(LR_BLOCK);
+    if (lr->buf == NULL)
+    {
+        free(lr);
+        return NULL;
+    }
+
+    lr->fd = fd;
+    lr->capacity = LR_BLOCK;
+    lr->start = lr->scan = lr->end = 0;
+    lr->eof = 0;
+    lr->delim = '\n';
+    lr->shared = 0;
+    lr->seekable = 0;
+    lr->offset = -1;
+    return lr;
+}
+
+
+// Documented in .h file
+void LR_set_delimiter(LineReader lr, char delim)
+{
+    lr->delim = delim;
+}
+
+
+// Documented in .h file
+void LR_set_shared(LineReader lr, int shared)
+{
+    lr->shared = shared;
+    lr->seekable = shared && lseek(lr->fd, 0, SEEK_CUR) != -1;
+    lr->offset = -1;
+}
+
+
+// Read another block into the buffer, first moving the partial line
+// to the front and growing the buffer if the line already fills it.
+// A shared pipe is read a byte at a time: whatever we read is lost to
+// the commands. Returns the number of bytes read, 0 at EOF or -1 on
+// error. A read interrupted by ^C (the shell's SIGINT handler does not
+// restart) is an error too.
+static ssize_t _LR_fill(LineReader lr)
+{
+    size_t block = (lr->shared && !lr->seekable) ? 1 : LR_BLOCK;
+
+    if (lr->start == lr->end)
+    {
+        lr->start = lr->scan = lr->end = 0;
+    }
+    else if (lr->start > 0 && lr->capacity - lr->end < block + 1)
+    {
+        memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+        lr->end -= lr->start;
+        lr->scan -= lr->start;
+        lr->start = 0;
+    }
+
+    // Room for at least one block, plus the terminating NUL
+    if (lr->capacity - lr->end < block + 1)
+    {
+        size_t capacity = lr->capacity * 2;
+        while (capacity - lr->end < block + 1)
+            capacity *= 2;
+        char *buf = realloc(lr->buf, capacity);
+        if (buf == NULL)
+            return -1;
+        lr->buf = buf;
+        lr->capacity = capacity;
+    }
+
+    ssize_t n = read(lr->fd, lr->buf + lr->end,
+                     block == 1 ? 1 : lr->capacity - lr->end - 1);
+    if (n > 0)
+        lr->end += n;
+    return n;
+}
+
+
+// For a shared file, before a line is handed out: move the file
+// offset back over what was read ahead, to just after the line, so a
+// command run for the line reads what follows it (as with any shell)
+static void _LR_give_back(LineReader lr)
+{
+    if (lr->seekable)
+        lr->offset = lseek(lr->fd, -(off_t)(lr->end - lr->start), SEEK_CUR);
+}
+
+
+// For a shared file, before looking for the next line: if nothing
+// moved the offset since the last line, skip it forward over the
+// buffered input again; otherwise a command read some of the input,
+// and the buffer is stale
+static void _LR_take_back(LineReader lr)
+{
+    if (lr->offset != -1 && lseek(lr->fd, 0, SEEK_CUR) == lr->offset)
+    {
+        lseek(lr->fd, lr->end - lr->start, SEEK_CUR);
+        return;
+    }
+
+    lr->start = lr->scan = lr->end = 0;
+    lr->eof = 0;
+}
+
+
+// Documented in .h file
+char *LR_next(LineReader lr, size_t *len)
+{
+    if (lr->seekable)
+        _LR_take_back(lr);
+
+    while (1)
+    {
+        char *newline = memchr(lr->buf + lr->scan, lr->delim, lr->end - lr->scan);
+        if (newline != NULL)
+        {
+            char *line = lr->buf + lr->start;
+            *newline = '\0';
+            if (len != NULL)
+                *len = newline - line;
+            lr->start = lr->scan = newline - lr->buf + 1;
+            _LR_give_back(lr);
+            return line;
+        }
+        lr->scan = lr->end;
+
+        if (lr->eof)
+            break;
+        ssize_t n = _LR_fill(lr);
+        if (n < 0)
+        {
+            // Not the end of the input: a partial line is not a line
+            lr->eof = 1;
+            return NULL;
+        }
+        if (n == 0)
+            break;
+    }
+
+    // End of input: whatever is left is the last line
+    lr->eof = 1;
+    if (lr->start == lr->end)
+        return NULL;
+
+    char *line = lr->buf + lr->start;
+    lr->buf[lr->end] = '\0';
+    if (len != NULL)
+        *len = lr->end - lr->start;
+    lr->start = lr->scan = lr->end;
+    _LR_give_back(lr);
+    return line;
+}
+
+
+// Documented in .h file
+void LR_free(LineReader lr)
+{
+    if (lr == NULL)
+        return;
+    free(lr->buf);
+    free(lr);
+}
@@ -0,0 +1,89 @@
+/*
+ * linereader.h
+ *
+ * Buffered reader that splits a file descriptor into lines, for
+ * running scripts and piped input without readline. Input is read in
+ * large blocks and lines are found with memchr; there is no limit on
+ * line length, the buffer grows to fit the longest line.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _LINEREADER_H_
+#define _LINEREADER_H_
+
+#include <stddef.h>
+
+// struct _linereader is defined in .c file
+typedef struct _linereader *LineReader;
+
+
+/*
+ * Create a line reader for a file descriptor. The descriptor stays
+ * owned by the caller.
+ *
+ * Parameters:
+ *   fd      Descriptor to read from
+ *
+ * Returns: The new reader, or NULL if out of memory
+ */
+LineReader LR_new(int fd);
+
+
+/*
+ * Change what ends a line, for input that is not line-oriented (for
+ * instance '\0' for the output of find -print0). The default is '\n'.
+ *
+ * Parameters:
+ *   lr      The reader
+ *   delim   The new terminator
+ *
+ * Returns: None
+ */
+void LR_set_delimiter(LineReader lr, char delim);
+
+
+/*
+ * Declare the descriptor shared with the commands run between lines,
+ * as a script on the shell's stdin is: a command reading its stdin
+ * must get the input after its own line, not lose it to read-ahead.
+ * From a file, read-ahead is given back with lseek after each line;
+ * a pipe is read a byte at a time. The default is not shared.
+ *
+ * Parameters:
+ *   lr      The reader, before its first line is read
+ *   shared  Nonzero if the descriptor is shared
+ *
+ * Returns: None
+ */
+void LR_set_shared(LineReader lr, int shared);
+
+
+/*
+ * Read the next line
+ *
+ * Parameters:
+ *   lr      The reader
+ *   len     Return space for the line's length, or NULL
+ *
+ * Returns: The line, without its '\n' (or other delimiter) and
+ *   NUL-terminated, or NULL at end of input or on a read error
+ *   (EINTR included). A final line without a delimiter is still
+ *   returned at end of input, but not after an error. The string
+ *   lives in the reader's buffer and is valid until the next call; the
+ *   caller may modify it in place.
+ */
+char *LR_next(LineReader lr, size_t *len);
+
+
+/*
+ * Free a line reader. The descriptor is not closed.
+ *
+ * Parameters:
+ *   lr      The reader to free
+ *
+ * Returns: None
+ */
+void LR_free(LineReader lr);
+
+#endif // _LINEREADER_H_
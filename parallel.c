@@ -0,0 +1,320 @@
+// parallel.c
+#define _GNU_SOURCE  // memfd_create
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "arena.h"
+#include "tokvec.h"
+#include "Tokenize.h"
+#include "parse.h"
+#include "pipeline.h"
+#include "fastpath.h"
+#include "linereader.h"
+#include "eventloop.h"
+
+// Exit statuses, as GNU parallel
+#define PARALLEL_MAX_FAILED 101
+#define PARALLEL_USAGE 255
+
+// One command line, from being read until its output is written
+typedef struct Job {
+    int number;       // 1-based line number, for reports
+    char *line;       // Copy of the command line
+    pid_t pid;        // Worker, or -1 once reaped / if never started
+    int pidfd;        // pidfd of the worker, or -1
+    int out_fd;       // memfd holding the job's stdout
+    int err_fd;       // memfd holding the job's stderr
+    int status;       // Exit status, shell-style, once finished
+    int done;
+} Job;
+
+// Growable list of every job started, in input order
+typedef struct JobList {
+    Job *jobs;
+    int count;
+    int capacity;
+} JobList;
+
+static int worker_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static Job *new_job(JobList *list, int number, const char *line) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        Job *jobs = realloc(list->jobs, capacity * sizeof(Job));
+        if (jobs == NULL)
+            return NULL;
+        list->jobs = jobs;
+        list->capacity = capacity;
+    }
+
+    Job *job = &list->jobs[list->count++];
+    memset(job, 0, sizeof(*job));
+    job->number = number;
+    job->line = strdup(line);
+    job->pid = -1;
+    job->pidfd = job->out_fd = job->err_fd = -1;
+    return job;
+}
+
+// Body of a worker process: run the pipeline with the job's capture
+// files as stdout and stderr, and nothing on stdin
+static void run_worker(const Plan *plan, const Job *job) {
+    char errmsg[256];
+    int devnull = open("/dev/null", O_RDONLY);
+
+    if (devnull != -1) {
+        dup2(devnull, STDIN_FILENO);
+        close(devnull);
+    }
+    dup2(job->out_fd, STDOUT_FILENO);
+    dup2(job->err_fd, STDERR_FILENO);
+
+    int status = execute_pipeline(plan, errmsg, sizeof(errmsg));
+    if (errmsg[0] != '\0') {
+        fprintf(stderr, "Execution error: %s\n", errmsg);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+// Parse line and start it as job. A line that does not parse finishes
+// the job at once with status 2 and the error as its stderr.
+// Returns 0, or -1 if the worker could not be started.
+static int start_job(Job *job) {
+    char errmsg[256];
+    Arena arena;
+
+    job->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+    job->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+    if (job->out_fd == -1 || job->err_fd == -1) {
+        perror("parallel: memfd_create");
+        return -1;
+    }
+
+    // The pipeline only has to live until the fork; the worker has its
+    // own copy of the arena
+    arena_init(&arena, 1024);
+    TokVec tokens = TOK_tokenize_input(&arena, job->line, errmsg, sizeof(errmsg));
+    Plan *plan = NULL;
+    if (tokens == NULL) {
+        dprintf(job->err_fd, "Tokenization error: %s\n", errmsg);
+    } else if (TOK_next_type(tokens) != TOK_END) {
+        plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+        if (plan == NULL)
+            dprintf(job->err_fd, "Parsing error: %s\n", errmsg);
+    }
+
+    if (plan == NULL) {
+        arena_free(&arena);
+        job->status = 2;
+        job->done = 1;
+        return 0;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    job->pid = fork();
+    if (job->pid == 0)
+        run_worker(plan, job);
+
+    arena_free(&arena);
+    if (job->pid == -1) {
+        perror("parallel: fork");
+        return -1;
+    }
+
+    job->pidfd = pidfd_open(job->pid, 0);
+    return 0;
+}
+
+// Reap a finished worker
+static void finish_job(Job *job) {
+    int status;
+
+    while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    if (WIFSIGNALED(status))
+        job->status = 128 + WTERMSIG(status);
+    else
+        job->status = WEXITSTATUS(status);
+
+    if (job->pidfd != -1)
+        close(job->pidfd);
+    job->pid = -1;
+    job->pidfd = -1;
+    job->done = 1;
+}
+
+// Block until at least one running job has finished, and reap every
+// job that has. Workers are watched through their pidfds, so only our
+// own children are waited for; without pidfds, the oldest job is.
+// Returns early, having reaped nothing, on ^C.
+static void wait_for_jobs(JobList *list, int first) {
+    struct pollfd fds[list->count - first];
+    Job *owners[list->count - first];
+    int nfds = 0;
+
+    for (int i = first; i < list->count; i++) {
+        Job *job = &list->jobs[i];
+        if (job->pid == -1)
+            continue;
+        if (job->pidfd == -1) {
+            finish_job(job);
+            return;
+        }
+        fds[nfds].fd = job->pidfd;
+        fds[nfds].events = POLLIN;
+        owners[nfds++] = job;
+    }
+    if (nfds == 0)
+        return;
+
+    while (poll(fds, nfds, -1) == -1) {
+        if (errno != EINTR || eventloop_interrupt_pending())
+            return;
+    }
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents != 0)
+            finish_job(owners[i]);
+    }
+}
+
+// Copy a capture file to fd in one go, then close it
+static void flush_capture(int capture_fd, int fd) {
+    if (lseek(capture_fd, 0, SEEK_SET) == 0)
+        fd_copy(capture_fd, fd);
+    close(capture_fd);
+}
+
+// Write out a finished job's output and, if it failed, a report.
+// Returns nonzero if the job failed.
+static int report_job(Job *job, int out_fd) {
+    flush_capture(job->out_fd, out_fd);
+    flush_capture(job->err_fd, STDERR_FILENO);
+    job->out_fd = job->err_fd = -1;
+
+    if (job->status != 0) {
+        fprintf(stderr, "parallel: job %d (%s) exited with status %d\n",
+                job->number, job->line, job->status);
+    }
+    free(job->line);
+    job->line = NULL;
+    return job->status != 0;
+}
+
+// Documented in .h file
+int builtin_parallel(int argc, char **argv, int in_fd, int out_fd) {
+    int max_jobs = worker_count();
+    int keep_order = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            max_jobs = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0') {
+            max_jobs = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            keep_order = 1;
+        } else {
+            fprintf(stderr, "usage: parallel [-j N] [-k] < command-lines\n");
+            return PARALLEL_USAGE;
+        }
+    }
+    if (max_jobs < 1) {
+        fprintf(stderr, "parallel: -j must be at least 1\n");
+        return PARALLEL_USAGE;
+    }
+
+    LineReader lr = LR_new(in_fd);
+    if (lr == NULL) {
+        perror("parallel");
+        return PARALLEL_USAGE;
+    }
+
+    JobList list = { NULL, 0, 0 };
+    int running = 0;    // Jobs started and not yet reaped
+    int reported = 0;   // With -k: jobs before this one have been reported
+    int failed = 0;
+    int line_number = 0;
+    int input_done = 0;
+    int interrupted = 0;
+
+    while (!input_done || running > 0) {
+        // Fill every free worker slot from the input
+        while (!input_done && running < max_jobs) {
+            char *line = LR_next(lr, NULL);
+            if (line == NULL) {
+                input_done = 1;
+                break;
+            }
+            line_number++;
+            if (line[strspn(line, " \t")] == '\0')
+                continue;
+
+            Job *job = new_job(&list, line_number, line);
+            if (job == NULL || job->line == NULL || start_job(job) != 0) {
+                // Stop reading, but finish and report what is running
+                if (job != NULL) {
+                    job->status = 1;
+                    job->done = 1;
+                }
+                input_done = 1;
+                break;
+            }
+            if (!job->done)
+                running++;
+        }
+
+        // ^C: start nothing more. The running jobs are in our process
+        // group, so a ^C from the terminal reached them too; they are
+        // waited for and reported as usual.
+        if (eventloop_interrupt_pending()) {
+            interrupted = 1;
+            input_done = 1;
+        }
+
+        if (running > 0) {
+            wait_for_jobs(&list, reported);
+        }
+
+        // Report what is finished: everything, or with -k the finished
+        // prefix of the input
+        running = 0;
+        for (int i = reported; i < list.count; i++) {
+            Job *job = &list.jobs[i];
+            if (!job->done) {
+                running++;
+                continue;
+            }
+            if (job->line == NULL)
+                continue;   // already reported
+            if (keep_order && i != reported)
+                continue;
+            failed += report_job(job, out_fd);
+            if (i == reported)
+                reported++;
+        }
+
+        // Skip over jobs reported out of order
+        while (reported < list.count && list.jobs[reported].line == NULL)
+            reported++;
+    }
+
+    LR_free(lr);
+    free(list.jobs);
+    if (interrupted)
+        return 128 + SIGINT;
+    return failed > PARALLEL_MAX_FAILED ? PARALLEL_MAX_FAILED : failed;
+}
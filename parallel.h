@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+ * parallel [-j N] [-k]: run the command lines read from standard input
+ * as independent jobs, up to N at a time (default: one per online
+ * CPU).
+ *
+ * Each line is tokenized and parsed by the shell before its job
+ * starts, so a malformed line is reported without running anything.
+ * Every job is a forked worker that runs its pipeline with
+ * execute_pipeline, its stdout and stderr captured in memory files.
+ * A finished job's output is written out in one piece, so the output
+ * of concurrent jobs is never interleaved. Jobs are printed in the
+ * order they finish, or in input order with -k. A job that fails is
+ * reported on stderr with its line number and status.
+ *
+ * Has the BuiltinFn signature (see builtins.h).
+ *
+ * Returns: The number of failed jobs, capped at 101 (as GNU
+ *   parallel), or 255 for a usage error
+ */
+int builtin_parallel(int argc, char **argv, int in_fd, int out_fd);
+
+#endif // PARALLEL_H
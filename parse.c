@@ -2,162 +2,311 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <glob.h> // Include glob for wildcard expansion
+#include <stdint.h>
 #include "parse.h"
 #include "Tokenize.h"
 #include "pipeline.h"
 #include "ast.h"
-#include "clist.h"
+#include "tokvec.h"
+#include "arena.h"
+#include "globcache.h"
+#include "stats.h"
+#include "trace.h"
 
-Pipeline *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz)
+// GC_expand callback: the matches become arguments of the open
+// stage, in one append
+static void add_glob_matches(void *ctx, char **paths, size_t count)
 {
-    Pipeline *pipeline = NULL;
-    Pipeline *current_pipeline = NULL;
-    Command *current_command = NULL;
+    plan_add_arguments(ctx, paths, count);
+}
+
+// Parse a timeout(1)-style duration: a number of seconds, or of
+// minutes, hours or days with an m, h or d suffix. Returns the
+// duration in milliseconds, or -1 if text is not a positive duration.
+static long parse_duration(const char *text)
+{
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || !(value > 0))
+    {
+        return -1;
+    }
+
+    double scale = 1000;
+    if (*end == 's' || *end == 'm' || *end == 'h' || *end == 'd')
+    {
+        scale *= (*end == 'm') ? 60 : (*end == 'h') ? 3600 : (*end == 'd') ? 86400 : 1;
+        end++;
+    }
+    if (*end != '\0' || value * scale > 1e15)
+    {
+        return -1;
+    }
+    return (long)(value * scale + 0.5);
+}
+
+// Whether stage, so far, is under batch, so that its arguments need
+// not fit in one execve
+static int is_batch_command(const PlanBuilder *pb, const Stage *stage)
+{
+    return stage->argc > 0 && strcmp(plan_stage_args(pb, stage)[0], "batch") == 0;
+}
+
+// A stage starting with "batch [-P N] [-0] cmd" runs cmd as xargs
+// would, as many times as its arguments need to fit in ARG_MAX, one
+// run at a time unless -P says otherwise (see batch.h): the words are
+// consumed here, and what can be divided
+// among the runs is recorded. That is the largest glob expansion if
+// there is one, else every argument; with -0 it is only what stdin
+// adds. Returns 0, or -1 with errmsg set if the prefix is malformed.
+static int take_batch_prefix(PlanBuilder *pb, Stage *stage, char *errmsg, size_t errmsg_sz)
+{
+    if (!is_batch_command(pb, stage))
+    {
+        return 0;
+    }
+
+    char **args = plan_stage_args(pb, stage);
+    int i = 1;
+    stage->batch_jobs = 1;
+    for (; i < stage->argc && args[i][0] == '-'; i++)
+    {
+        const char *opt = args[i];
+        if (strcmp(opt, "--") == 0)
+        {
+            i++;
+            break;
+        }
+        else if (strcmp(opt, "-0") == 0)
+        {
+            stage->batch_stdin = 1;
+        }
+        else if (strncmp(opt, "-P", 2) == 0)
+        {
+            const char *value = opt[2] != '\0' ? opt + 2
+                              : (i + 1 < stage->argc) ? args[++i] : "";
+            char *end;
+            long jobs = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || jobs < 0 || jobs > 1024)
+            {
+                snprintf(errmsg, errmsg_sz, "batch: -P needs a number from 0 to 1024");
+                return -1;
+            }
+            stage->batch_jobs = (int)jobs;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (i == stage->argc || args[i][0] == '-')
+    {
+        snprintf(errmsg, errmsg_sz, "usage: batch [-P N] [-0] command [args...]");
+        return -1;
+    }
+
+    plan_drop_arguments(stage, i);
+    stage->batch = 1;
+    if (stage->batch_stdin)
+    {
+        stage->split_start = stage->split_end = stage->argc;
+    }
+    else if (stage->split_end > 0)
+    {
+        stage->split_start -= i;
+        stage->split_end -= i;
+    }
+    else
+    {
+        stage->split_start = 1;
+        stage->split_end = stage->argc;
+    }
+    return 0;
+}
+
+// A pipeline starting with "timeout N cmd" runs cmd, and everything
+// piped from it, with a time limit: the words are consumed here and
+// the limit is enforced by the executor. Anything else spelled
+// timeout (options, a bad duration) is left for timeout(1). This is
+// called as the first stage's third word arrives, so that cmd is seen
+// as the stage's first word: it may be batch. Returns the limit in
+// milliseconds, or 0.
+static long take_timeout_prefix(PlanBuilder *pb)
+{
+    Stage *stage = &pb->stages[0];
+    char **args = plan_stage_args(pb, stage);
+    if (pb->stage_count != 1 || stage->argc != 2 || strcmp(args[0], "timeout") != 0)
+    {
+        return 0;
+    }
+
+    long timeout_ms = parse_duration(args[1]);
+    if (timeout_ms <= 0)
+    {
+        return 0;
+    }
+
+    plan_drop_arguments(stage, 2);
+    return timeout_ms;
+}
+
+Plan *parse_tokens(Arena *arena, TokVec tokens, char *errmsg, size_t errmsg_sz)
+{
+    PlanBuilder pb;
+    Stage *current_stage = NULL;  // The stage taking arguments, if any
+    char *input_file = NULL;   // Redirections seen for the stage being built
+    char *output_file = NULL;
     int pipe_count = 0;
-    int redirection_count = 0;
+    int background = 0;
+    int globs = 0;
+    long timeout_ms = 0;
 
     // Reset error message buffer
     if (errmsg)
         errmsg[0] = '\0';
 
     // Validate input tokens
-    if (CL_length(tokens) == 0)
+    if (TOK_next_type(tokens) == TOK_END)
     {
         snprintf(errmsg, errmsg_sz, "No tokens to parse");
         return NULL;
     }
 
-    while (CL_length(tokens) > 0)
+    plan_builder_init(&pb, arena);
+    while (TOK_next_type(tokens) != TOK_END)
     {
         Token token = TOK_next(tokens);
         TOK_consume(tokens);
 
         if (token.type == TOK_WORD || token.type == TOK_QUOTED_WORD)
         {
-            if (current_command == NULL)
+            current_stage = plan_stage(&pb);
+            if (timeout_ms == 0)
             {
-                current_command = create_command();
+                timeout_ms = take_timeout_prefix(&pb);
             }
-            add_argument_to_command(current_command, token.value);
 
-            // Handle globbing for wildcard expansion
-            if (strchr(token.value, '*') || strchr(token.value, '?') ||
-                strchr(token.value, '~') || strchr(token.value, '[') ||
-                strchr(token.value, ']'))
+            // An unquoted word with wildcards (or a leading ~) is
+            // replaced by its matches; with none, it stays as it is
+            size_t matches = 0;
+            if (token.type == TOK_WORD && GC_has_magic(token.value))
             {
-                glob_t globbuf;
-                int glob_result = glob(token.value, GLOB_TILDE_CHECK, NULL, &globbuf);
-                if (glob_result == 0)
+                globs++;
+                int batched = is_batch_command(&pb, current_stage);
+                int first = current_stage->argc;
+                STAT_BEGIN(glob_start);
+                uint64_t glob_trace = trace_begin();
+                matches = GC_expand(arena, token.value, batched ? SIZE_MAX : 0,
+                                    add_glob_matches, &pb);
+                STAT_END(STAT_GLOB, glob_start);
+                trace_end("glob", glob_trace, token.value);
+                if (matches == GC_TOO_LONG)
+                {
+                    snprintf(errmsg, errmsg_sz, "%s: expansion exceeds ARG_MAX (see batch)",
+                             token.value);
+                    return NULL;
+                }
+                if (batched && (int)matches > current_stage->split_end - current_stage->split_start)
                 {
-                    for (size_t i = 0; i < globbuf.gl_pathc; i++)
-                    {
-                        add_argument_to_command(current_command, globbuf.gl_pathv[i]);
-                    }
-                    globfree(&globbuf);
+                    current_stage->split_start = first;
+                    current_stage->split_end = first + (int)matches;
                 }
             }
+            if (matches == 0)
+            {
+                plan_add_argument(&pb, token.value);
+            }
         }
         else if (token.type == TOK_PIPE)
         {
             pipe_count++;
 
             // Ensure commands exist before and after pipe
-            if (current_command == NULL)
+            if (current_stage == NULL)
             {
                 snprintf(errmsg, errmsg_sz, "No command specified before pipe");
-                free_pipeline(pipeline);
                 return NULL;
             }
 
-            Pipeline *new_pipeline = malloc(sizeof(Pipeline));
-            if (new_pipeline == NULL)
+            if (take_batch_prefix(&pb, current_stage, errmsg, errmsg_sz) != 0)
             {
-                snprintf(errmsg, errmsg_sz, "Memory allocation error for pipeline");
-                free_pipeline(pipeline);
                 return NULL;
             }
 
-            new_pipeline->command = current_command;
-            new_pipeline->next = NULL;
-            new_pipeline->input_file = NULL;
-            new_pipeline->output_file = NULL;
-
-            if (pipeline == NULL)
-            {
-                pipeline = new_pipeline;
-            }
-            else
-            {
-                current_pipeline->next = new_pipeline;
-            }
-
-            current_pipeline = new_pipeline;
-            current_command = NULL;
+            plan_end_stage(&pb, input_file, output_file);
+            current_stage = NULL;
+            input_file = NULL;
+            output_file = NULL;
         }
         else if (token.type == TOK_LESSTHAN || token.type == TOK_GREATERTHAN)
         {
-            redirection_count++;
-
-            // Prevent multiple redirections
-            if (redirection_count > 1)
+            // Prevent multiple redirections of the same stream in one stage
+            if ((token.type == TOK_LESSTHAN && input_file != NULL) ||
+                (token.type == TOK_GREATERTHAN && output_file != NULL))
             {
                 snprintf(errmsg, errmsg_sz, "Multiple redirections not allowed");
-                free_pipeline(pipeline);
                 return NULL;
             }
 
-            if (CL_length(tokens) == 0)
+            TokenType file_type = TOK_next_type(tokens);
+            if (file_type != TOK_WORD && file_type != TOK_QUOTED_WORD)
             {
                 snprintf(errmsg, errmsg_sz, "Expected filename after redirection");
-                free_pipeline(pipeline);
                 return NULL;
             }
 
             Token file_token = TOK_next(tokens);
             TOK_consume(tokens);
 
-            if (token.type == TOK_LESSTHAN && current_pipeline != NULL)
+            // Redirections belong to the stage they appear in; they are
+            // recorded when that stage is closed
+            if (token.type == TOK_LESSTHAN)
+            {
+                input_file = file_token.value;
+            }
+            else
             {
-                set_input_file(current_pipeline, file_token.value);
+                output_file = file_token.value;
             }
-            else if (token.type == TOK_GREATERTHAN && current_pipeline != NULL)
+        }
+        else if (token.type == TOK_AMPERSAND)
+        {
+            // & runs the whole pipeline in the background, so it can
+            // only come at the very end
+            if (current_stage == NULL)
             {
-                set_output_file(current_pipeline, file_token.value);
+                snprintf(errmsg, errmsg_sz, "No command specified before &");
+                return NULL;
             }
+            if (TOK_next_type(tokens) != TOK_END)
+            {
+                snprintf(errmsg, errmsg_sz, "& must end the command line");
+                return NULL;
+            }
+            background = 1;
         }
         else
         {
             snprintf(errmsg, errmsg_sz, "Unexpected token: %s", token.value);
-            free_pipeline(pipeline);
             return NULL;
         }
     }
 
-    if (current_command != NULL)
+    if (current_stage == NULL)
     {
-        Pipeline *new_pipeline = malloc(sizeof(Pipeline));
-        if (new_pipeline == NULL)
-        {
-            snprintf(errmsg, errmsg_sz, "Memory allocation error for final pipeline");
-            free_pipeline(pipeline);
-            return NULL;
-        }
-
-        new_pipeline->command = current_command;
-        new_pipeline->next = NULL;
-        new_pipeline->input_file = NULL;
-        new_pipeline->output_file = NULL;
-
-        if (pipeline == NULL)
-        {
-            pipeline = new_pipeline;
-        }
-        else
-        {
-            current_pipeline->next = new_pipeline;
-        }
+        snprintf(errmsg, errmsg_sz, pipe_count > 0 ? "No command specified after pipe"
+                                                   : "No command specified");
+        return NULL;
+    }
+    else if (take_batch_prefix(&pb, current_stage, errmsg, errmsg_sz) != 0)
+    {
+        return NULL;
     }
+    plan_end_stage(&pb, input_file, output_file);
 
-    return pipeline;
+    Plan *plan = plan_finish(&pb);
+    plan->background = background;
+    plan->timeout_ms = timeout_ms;
+    plan->globs = globs;
+    return plan;
 }
@@ -2,16 +2,21 @@
 #define PARSE_H
 
 #include "Tokenize.h"
-#include "ast.h"  // Include ast.h to use the Command and Pipeline structs
+#include "ast.h"  // Include ast.h to use the Plan struct
 #include "pipeline.h"
-#include "clist.h"
+#include "tokvec.h"
+#include "arena.h"
 
 
 
-// Function to parse a list of tokens into a pipeline
-Pipeline *parse_tokens(CList tokens, char *errmsg, size_t errmsg_sz);
-
-// Helper functions
-void free_pipeline(Pipeline *pipeline);
+// Function to parse a list of tokens into a plan (see ast.h). The
+// plan is allocated from arena in one block, its arguments and file
+// names borrow the token text, and glob matches (see globcache.h) are
+// allocated from arena; all of it lives until the arena is reset. A
+// trailing & sets the plan's background, and a leading "timeout N" is
+// removed and sets its timeout_ms. A stage starting with
+// "batch [-P N] [-0]" has those words removed and its batch fields set
+// (see batch.h).
+Plan *parse_tokens(Arena *arena, TokVec tokens, char *errmsg, size_t errmsg_sz);
 
 #endif // PARSE_H
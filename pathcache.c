@@ -0,0 +1,279 @@
+/*
+ * pathcache.c
+ *
+ * Open-addressing hash table from command name to executable path
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+
+// Initial number of slots; always a power of two
+#define PC_INITIAL_CAPACITY 64
+
+typedef struct
+{
+    char *name;          // Command name, or NULL if the slot is empty
+    char *path;          // Resolved absolute path
+    unsigned long hits;  // Number of times this entry was used
+} PathEntry;
+
+static PathEntry *table = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+
+// $PATH at the time the cache was filled
+static char *cached_path_var = NULL;
+
+static size_t total_hits = 0;
+static size_t total_misses = 0;
+
+
+// FNV-1a string hash
+static size_t _PC_hash(const char *s)
+{
+    size_t h = 14695981039346656037UL;
+
+    for (; *s != '\0'; s++)
+    {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211UL;
+    }
+
+    return h;
+}
+
+
+/*
+ * Find the slot for name: either the slot holding it, or the empty
+ * slot where it would be inserted
+ *
+ * Parameters:
+ *   name    The command name
+ *
+ * Returns: Pointer into table
+ */
+static PathEntry *_PC_find_slot(const char *name)
+{
+    size_t mask = capacity - 1;
+    size_t i = _PC_hash(name) & mask;
+
+    while (table[i].name != NULL && strcmp(table[i].name, name) != 0)
+        i = (i + 1) & mask;
+
+    return &table[i];
+}
+
+
+// Double the table size and rehash every entry
+static void _PC_grow(void)
+{
+    PathEntry *old_table = table;
+    size_t old_capacity = capacity;
+
+    capacity = capacity ? capacity * 2 : PC_INITIAL_CAPACITY;
+    table = calloc(capacity, sizeof(PathEntry));
+    if (table == NULL)
+    {
+        perror("Failed to allocate memory for path cache");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_table[i].name != NULL)
+            *_PC_find_slot(old_table[i].name) = old_table[i];
+    }
+
+    free(old_table);
+}
+
+
+/*
+ * Remove one entry, re-inserting the rest of its probe run so that
+ * later lookups still find them
+ *
+ * Parameters:
+ *   entry   The slot to empty
+ *
+ * Returns: None
+ */
+static void _PC_remove(PathEntry *entry)
+{
+    size_t mask = capacity - 1;
+    size_t i = (size_t)(entry - table);
+
+    free(entry->name);
+    free(entry->path);
+    entry->name = NULL;
+    count--;
+
+    for (i = (i + 1) & mask; table[i].name != NULL; i = (i + 1) & mask)
+    {
+        PathEntry moved = table[i];
+        table[i].name = NULL;
+        *_PC_find_slot(moved.name) = moved;
+    }
+}
+
+
+/*
+ * Check that path names an executable regular file
+ *
+ * Parameters:
+ *   path    The candidate path
+ *
+ * Returns: 1 if path can be executed, 0 otherwise
+ */
+static int _PC_is_executable(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+
+/*
+ * Search $PATH for name, the same way execvp does
+ *
+ * Parameters:
+ *   name       The command name
+ *   path_var   The value of $PATH
+ *
+ * Returns: A newly malloc'd path, or NULL if not found
+ */
+static char *_PC_search(const char *name, const char *path_var)
+{
+    size_t name_len = strlen(name);
+    const char *dir = path_var;
+
+    while (1)
+    {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        // An empty component means the current directory
+        char *candidate = malloc(dir_len + name_len + 3);
+        if (candidate == NULL)
+        {
+            perror("Failed to allocate memory for path lookup");
+            exit(EXIT_FAILURE);
+        }
+        if (dir_len == 0)
+            sprintf(candidate, "./%s", name);
+        else
+            sprintf(candidate, "%.*s/%s", (int)dir_len, dir, name);
+
+        if (_PC_is_executable(candidate))
+            return candidate;
+        free(candidate);
+
+        if (end == NULL)
+            return NULL;
+        dir = end + 1;
+    }
+}
+
+
+// Documented in .h file
+const char *PC_lookup(const char *name)
+{
+    if (name == NULL || name[0] == '\0')
+        return NULL;
+
+    if (strchr(name, '/') != NULL)
+        return name;
+
+    // execvp's default search path when $PATH is unset
+    const char *path_var = getenv("PATH");
+    if (path_var == NULL)
+        path_var = "/bin:/usr/bin";
+
+    if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0)
+    {
+        PC_clear();
+        free(cached_path_var);
+        cached_path_var = strdup(path_var);
+    }
+
+    if (capacity > 0)
+    {
+        PathEntry *entry = _PC_find_slot(name);
+        if (entry->name != NULL)
+        {
+            if (_PC_is_executable(entry->path))
+            {
+                entry->hits++;
+                total_hits++;
+                return entry->path;
+            }
+            // The binary went away; search again
+            _PC_remove(entry);
+        }
+    }
+
+    total_misses++;
+
+    char *path = _PC_search(name, path_var);
+    if (path == NULL)
+        return NULL;
+
+    if ((count + 1) * 10 > capacity * 7)
+        _PC_grow();
+
+    PathEntry *entry = _PC_find_slot(name);
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    count++;
+
+    return path;
+}
+
+
+// Documented in .h file
+void PC_clear(void)
+{
+    for (size_t i = 0; i < capacity; i++)
+    {
+        if (table[i].name != NULL)
+        {
+            free(table[i].name);
+            free(table[i].path);
+            table[i].name = NULL;
+        }
+    }
+
+    count = 0;
+}
+
+
+// Documented in .h file
+void PC_print(int out_fd)
+{
+    if (count > 0)
+        dprintf(out_fd, "hits\tpath\n");
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        if (table[i].name != NULL)
+            dprintf(out_fd, "%4lu\t%s\n", table[i].hits, table[i].path);
+    }
+
+    dprintf(out_fd, "%zu lookups: %zu hits, %zu misses\n",
+            total_hits + total_misses, total_hits, total_misses);
+}
+
+
+// Documented in .h file
+void PC_counters(size_t *hits, size_t *misses)
+{
+    *hits = total_hits;
+    *misses = total_misses;
+}
@@ -0,0 +1,65 @@
+/*
+ * pathcache.h
+ *
+ * Cache of resolved executable paths, so that external commands are
+ * looked up on $PATH once per session rather than by execvp on every
+ * launch
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+#include <stddef.h>
+
+/*
+ * Resolve a command name to the absolute path of the executable that
+ * execvp would run. Results are cached; the whole cache is dropped
+ * when $PATH changes, and an entry is dropped when its file is no
+ * longer executable. Names containing a '/' are not searched for and
+ * are returned unchanged.
+ *
+ * Parameters:
+ *   name    The command name (args[0])
+ *
+ * Returns: The path to execute, or NULL if name was not found on
+ *   $PATH. The string is owned by the cache and stays valid until
+ *   the next call into this module.
+ */
+const char *PC_lookup(const char *name);
+
+
+/*
+ * Forget every cached path (hash -r). The hit/miss counters are kept.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void PC_clear(void);
+
+
+/*
+ * Print the cache contents and the hit/miss counters
+ *
+ * Parameters:
+ *   out_fd  Descriptor to print to
+ *
+ * Returns: None
+ */
+void PC_print(int out_fd);
+
+
+/*
+ * Retrieve the lookup counters
+ *
+ * Parameters:
+ *   hits      Return space for the number of lookups served from the cache
+ *   misses    Return space for the number of lookups that searched $PATH
+ *
+ * Returns: None
+ */
+void PC_counters(size_t *hits, size_t *misses);
+
+#endif /* _PATHCACHE_H_ */
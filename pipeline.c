@@ -1,43 +1,29 @@
 // pipeline.c
+#define _GNU_SOURCE  // pipe2, O_CLOEXEC, gettid
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <spawn.h>
+#include <signal.h>
+#include <pthread.h>
 #include "pipeline.h"
 #include "ast.h"
+#include "pathcache.h"
+#include "builtins.h"
+#include "fastpath.h"
+#include "stats.h"
+#include "trace.h"
+#include "jobs.h"
+#include "eventloop.h"
+#include "batch.h"
 
-// Function to handle built-in commands
-int handle_builtin_commands(Command *cmd) {
-    if (cmd == NULL || cmd->args == NULL || cmd->arg_count == 0) return -1;
-
-    const char *command = cmd->args[0];
-
-    if (strcmp(command, "pwd") == 0) {
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            printf("%s\n", cwd);
-            return 0;
-        }
-        perror("pwd");
-        return 1;
-    } else if (strcmp(command, "author") == 0) {
-        printf("Uwase Pauline\n");
-        return 0;
-    } else if (strcmp(command, "cd") == 0) {
-        const char *target_dir = (cmd->arg_count > 1) ? cmd->args[1] : getenv("HOME");
-        if (target_dir == NULL || chdir(target_dir) != 0) {
-            perror("cd");
-            return 1;
-        }
-        return 0;
-    } else if (strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0) {
-        exit(0);
-    }
-
-    return -1; // Not a built-in command
-}
+extern char **environ;
 
 // Redirection handling function
 int handle_redirection(char **args) {
@@ -66,128 +52,838 @@ int handle_redirection(char **args) {
     return input_fd != -1 || output_fd != -1 ? 0 : -1;
 }
 
+// How external commands are started; see set_launch_mode
+static LaunchMode launch_mode = LAUNCH_SPAWN;
+
+// Documented in .h file
+void set_launch_mode(LaunchMode mode) {
+    launch_mode = mode;
+}
+
+// Documented in .h file
+LaunchMode get_launch_mode(void) {
+    return launch_mode;
+}
+
+// set -o pipefail
+static int pipefail = 0;
+
+// Documented in .h file
+void set_pipefail(int on) {
+    pipefail = on;
+}
+
+// Documented in .h file
+int get_pipefail(void) {
+    return pipefail;
+}
+
+// Documented in .h file
+const char *launch_mode_name(LaunchMode mode) {
+    return mode == LAUNCH_SPAWN ? "spawn" : "fork";
+}
+
+// Documented in .h file
+int parse_launch_mode(const char *name, LaunchMode *mode) {
+    if (strcmp(name, "spawn") == 0) {
+        *mode = LAUNCH_SPAWN;
+    } else if (strcmp(name, "fork") == 0) {
+        *mode = LAUNCH_FORK;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Descriptors a stage's child should end up with
+typedef struct StageFds {
+    int in_fd;     // Becomes stdin, or -1 to inherit
+    int out_fd;    // Becomes stdout, or -1 to inherit
+    int close_fd;  // Must not leak into the child (our end of its pipe), or -1
+    pid_t pgid;    // Process group to join: 0 for a new one, -1 to stay in ours
+    int terminal;  // Nonzero to take the terminal for that group
+} StageFds;
+
+// Signals the shell ignores or catches for itself, which every stage
+// gets back with their default action (ignored signals survive exec).
+// SIGPIPE above all: a producer whose reader has gone must die of it.
+static const int child_default_signals[] = {
+    SIGPIPE, SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGALRM
+};
+#define N_CHILD_DEFAULT_SIGNALS \
+    (sizeof(child_default_signals) / sizeof(child_default_signals[0]))
+
+// Child-side setup shared by every forked stage: join the stage's
+// process group, take the terminal if it is to have it, and undo the
+// shell's own signal handling
+static void setup_child(const StageFds *fds) {
+    if (fds->pgid != -1)
+        setpgid(0, fds->pgid);
+    // Before SIGTTOU is restored, or this would stop us
+    if (fds->terminal)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    for (size_t i = 0; i < N_CHILD_DEFAULT_SIGNALS; i++)
+        signal(child_default_signals[i], SIG_DFL);
+
+    // The mask survives exec too, and a stage started from a builtin's
+    // thread (parallel) would inherit its blocked SIGPIPE
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+// Nonzero if stage timings are wanted, for stats or for a trace. A
+// build without stats only measures while a trace is being written.
+static int measuring(void) {
+#ifdef PLAIDSH_STATS
+    return 1;
+#else
+    return trace_enabled();
+#endif
+}
+
+// The current time when measuring, else 0
+static uint64_t stage_clock(void) {
+    return measuring() ? stats_now() : 0;
+}
+
+// Wait for a forked child's exec. The child holds the write end of a
+// close-on-exec pipe, so the parent's read sees EOF exactly when exec
+// succeeds (or the child exits). Returns the time that happened.
+static uint64_t wait_for_exec(int exec_fd) {
+    char c;
+    while (read(exec_fd, &c, 1) == -1 && errno == EINTR)
+        ;
+    close(exec_fd);
+    return stats_now();
+}
+
+// Start one stage with fork + exec; redirections are applied in the
+// child before it execs. When measuring, the stage's fork and exec
+// times are recorded. Returns the child pid, or -1 if fork failed.
+static pid_t launch_fork(const Plan *plan, const Stage *current, const char *exe_path,
+                         const StageFds *fds, StageStatus *stage) {
+    const char *input_file = plan_input_file(plan, current);
+    const char *output_file = plan_output_file(plan, current);
+    char **args = plan_args(plan, current);
+
+    // Seeing the exec complete costs a pipe and a blocking read, so
+    // only do it when measuring (see above)
+    int exec_pipe[2] = { -1, -1 };
+    if (measuring() && pipe2(exec_pipe, O_CLOEXEC) == -1)
+        exec_pipe[0] = exec_pipe[1] = -1;
+
+    stage->launch_ns = stage_clock();
+    pid_t pid = fork();
+
+    if (pid != 0) {
+        // Also from this side, so the group exists before the next
+        // stage tries to join it
+        if (pid > 0 && fds->pgid != -1)
+            setpgid(pid, fds->pgid ? fds->pgid : pid);
+        stage->started_ns = stage_clock();
+        if (exec_pipe[0] != -1) {
+            close(exec_pipe[1]);
+            if (pid > 0)
+                stage->exec_ns = wait_for_exec(exec_pipe[0]);
+            else
+                close(exec_pipe[0]);
+        }
+        if (pid > 0 && !current->batch)
+            stage->execs = 1;
+        return pid;
+    }
+
+    // Child process. Every way out of it is exec or _exit: exit would
+    // run our atexit handlers here (the trace file belongs to the shell)
+    setup_child(fds);
+
+    // If there was a previous pipe, redirect input from it
+    if (fds->in_fd != -1) {
+        dup2(fds->in_fd, STDIN_FILENO);
+        close(fds->in_fd);
+    }
+
+    // If this is not the last command, redirect output to the pipe
+    if (fds->out_fd != -1) {
+        dup2(fds->out_fd, STDOUT_FILENO);
+        close(fds->out_fd);
+    }
+    if (fds->close_fd != -1) {
+        close(fds->close_fd);
+    }
+
+    // Handle input/output redirections; like other shells, an
+    // explicit redirection takes precedence over the pipe
+    if (input_file) {
+        int input_fd = open(input_file, O_RDONLY);
+        if (input_fd == -1) {
+            perror("Input file error");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(input_fd, STDIN_FILENO);
+        close(input_fd);
+    }
+
+    if (output_file) {
+        int output_fd = open(output_file,
+                             O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output_fd == -1) {
+            perror("Output file error");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(output_fd, STDOUT_FILENO);
+        close(output_fd);
+    }
+
+    // Ensure stdout is flushed
+    fflush(stdout);
+
+    // A batch stage stays a shell process that starts the runs itself.
+    // With no exec to come, the exec pipe must be closed by hand. A
+    // run killed by a signal takes the stage with it (quietly, for
+    // SIGPIPE), as if the stage had been the run.
+    if (current->batch) {
+        if (exec_pipe[1] != -1)
+            close(exec_pipe[1]);
+        int status = batch_run(plan, current, exe_path);
+        if (status > 128)
+            raise(status - 128);
+        _exit(status);
+    }
+
+    // Execute command. execvp remains the fallback, both for names
+    // not on $PATH (for its error) and for scripts without a #! line,
+    // which only execvp knows to hand to sh
+    if (exe_path != NULL)
+        execv(exe_path, args);
+    execvp(args[0], args);
+
+    // If execvp fails: 127 for a command that was not found, 126 for
+    // one that could not be run, as launch_spawn records it
+    int err = errno;
+    perror("Command execution failed");
+    _exit(err == ENOENT ? 127 : 126);
+}
+
+// Start one stage with posix_spawn. The pipe wiring becomes file
+// actions, so the child never runs any of our code and the (large,
+// under ASan) address space is not copied. The < and > files are
+// opened here first, so that a missing or unwritable file is reported
+// as it is on the fork path rather than as an exec failure. Failures
+// are printed here and recorded as the stage's status. A script
+// without a #! line, which posix_spawn cannot run, is handed to
+// launch_fork, whose execvp knows to give it to sh. Returns the child
+// pid, or -1.
+static pid_t launch_spawn(const Plan *plan, const Stage *current, const char *exe_path,
+                          const StageFds *fds, StageStatus *stage) {
+    const char *input_file = plan_input_file(plan, current);
+    const char *output_file = plan_output_file(plan, current);
+    char **args = plan_args(plan, current);
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+
+    int input_fd = -1, output_fd = -1;
+    if (input_file) {
+        input_fd = open(input_file, O_RDONLY | O_CLOEXEC);
+        if (input_fd == -1) {
+            perror("Input file error");
+            stage->status = EXIT_FAILURE << 8;
+            return -1;
+        }
+    }
+    if (output_file) {
+        output_fd = open(output_file,
+                         O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (output_fd == -1) {
+            perror("Output file error");
+            if (input_fd != -1)
+                close(input_fd);
+            stage->status = EXIT_FAILURE << 8;
+            return -1;
+        }
+    }
+
+    posix_spawn_file_actions_init(&actions);
+
+#if __GLIBC_PREREQ(2, 35)
+    // First, while stdin is still the terminal. Otherwise the parent
+    // does it once we return, which leaves a window where a stage
+    // reading the terminal gets SIGTTIN.
+    if (fds->terminal)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+
+    // Same order as the fork path: pipes first, then files on top
+    if (fds->in_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, fds->in_fd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds->in_fd);
+    }
+    if (fds->out_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, fds->out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds->out_fd);
+    }
+    if (fds->close_fd != -1)
+        posix_spawn_file_actions_addclose(&actions, fds->close_fd);
+    if (input_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    if (output_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+
+    // The equivalent of setup_child
+    posix_spawnattr_t attr;
+    sigset_t defaults, none;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < N_CHILD_DEFAULT_SIGNALS; i++)
+        sigaddset(&defaults, child_default_signals[i]);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    if (fds->pgid != -1) {
+        posix_spawnattr_setpgroup(&attr, fds->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    // Anything buffered must not be written out of order with the child
+    fflush(stdout);
+
+    int err;
+    if (exe_path != NULL)
+        err = posix_spawn(&pid, exe_path, &actions, &attr, args, environ);
+    else
+        err = posix_spawnp(&pid, args[0], &actions, &attr, args, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (input_fd != -1)
+        close(input_fd);
+    if (output_fd != -1)
+        close(output_fd);
+
+    if (err == ENOEXEC)
+        return launch_fork(plan, current, exe_path, fds, stage);
+
+    if (err != 0) {
+        fprintf(stderr, "Command execution failed: %s\n", strerror(err));
+        stage->status = (err == ENOENT ? 127 : 126) << 8;
+        return -1;
+    }
+
+    return pid;
+}
+
+// A builtin stage. It runs in the shell process and owns its two
+// descriptors, closing them when it finishes so that the neighbouring
+// stages see EOF/EPIPE exactly as if it had been a child process.
+typedef struct BuiltinStage {
+    const Builtin *builtin;
+    char **args;       // The stage's arguments, NULL-terminated
+    int argc;
+    int in_fd;         // stdin of the stage; closed when done unless STDIN_FILENO
+    int out_fd;        // stdout of the stage; closed when done unless STDOUT_FILENO
+    int result;        // Exit status of the builtin
+    int threaded;      // Nonzero if running on 'thread'
+    pthread_t thread;
+    int index;         // Position in the pipeline, for tracing
+} BuiltinStage;
+
+// Close a builtin stage's descriptors, leaving the shell's own alone
+static void close_builtin_fds(BuiltinStage *b) {
+    if (b->in_fd != STDIN_FILENO)
+        close(b->in_fd);
+    if (b->out_fd != STDOUT_FILENO)
+        close(b->out_fd);
+}
+
+// Run a builtin stage to completion on the calling thread. When
+// tracing, the run is drawn on that thread's track; a builtin run
+// inline gets a named span on the shell's track instead.
+static void run_builtin_stage(BuiltinStage *b) {
+    uint64_t start = trace_begin();
+
+    b->result = b->builtin->fn(b->argc, b->args,
+                               b->in_fd, b->out_fd);
+    close_builtin_fds(b);
+
+    if (start != 0) {
+        char name[160], cmd[128], args[32];
+        pid_t tid = gettid();
+        snprintf(name, sizeof(name), "stage %d: %s (builtin)", b->index,
+                 trace_escape(cmd, sizeof(cmd), b->builtin->name));
+        snprintf(args, sizeof(args), "\"status\":%d", b->result);
+        if (tid == getpid()) {
+            trace_span(tid, name, start, stats_now(), args);
+        } else {
+            trace_name_track(tid, name);
+            trace_span(tid, "run", start, stats_now(), args);
+        }
+    }
+}
+
+// Thread body for a builtin that is not the last stage
+static void *builtin_thread(void *arg) {
+    // A reader that exits early must not kill the whole shell with
+    // SIGPIPE; with the signal blocked the write fails with EPIPE
+    // instead, which only ends this stage
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    run_builtin_stage(arg);
+    return NULL;
+}
+
+// Run a builtin stage in a child process of its own: for a background
+// job or one with a timeout, for a builtin that changes the shell but
+// is not a lone stage, or when no thread could be had for it. Returns
+// the child pid, or -1 if fork failed. The parent's copies of the
+// descriptors are closed either way.
+static pid_t launch_builtin_fork(BuiltinStage *b, const StageFds *fds,
+                                 StageStatus *stage) {
+    fflush(stdout);
+    stage->launch_ns = stage_clock();
+    pid_t pid = fork();
+
+    if (pid != 0) {
+        if (pid > 0 && fds->pgid != -1)
+            setpgid(pid, fds->pgid ? fds->pgid : pid);
+        stage->started_ns = stage_clock();
+        close_builtin_fds(b);
+        return pid;
+    }
+
+    // Child process: no exec, so exit without running our atexit
+    // handlers (the trace file belongs to the shell)
+    setup_child(fds);
+    if (fds->close_fd != -1)
+        close(fds->close_fd);
+    if (b->in_fd != STDIN_FILENO) {
+        dup2(b->in_fd, STDIN_FILENO);
+        close(b->in_fd);
+    }
+    if (b->out_fd != STDOUT_FILENO) {
+        dup2(b->out_fd, STDOUT_FILENO);
+        close(b->out_fd);
+    }
+    if (b->builtin->shell)
+        jobs_forget();
+    int result = b->builtin->fn(b->argc, b->args,
+                                STDIN_FILENO, STDOUT_FILENO);
+    fflush(stdout);
+    _exit(result & 0xff);
+}
+
+// Apply a stage's < and > to a builtin, replacing the pipe ends it
+// was given (an explicit redirection wins, as for external commands).
+// Returns 0 on success, or -1 after printing an error.
+static int open_builtin_redirections(const Plan *plan, const Stage *current,
+                                     BuiltinStage *b) {
+    const char *input_file = plan_input_file(plan, current);
+    const char *output_file = plan_output_file(plan, current);
+
+    if (input_file) {
+        int input_fd = open(input_file, O_RDONLY | O_CLOEXEC);
+        if (input_fd == -1) {
+            perror("Input file error");
+            return -1;
+        }
+        if (b->in_fd != STDIN_FILENO)
+            close(b->in_fd);
+        b->in_fd = input_fd;
+    }
+
+    if (output_file) {
+        int output_fd = open(output_file,
+                             O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (output_fd == -1) {
+            perror("Output file error");
+            return -1;
+        }
+        if (b->out_fd != STDOUT_FILENO)
+            close(b->out_fd);
+        b->out_fd = output_fd;
+    }
+
+    return 0;
+}
+
+// Report how a single stage finished, in the same style as before
+static void report_stage_status(int index, const char *name, int status) {
+    if (WIFEXITED(status)) {
+        if (WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Stage %d (%s) exited with status %d\n",
+                    index, name, WEXITSTATUS(status));
+        }
+    } else if (WIFSIGNALED(status)) {
+        fprintf(stderr, "Stage %d (%s) terminated by signal %d\n",
+                index, name, WTERMSIG(status));
+    } else {
+        fprintf(stderr, "Stage %d (%s) terminated abnormally\n", index, name);
+    }
+}
+
+// Convert a waitpid status into a shell-style exit code
+static int status_to_exit_code(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 1;
+}
+
+// Draw a reaped child on its own trace track: how it was started, how
+// long it ran, and what it cost
+static void trace_stage(int index, const StageStatus *stage) {
+    char name[160], cmd[128], args[256];
+
+    snprintf(name, sizeof(name), "stage %d: %s (pid %d)", index,
+             trace_escape(cmd, sizeof(cmd), stage->name), (int)stage->pid);
+    trace_name_track(stage->pid, name);
+
+    uint64_t running_ns = stage->started_ns;
+    if (stage->exec_ns != 0) {
+        trace_span(stage->pid, "fork", stage->launch_ns, stage->started_ns, NULL);
+        trace_span(stage->pid, "exec", stage->started_ns, stage->exec_ns, NULL);
+        running_ns = stage->exec_ns;
+    } else {
+        trace_span(stage->pid, "spawn", stage->launch_ns, stage->started_ns, NULL);
+    }
+
+    const struct rusage *ru = &stage->usage;
+    snprintf(args, sizeof(args),
+             "\"status\":%d,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"max_rss_kb\":%ld",
+             status_to_exit_code(stage->status),
+             ru->ru_utime.tv_sec * 1e3 + ru->ru_utime.tv_usec / 1e3,
+             ru->ru_stime.tv_sec * 1e3 + ru->ru_stime.tv_usec / 1e3,
+             ru->ru_maxrss);
+    trace_span(stage->pid, "run", running_ns, stage->exit_ns, args);
+    trace_instant(stage->pid, "exit", stage->exit_ns);
+}
+
+// The command line of a background job, for jobs listings
+static char *describe_job(const Plan *plan) {
+    size_t size = 1;
+    for (int i = 0; i < plan->argv_count; i++)
+        size += (plan->argv[i] != NULL) ? strlen(plan->argv[i]) + 1 : 3;
+
+    char *text = malloc(size);
+    if (text == NULL)
+        return NULL;
+    char *end = text;
+    for (int s = 0; s < plan->stage_count; s++) {
+        char **args = plan_args(plan, &plan->stages[s]);
+        for (int i = 0; args[i] != NULL; i++) {
+            size_t len = strlen(args[i]);
+            if (i > 0)
+                *end++ = ' ';
+            memcpy(end, args[i], len);
+            end += len;
+        }
+        if (s + 1 < plan->stage_count) {
+            memcpy(end, " | ", 3);
+            end += 3;
+        }
+    }
+    *end = '\0';
+    return text;
+}
+
+// Hand a pipeline to the job table instead of waiting for it: a
+// background job once its stages have started, or a foreground one
+// that was stopped. Stages already reaped are not the job's to wait for,
+// and a pipeline none of whose stages started (no group) is no job.
+static void register_job(const Plan *plan, pid_t pgid,
+                         const StageStatus *stages, int stage_count,
+                         int stopped) {
+    if (pgid == 0)
+        return;
+
+    pid_t pids[stage_count];
+    int status[stage_count];
+    for (int i = 0; i < stage_count; i++) {
+        pids[i] = (stages[i].exit_ns == 0) ? stages[i].pid : -1;
+        status[i] = stages[i].status;
+    }
+
+    char *command = describe_job(plan);
+    if (command == NULL ||
+        jobs_add(pgid, pids, status, stage_count, command, stopped) == -1)
+        fprintf(stderr, "Out of memory registering job\n");
+    free(command);
+}
+
 // Function to execute the pipeline
-void execute_pipeline(Pipeline *pipeline, char *errmsg, size_t errmsg_size) {
-    Pipeline *current = pipeline; 
+int execute_pipeline(const Plan *plan, char *errmsg, size_t errmsg_size) {
     int pipe_fds[2];
     int prev_pipe_fd = -1;
-    int status;  // To capture child process exit status
+    int stage_count = (plan != NULL) ? plan->stage_count : 0;
+    int last_status = 0;
+    int background = plan != NULL && plan->background;
+    uint64_t timeout_ns = (plan != NULL) ? plan->timeout_ms * 1000000ULL : 0;
+
+    // A pipeline gets a process group of its own when it runs in the
+    // background, when it may have to be killed as a whole (timeout),
+    // or when an interactive shell hands it the terminal, so that ^C
+    // and ^Z go to it alone. Otherwise it stays in ours, and can read
+    // a terminal the shell was started on.
+    int terminal = !background && jobs_interactive() && isatty(STDIN_FILENO);
+    int own_group = background || timeout_ns != 0 || terminal;
+    pid_t pgid = 0;  // That group, once its first stage is running
+
+    // Builtins must be children too when the shell will not wait for
+    // them, or when the group may have to be killed or stopped as a
+    // whole. A lone builtin (cd, fg, ...) still runs in the shell.
+    int fork_builtins = background || timeout_ns != 0 ||
+                        (terminal && stage_count > 1);
+
+    errmsg[0] = '\0';
 
     // Handle empty pipeline
-    if (current == NULL) {
+    if (stage_count == 0) {
         snprintf(errmsg, errmsg_size, "No command specified");
-        return;
+        return 1;
     }
 
-    while (current != NULL) {
-        // Validate command
-        if (current->command == NULL || current->command->args == NULL || 
-            current->command->arg_count == 0) {
+    // Validate every stage before anything is started, so that a bad
+    // stage late in the pipeline does not leave earlier ones running
+    for (int i = 0; i < stage_count; i++) {
+        if (plan->stages[i].argc == 0) {
             snprintf(errmsg, errmsg_size, "Invalid or empty command");
-            return;
+            return 1;
         }
+    }
 
-        // Debug print: Show command being processed
-        fprintf(stderr, "Processing command: %s\n", current->command->args[0]);
+    StageStatus *stages = calloc(stage_count, sizeof(StageStatus));
+    BuiltinStage *builtin_stages = calloc(stage_count, sizeof(BuiltinStage));
+    if (stages == NULL || builtin_stages == NULL) {
+        snprintf(errmsg, errmsg_size, "Memory allocation error for pipeline stages");
+        free(stages);
+        free(builtin_stages);
+        return 1;
+    }
 
-        // Check for built-in commands first
-        int builtin_result = handle_builtin_commands(current->command);
-        if (builtin_result == 0) {
-            current = current->next; 
-            continue; 
-        } else if (builtin_result > 0) {
-            // Built-in command encountered an error
-            snprintf(errmsg, errmsg_size, "Built-in command failed");
-            return;
-        }
+    // Phase 1: start every stage without waiting on any of them, so
+    // that data streams through the pipes while all stages run. Every
+    // descriptor we create is close-on-exec, so a child only keeps the
+    // ends it was explicitly given as stdin/stdout.
+    // Without job control a background job must not compete with the
+    // shell for its input
+    if (background && !jobs_interactive() && plan->stages[0].input < 0)
+        prev_pipe_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    for (int index = 0; index < stage_count; index++) {
+        const Stage *current = &plan->stages[index];
+        char **args = plan_args(plan, current);
+        const char *input_file = plan_input_file(plan, current);
+        int has_next = index + 1 < stage_count;
+        StageStatus *stage = &stages[index];
+        stage->name = args[0];
+        stage->to_next = (has_next && current->output < 0);
+        stage->pid = -1;
 
         // Create a pipe for inter-process communication
-        if (current->next != NULL && pipe(pipe_fds) == -1) {
+        if (has_next && pipe2(pipe_fds, O_CLOEXEC) == -1) {
             snprintf(errmsg, errmsg_size, "Error creating pipe");
-            return; 
-        }
-
-        pid_t pid = fork();
-       
-        if (pid == 0) { 
-            // Child process
-            
-            // Handle input/output redirections
-            if (current->input_file) {
-                int input_fd = open(current->input_file, O_RDONLY);
-                if (input_fd == -1) {
-                    perror("Input file error");
-                    exit(EXIT_FAILURE);
-                }
-                dup2(input_fd, STDIN_FILENO);
-                close(input_fd);
-            }
+            break;
+        }
 
-            if (current->output_file) {
-                int output_fd = open(current->output_file, 
-                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (output_fd == -1) {
-                    perror("Output file error");
-                    exit(EXIT_FAILURE);
-                }
-                dup2(output_fd, STDOUT_FILENO);
-                close(output_fd);
-            }
+        // A stage reading a large file usually writes about as much;
+        // size its pipe for that stream up front
+        struct stat in_st;
+        if (has_next && input_file != NULL &&
+            stat(input_file, &in_st) == 0 && S_ISREG(in_st.st_mode))
+            fit_pipe_to(pipe_fds[1], in_st.st_size);
 
-            // If there was a previous pipe, redirect input from it
-            if (prev_pipe_fd != -1) {
-                dup2(prev_pipe_fd, STDIN_FILENO);
-                close(prev_pipe_fd);
-            }
-           
-            // If this is not the last command, redirect output to the pipe
-            if (current->next != NULL) {
-                dup2(pipe_fds[1], STDOUT_FILENO);
-                close(pipe_fds[0]);
-                close(pipe_fds[1]);
+        // Descriptors and process group for a child; with a group of
+        // its own, the first stage leads it and the rest join it
+        StageFds fds = {
+            .in_fd = prev_pipe_fd,
+            .out_fd = (has_next) ? pipe_fds[1] : -1,
+            .close_fd = (has_next) ? pipe_fds[0] : -1,
+            .pgid = own_group ? pgid : -1,
+            .terminal = terminal && pgid == 0,
+        };
+
+        // Builtins run in-process, on a thread unless they are last,
+        // or in a child of their own (fork_builtins). Under batch the
+        // command is always run as a program, as with xargs.
+        const Builtin *builtin = current->batch ? NULL :
+            find_builtin(current->argc, args);
+        if (builtin != NULL) {
+            BuiltinStage *b = &builtin_stages[index];
+            b->builtin = builtin;
+            b->args = args;
+            b->argc = current->argc;
+            b->index = index;
+            b->in_fd = (prev_pipe_fd != -1) ? prev_pipe_fd : STDIN_FILENO;
+            b->out_fd = (has_next) ? pipe_fds[1] : STDOUT_FILENO;
+
+            // The stage now owns these ends
+            prev_pipe_fd = (has_next) ? pipe_fds[0] : -1;
+
+            if (open_builtin_redirections(plan, current, b) != 0) {
+                close_builtin_fds(b);
+                stage->status = 1 << 8;
+                continue;
             }
 
-            // Ensure stdout is flushed
-            fflush(stdout);
+            // One that changes the shell runs in it only on its own
+            int in_child = fork_builtins ||
+                           (builtin->shell && stage_count > 1);
 
-            // Execute command
-            execvp(current->command->args[0], current->command->args); 
-            
-            // If execvp fails
-            perror("Command execution failed");
-            exit(EXIT_FAILURE); 
-            
-        } else if (pid > 0) { 
-            // Parent process
-            // Wait for child and check status
-            waitpid(pid, &status, 0);
-
-            // Check if child process exited normally
-            if (WIFEXITED(status)) {
-                if (WEXITSTATUS(status) != 0) {
-                    fprintf(stderr, "Command exited with status %d\n", WEXITSTATUS(status));
+            fflush(stdout);
+            if (!in_child && has_next) {
+                if (pthread_create(&b->thread, NULL, builtin_thread, b) == 0) {
+                    b->threaded = 1;
+                    continue;
                 }
-            } else {
-                fprintf(stderr, "Command terminated abnormally\n");
+                // Run inline, it could fill its pipe before the stage
+                // reading it has even started; a child can wait for it
             }
 
-            // Close write end of pipe
-            if (current->next != NULL) {
-                close(pipe_fds[1]);
+            if (in_child || has_next) {
+                pid_t pid = launch_builtin_fork(b, &fds, stage);
+                if (pid > 0) {
+                    stage->pid = pid;
+                    if (own_group && pgid == 0)
+                        pgid = pid;
+                } else {
+                    perror("fork");
+                    stage->status = 1 << 8;
+                }
+                continue;
             }
 
-            // Save read end of pipe for next iteration
-            if (prev_pipe_fd != -1) {
-                close(prev_pipe_fd);
+            run_builtin_stage(b);
+            stage->status = b->result << 8;  // same encoding as waitpid
+            if (builtin->ends_shell && stage_count == 1)
+                exit(b->result);
+            continue;
+        }
+
+        // Resolve the executable here, in the parent, so the result is
+        // cached for the next launch instead of being lost in the child
+        const char *exe_path = PC_lookup(args[0]);
+
+        // posix_spawn returns only once the child has exec'd, so for
+        // it "launch" covers the exec as well
+        // A batch stage is a fork of the shell that never execs
+        pid_t pid;
+        if (launch_mode == LAUNCH_SPAWN && !current->batch) {
+            stage->launch_ns = stage_clock();
+            pid = launch_spawn(plan, current, exe_path, &fds, stage);
+            stage->started_ns = stage_clock();
+        } else {
+            pid = launch_fork(plan, current, exe_path, &fds, stage);
+        }
+
+#ifdef PLAIDSH_STATS
+        stats_record(STAT_LAUNCH, stage->started_ns - stage->launch_ns);
+        if (stage->exec_ns != 0)
+            stats_record(STAT_EXEC, stage->exec_ns - stage->started_ns);
+#endif
+
+        if (pid > 0) {
+            stage->pid = pid;
+            if (own_group && pgid == 0) {
+                pgid = pid;
+                // Also from here, in case the child has not yet
+                if (terminal)
+                    jobs_set_foreground(pgid);
             }
-            prev_pipe_fd = (current->next != NULL) ? pipe_fds[0] : -1;
+        }
+
+        // Close write end of pipe; only the child writes to it
+        if (has_next) {
+            close(pipe_fds[1]);
+        }
+
+        // Save read end of pipe for next iteration
+        if (prev_pipe_fd != -1) {
+            close(prev_pipe_fd);
+        }
+        prev_pipe_fd = (has_next) ? pipe_fds[0] : -1;
 
-            current = current->next; 
-            
-        } else { 
+        if (pid == -1 && launch_mode == LAUNCH_FORK) {
             snprintf(errmsg, errmsg_size, "Fork failed");
             perror("fork");
-            exit(EXIT_FAILURE); 
+            break;
         }
     }
-}
\ No newline at end of file
+
+    // Nobody is left to read from a dangling pipe (an aborted launch);
+    // close it so upstream stages see EPIPE/EOF
+    if (prev_pipe_fd != -1) {
+        close(prev_pipe_fd);
+    }
+
+    if (background) {
+        register_job(plan, pgid, stages, stage_count, 0);
+        free(stages);
+        free(builtin_stages);
+        return 0;
+    }
+
+    // Phase 2: wait for everything to finish. Builtin threads are
+    // joined first. Children that exit meanwhile stay zombies until
+    // reaped, which holds up no other stage.
+    STAT_BEGIN(wait_start);
+    uint64_t wait_trace = trace_begin();
+    for (int i = 0; i < stage_count; i++) {
+        if (builtin_stages[i].threaded) {
+            pthread_join(builtin_stages[i].thread, NULL);
+            stages[i].status = builtin_stages[i].result << 8;
+        }
+    }
+
+    // Then reap all children together, in whatever order they exit
+    WaitResult result = eventloop_wait(own_group ? pgid : -1, stages,
+                                       stage_count, timeout_ns);
+    if (terminal)
+        jobs_set_foreground(0);
+    STAT_END(STAT_WAIT, wait_start);
+    trace_end("wait", wait_trace, NULL);
+
+    // ^Z: the pipeline lives on as a stopped job
+    if (result == WAIT_STOPPED) {
+        register_job(plan, pgid, stages, stage_count, 1);
+        free(stages);
+        free(builtin_stages);
+        return 128 + SIGTSTP;
+    }
+
+    // Report per-stage results in pipeline order. Stages ended by ^C,
+    // or by the timeout's SIGTERM, are what the user asked for, and
+    // SIGPIPE is how a producer normally ends once its reader has. A
+    // forked child whose exec failed has said why itself (126/127).
+    for (int i = 0; i < stage_count; i++) {
+        if (stages[i].pid > 0) {
+            int status = stages[i].status;
+            int expected = WIFSIGNALED(status) &&
+                (WTERMSIG(status) == SIGINT || WTERMSIG(status) == SIGPIPE ||
+                 (result == WAIT_TIMED_OUT && WTERMSIG(status) == SIGTERM));
+            if (stages[i].execs && WIFEXITED(status) &&
+                (WEXITSTATUS(status) == 126 || WEXITSTATUS(status) == 127))
+                expected = 1;
+            if (!expected)
+                report_stage_status(i, stages[i].name, status);
+            if (trace_enabled())
+                trace_stage(i, &stages[i]);
+        }
+    }
+
+    // The last stage's status, or with pipefail the last failure's;
+    // 124 on a timeout, as timeout(1) returns
+    last_status = status_to_exit_code(stages[stage_count - 1].status);
+    for (int i = stage_count - 1; pipefail && last_status == 0 && i >= 0; i--)
+        last_status = status_to_exit_code(stages[i].status);
+    if (result == WAIT_TIMED_OUT)
+        last_status = 124;
+    free(stages);
+    free(builtin_stages);
+    return last_status;
+}
@@ -1,12 +1,97 @@
 #ifndef PIPELINE_H
 #define PIPELINE_H
 
-#include "ast.h"  // Assuming the ASTNode structure is declared in ast.h
+#include "ast.h"  // The Plan a pipeline is run from
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Bookkeeping for one stage of a running pipeline
+typedef struct StageStatus {
+    const char *name;  // Command name, for diagnostics
+    pid_t pid;         // Child pid, or -1 if the stage did not fork
+    int status;        // Raw status as returned by waitpid
+    int to_next;       // Stdout is the pipe to the next stage
+    int cut_off;       // Sent SIGPIPE because the next stage had exited
+    int execs;         // Forked to exec a program (fork launcher only)
+
+    // Timestamps (stats_now) taken only for stats or tracing, else 0
+    uint64_t launch_ns;   // fork/posix_spawn called
+    uint64_t started_ns;  // ...and returned
+    uint64_t exec_ns;     // Child's exec completed (fork launcher only)
+    uint64_t exit_ns;     // Child reaped
+    struct rusage usage;  // Child's resource usage, from wait4
+} StageStatus;
+
+// How external commands are started
+typedef enum LaunchMode {
+    LAUNCH_FORK,   // fork, then redirect and exec in the child
+    LAUNCH_SPAWN   // posix_spawn with file actions (vfork-style, no page-table copy)
+} LaunchMode;
 
 // Function declarations
-void execute_pipeline(Pipeline *pipeline, char *errmsg, size_t errmsg_size);
-int handle_builtin_commands(Command *cmd);
+
+/*
+ * Select how execute_pipeline starts external commands. The default
+ * is LAUNCH_SPAWN; plaidsh sets it from $PLAIDSH_LAUNCHER at startup,
+ * and the launcher builtin changes it at runtime.
+ *
+ * Parameters:
+ *   mode     The launch backend to use
+ *
+ * Returns: None
+ */
+void set_launch_mode(LaunchMode mode);
+
+LaunchMode get_launch_mode(void);
+
+// Printable name of a launch mode ("fork" or "spawn")
+const char *launch_mode_name(LaunchMode mode);
+
+/*
+ * Select how a pipeline's status is computed: by default it is the
+ * last stage's; with pipefail (set -o pipefail) it is that of the last
+ * stage to fail, or 0 if none did.
+ *
+ * Parameters:
+ *   on       Nonzero to turn pipefail on
+ *
+ * Returns: None
+ */
+void set_pipefail(int on);
+
+int get_pipefail(void);
+
+/*
+ * Parse a launch mode name ("fork" or "spawn")
+ *
+ * Parameters:
+ *   name     The name to parse
+ *   mode     Return space for the mode
+ *
+ * Returns: 0 on success, -1 if name is not a launch mode
+ */
+int parse_launch_mode(const char *name, LaunchMode *mode);
+
+
+/*
+ * Execute a pipeline, walking its plan's stages in order. All stages
+ * are started before any of them is waited on, so that data streams
+ * between them; the children are then reaped together and a
+ * diagnostic is printed for every stage that failed. Builtins are ordinary stages that run inside the
+ * shell (see builtins.h), so a pipeline made only of builtins starts
+ * no processes.
+ *
+ * Parameters:
+ *   plan         The pipeline to run
+ *   errmsg       Return space for an error message; set to "" on success
+ *   errmsg_size  The size of errmsg
+ *
+ * Returns: The exit status of the last stage, shell-style (128+N
+ *   when the stage was killed by signal N)
+ */
+int execute_pipeline(const Plan *plan, char *errmsg, size_t errmsg_size);
 int handle_redirection(char **args);
 
 #endif // PIPELINE_H
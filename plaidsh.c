@@ -1,21 +1,137 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
-#include "clist.h"
+#include "tokvec.h"
+#include "arena.h"
 #include "Token.h"
 #include "Tokenize.h"
 #include "pipeline.h"
+#include "fastpath.h"
 #include "parse.h"
 #include "ast.h"
+#include "plancache.h"
+#include "stats.h"
+#include "trace.h"
+#include "linereader.h"
+#include "jobs.h"
+#include "eventloop.h"
 
-int main() {
-    printf("Welcome to Plaid Shell!\n");
+// Exit status for a line that does not tokenize or parse, as in sh
+#define SYNTAX_ERROR_STATUS 2
+
+// Exit status of a script stopped by ^C
+#define INTERRUPTED_STATUS 130
+
+/*
+ * Tokenize and parse one command line
+ *
+ * Parameters:
+ *   arena   Arena for the line's tokens and plan
+ *   line    The command line
+ *   status  Set to the syntax error status if the line is bad
+ *
+ * Returns: The line's plan, or NULL for a blank line or (after
+ *   printing the error) a bad one
+ */
+static Plan *parse_line(Arena *arena, char *line, int *status) {
+    char errmsg[256]; // Buffer for error messages
+
+    // Tokenize the input
+    STAT_BEGIN(tokenize_start);
+    uint64_t tokenize_trace = trace_begin();
+    TokVec tokens = TOK_tokenize_input(arena, line, errmsg, sizeof(errmsg));
+    STAT_END(STAT_TOKENIZE, tokenize_start);
+    trace_end("tokenize", tokenize_trace, NULL);
+    if (tokens == NULL) {
+        fprintf(stderr, "Tokenization error: %s\n", errmsg);
+        *status = SYNTAX_ERROR_STATUS;
+        return NULL;
+    }
+
+    // Nothing to do for a blank line
+    if (TOK_next_type(tokens) == TOK_END)
+        return NULL;
+
+    // Parse tokens into a plan
+    STAT_BEGIN(parse_start);
+    uint64_t parse_trace = trace_begin();
+    Plan *plan = parse_tokens(arena, tokens, errmsg, sizeof(errmsg));
+    STAT_END(STAT_PARSE, parse_start);
+    trace_end("parse", parse_trace, NULL);
+    if (plan == NULL) {
+        fprintf(stderr, "Parsing error: %s\n", errmsg);
+        *status = SYNTAX_ERROR_STATUS;
+    }
+    return plan;
+}
+
+/*
+ * Run one command line: from its cached plan if it was run before
+ * (see plancache.h), else tokenized and parsed afresh. Everything
+ * allocated for it comes from arena, which is reset before returning.
+ *
+ * Parameters:
+ *   arena   Arena for the line's tokens and plan
+ *   line    The command line
+ *   status  In: the previous status; out: the line's status. A blank
+ *           line leaves it unchanged.
+ *
+ * Returns: None
+ */
+static void run_line(Arena *arena, char *line, int *status) {
     char errmsg[256]; // Buffer for error messages
 
+    // Blank lines are neither looked up nor cached
+    if (line[strspn(line, " \t\r\n")] == '\0')
+        return;
+
+    uint64_t line_trace = trace_begin();
+    uint64_t lookup_trace = trace_begin();
+    Plan *plan = PLC_lookup(arena, line);
+    trace_end("plan cache", lookup_trace, NULL);
+    if (plan == NULL) {
+        plan = parse_line(arena, line, status);
+        if (plan == NULL) {
+            arena_reset(arena);
+            return;
+        }
+        PLC_store(line, plan);
+    }
+
+    // Execute the pipeline; it returns the last stage's status
+    uint64_t execute_trace = trace_begin();
+    *status = execute_pipeline(plan, errmsg, sizeof(errmsg));
+    trace_end("execute", execute_trace, NULL);
+    trace_end("line", line_trace, line);
+
+    // Check if any error message was set
+    if (errmsg[0] != '\0') {
+        fprintf(stderr, "Execution error: %s\n", errmsg);
+    }
+
+    // Everything but the line itself came from the arena and is
+    // recycled for the next line
+    arena_reset(arena);
+}
+
+// Interactive session: prompt with readline, keep history
+static int run_interactive(Arena *arena) {
+    int status = 0;
+
+    printf("Welcome to Plaid Shell!\n");
     while (1) {
+        // Announce background jobs that finished since the last prompt
+        jobs_reap();
+        jobs_notify(STDOUT_FILENO);
+
         // Display the prompt
+        STAT_BEGIN(read_start);
         char *input = readline("#? ");
+        STAT_END(STAT_READLINE, read_start);
 
         // Check for EOF (Ctrl+D)
         if (!input) {
@@ -28,36 +144,136 @@ int main() {
             add_history(input);
         }
 
-        // Tokenize the input
-        CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
-        if (tokens == NULL) {
-            fprintf(stderr, "Tokenization error: %s\n", errmsg);
-            free(input);
-            continue;
-        }
+        // A ^C at the prompt is not for the next command line
+        eventloop_interrupted();
+        run_line(arena, input, &status);
+        free(input);
+    }
+    return status;
+}
 
-        // Parse tokens into a pipeline
-        Pipeline *pipeline = parse_tokens(tokens, errmsg, sizeof(errmsg));
-        if (pipeline == NULL) {
-            // fprintf(stderr, "Parsing error: %s\n", errmsg);
-            CL_free(tokens);
-            free(input);
+// Script or piped input: no prompt, no banner, no history. Lines whose
+// first non-blank character is '#' are comments (this covers a #!
+// line). A ^C ends the script after the line it interrupted.
+static int run_batch(Arena *arena, int fd) {
+    int status = 0;
+    LineReader lr = LR_new(fd);
+    if (lr == NULL) {
+        perror("plaidsh");
+        return 1;
+    }
+    // Commands in a script on stdin read the lines that follow them
+    if (fd == STDIN_FILENO)
+        LR_set_shared(lr, 1);
+
+    while (1) {
+        STAT_BEGIN(read_start);
+        char *line = LR_next(lr, NULL);
+        STAT_END(STAT_READLINE, read_start);
+        if (line == NULL)
+            break;
+
+        if (line[strspn(line, " \t")] == '#')
             continue;
+        jobs_reap();
+        run_line(arena, line, &status);
+        if (eventloop_interrupted()) {
+            status = INTERRUPTED_STATUS;
+            break;
         }
+    }
 
-        // Execute the pipeline (void return type)
-        execute_pipeline(pipeline, errmsg, sizeof(errmsg));
+    LR_free(lr);
+    return status;
+}
+
+// plaidsh -c 'commands': each line of the argument is run in turn
+static int run_string(Arena *arena, const char *commands) {
+    int status = 0;
+    char *copy = strdup(commands);
+    if (copy == NULL) {
+        perror("plaidsh");
+        return 1;
+    }
 
-        // Check if any error message was set
-        if (errmsg[0] != '\0') {
-            fprintf(stderr, "Execution error: %s\n", errmsg);
+    char *line = copy;
+    while (line != NULL) {
+        char *newline = strchr(line, '\n');
+        if (newline != NULL)
+            *newline = '\0';
+        jobs_reap();
+        run_line(arena, line, &status);
+        if (eventloop_interrupted()) {
+            status = INTERRUPTED_STATUS;
+            break;
         }
+        line = (newline != NULL) ? newline + 1 : NULL;
+    }
 
-        // Free allocated memory
-        free(input);
-        free_token_values(tokens); 
-        free_pipeline(pipeline);
+    free(copy);
+    return status;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: plaidsh [-c commands | script]\n");
+    exit(SYNTAX_ERROR_STATUS);
+}
+
+int main(int argc, char **argv) {
+    Arena line_arena;  // Tokens and plan for the current line
+    int status;
+
+    arena_init(&line_arena, 4096);
+
+    // Let the environment pick how external commands are started
+    const char *launcher = getenv("PLAIDSH_LAUNCHER");
+    LaunchMode mode;
+    if (launcher != NULL && parse_launch_mode(launcher, &mode) == 0) {
+        set_launch_mode(mode);
+    }
+
+    // ...whether to write a trace of every command line
+    const char *trace = getenv("PLAIDSH_TRACE");
+    if (trace != NULL && trace[0] != '\0') {
+        if (trace_start(trace) != 0)
+            perror(trace);
+    }
+    atexit(trace_stop);
+
+    // ...and whether echo/cat/true/false/wc may run in-process
+    const char *fastpath = getenv("PLAIDSH_FASTPATH");
+    if (fastpath != NULL && strcmp(fastpath, "off") == 0) {
+        set_fastpath_enabled(0);
+    }
+
+    // Only a shell reading a terminal does job control
+    int interactive = (argc == 1 && isatty(STDIN_FILENO));
+    jobs_init(interactive);
+    eventloop_init();
+
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        if (argc != 3)
+            usage();
+        status = run_string(&line_arena, argv[2]);
+    } else if (argc == 2) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(argv[1]);
+            arena_free(&line_arena);
+            return 127;
+        }
+        status = run_batch(&line_arena, fd);
+        close(fd);
+    } else if (argc == 1) {
+        // A terminal gets the interactive shell; anything else is a script
+        if (interactive)
+            status = run_interactive(&line_arena);
+        else
+            status = run_batch(&line_arena, STDIN_FILENO);
+    } else {
+        usage();
     }
 
-    return 0;
+    arena_free(&line_arena);
+    return status;
 }
@@ -1,12 +1,28 @@
+#define _GNU_SOURCE  // F_GETPIPE_SZ
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "parse.h"
 #include "pipeline.h"
 #include "ast.h"
-#include "clist.h"
+#include "tokvec.h"
+#include "arena.h"
+#include "argvec.h"
+#include "pathcache.h"
+#include "plancache.h"
+#include "globcache.h"
 #include "Tokenize.h"
+#include "fastpath.h"
+#include "stats.h"
+#include "trace.h"
 
 // Helper function to print token details for debugging
 void print_token(const Token* token, int index) {
@@ -19,8 +35,8 @@ void print_token(const Token* token, int index) {
 }
 
 // Validate a specific token in the list
-void validate_token(CList tokens, int index, int expected_type, const char* expected_value) {
-    Token token = CL_nth(tokens, index);
+void validate_token(TokVec tokens, int index, int expected_type, const char* expected_value) {
+    Token token = TV_nth(tokens, index);
     
     // Detailed assertion with informative error message
     if (token.type != expected_type || strcmp(token.value, expected_value) != 0) {
@@ -39,23 +55,25 @@ int test_basic_word_tokenization() {
     printf("Running basic word tokenization test...\n");
     
     char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
     const char *input = "echo hello world";
     
-    CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+    TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
     assert(tokens != NULL);
     
-    int token_count = CL_length(tokens);
+    int token_count = TV_length(tokens);
     printf("Token count: %d\n", token_count);
     
     // Debug: Print all tokens
     for (int i = 0; i < token_count; i++) {
-        Token token = CL_nth(tokens, i);
-        printf("Token %d: type=%d, value='%s', length=%zu\n", 
-               i, token.type, token.value, strlen(token.value));
+        Token token = TV_nth(tokens, i);
+        printf("Token %d: type=%d, value='%s'\n", 
+               i, token.type, token.value ? token.value : "(null)");
     }
     
-    // Adjust assertion to expect 4 tokens (3 words + 1 end token)
-    assert(token_count == 3);
+    // Expect 4 tokens (3 words + 1 end token)
+    assert(token_count == 4);
     
     // Validate the actual words, ignoring the end token
     validate_token(tokens, 0, TOK_WORD, "echo");
@@ -63,10 +81,10 @@ int test_basic_word_tokenization() {
     validate_token(tokens, 2, TOK_WORD, "world");
     
     // Verify the last token is the end token
-    Token last_token = CL_nth(tokens, token_count - 1);
+    Token last_token = TV_nth(tokens, token_count - 1);
     assert(last_token.type == TOK_END);
     
-    CL_free(tokens);
+    arena_free(&arena);
     printf("Basic word tokenization test passed.\n");
     return 1; // Return 1 to indicate the test passed
 }
@@ -76,16 +94,18 @@ int test_advanced_tokenization() {
     printf("Running advanced tokenization test...\n");
     
     char errmsg[256] = {0};
-    const char *input = "cat < input.txt | grep 'pattern' > output.txt";
+    Arena arena;
+    arena_init(&arena, 4096);
+    const char *input = "cat < input.txt | grep \"pattern\" > output.txt";
     
-    CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+    TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
     assert(tokens != NULL);
     
-    int token_count = CL_length(tokens);
+    int token_count = TV_length(tokens);
     printf("Token count: %d\n", token_count);
     
-    // Adjust to expect 8 tokens (7 meaningful tokens + 1 end token)
-    assert(token_count == 8);
+    // Expect 9 tokens (8 meaningful tokens + 1 end token)
+    assert(token_count == 9);
     
     // Validate tokens with special characters
     validate_token(tokens, 0, TOK_WORD, "cat");
@@ -93,14 +113,15 @@ int test_advanced_tokenization() {
     validate_token(tokens, 2, TOK_WORD, "input.txt");
     validate_token(tokens, 3, TOK_PIPE, "|");
     validate_token(tokens, 4, TOK_WORD, "grep");
-    validate_token(tokens, 5, TOK_QUOTED_WORD, "'pattern'");
+    validate_token(tokens, 5, TOK_QUOTED_WORD, "pattern");
     validate_token(tokens, 6, TOK_GREATERTHAN, ">");
+    validate_token(tokens, 7, TOK_WORD, "output.txt");
     
     // Verify the last token is the end token
-    Token last_token = CL_nth(tokens, token_count - 1);
+    Token last_token = TV_nth(tokens, token_count - 1);
     assert(last_token.type == TOK_END);
     
-    CL_free(tokens);
+    arena_free(&arena);
     printf("Advanced tokenization test passed.\n");
     return 1; // Return 1 to indicate the test passed
 }
@@ -110,19 +131,935 @@ int test_error_tokenization() {
     printf("Running error tokenization test...\n");
     
     char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
     const char *input = "echo \"unterminated string";
     
-    CList tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+    TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
     
     // Expect NULL return and non-empty error message
     assert(tokens == NULL);
     assert(strlen(errmsg) > 0);
     
     printf("Error message: %s\n", errmsg);
+    arena_free(&arena);
     printf("Error tokenization test passed.\n");
     return 1; // Return 1 to indicate the test passed
 }
 
+// Test the token vector on a long line, consuming through the cursor
+int test_token_vector() {
+    printf("Running token vector test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+    const int num_args = 10000;
+    char *input = malloc(num_args * 8 + 16);
+    assert(input != NULL);
+
+    char *p = input + sprintf(input, "echo");
+    for (int i = 0; i < num_args; i++)
+        p += sprintf(p, " a%d", i);
+
+    TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
+    assert(tokens != NULL);
+    assert(TV_length(tokens) == num_args + 2);
+
+    // Random access relative to the cursor, from both ends
+    validate_token(tokens, 0, TOK_WORD, "echo");
+    validate_token(tokens, num_args, TOK_WORD, "a9999");
+    assert(TV_nth(tokens, -1).type == TOK_END);
+
+    // Consuming moves the cursor without disturbing later tokens
+    TOK_consume(tokens);
+    assert(TOK_next_type(tokens) == TOK_WORD);
+    assert(strcmp(TOK_next(tokens).value, "a0") == 0);
+    assert(TV_length(tokens) == num_args + 1);
+
+    while (TOK_next_type(tokens) != TOK_END)
+        TOK_consume(tokens);
+    assert(TV_length(tokens) == 1);
+
+    // Consuming past the end is harmless
+    TOK_consume(tokens);
+    TOK_consume(tokens);
+    assert(TOK_next_type(tokens) == TOK_END);
+
+    arena_free(&arena);
+    free(input);
+    printf("Token vector test passed.\n");
+    return 1;
+}
+
+// Test that words are unescaped into the arena as slices, with no
+// limit on their length
+// Test the argument vector: growth, NULL termination, bulk appends
+int test_arg_vector() {
+    printf("Running argument vector test...\n");
+
+    Arena arena;
+    arena_init(&arena, 4096);
+    ArgVec av;
+    AV_init(&av);
+    assert(av.args == NULL && av.count == 0);
+
+    static char *words[3000];
+    static char text[3000][8];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(text[i], sizeof(text[i]), "w%d", i);
+        words[i] = text[i];
+    }
+
+    // Always exec-ready, and never copied more than the doubling needs
+    size_t allocs = arena.alloc_calls;
+    for (int i = 0; i < 1000; i++) {
+        AV_append(&arena, &av, words[i]);
+        assert(av.count == i + 1 && av.args[av.count] == NULL);
+        assert(av.capacity >= av.count);
+    }
+    assert(arena.alloc_calls - allocs <= 8);
+
+    // A bulk append grows at most once
+    allocs = arena.alloc_calls;
+    AV_append_all(&arena, &av, words + 1000, 2000);
+    assert(arena.alloc_calls - allocs <= 1);
+    assert(av.count == 3000 && av.args[3000] == NULL);
+    for (int i = 0; i < 3000; i++)
+        assert(av.args[i] == words[i]);
+    AV_append_all(&arena, &av, words, 0);
+    assert(av.count == 3000);
+
+    arena_free(&arena);
+    printf("Argument vector test passed.\n");
+    return 1;
+}
+
+/*
+ * The byte-at-a-time tokenizer that the scanners replaced, kept as the
+ * reference for the differential test below
+ */
+char handle_escape_sequence(char next_char, char *errmsg, size_t errmsg_sz);
+
+static size_t reference_token_count(const char *input) {
+    size_t count = 1;
+    int in_space = 1;
+
+    for (const char *p = input; *p != '\0'; p++) {
+        if (*p == '<' || *p == '>' || *p == '|' || *p == '&')
+            count += 2;
+        else if (*p == '"')
+            count++;
+        else if (isspace(*p))
+            in_space = 1;
+        else if (in_space) {
+            count++;
+            in_space = 0;
+        }
+    }
+    return count;
+}
+
+static TokVec reference_tokenize(Arena *arena, const char *input, char *errmsg, size_t errmsg_sz) {
+    size_t i = 0;
+    char *text = arena_alloc(arena, strlen(input) + 1);
+    TokVec tokens = TV_new(arena, reference_token_count(input));
+
+    while (input[i] != '\0') {
+        if (isspace(input[i])) {
+            i++;
+            continue;
+        }
+
+        Token token = {0};
+        if (input[i] == '<' || input[i] == '>' || input[i] == '|' || input[i] == '&') {
+            token.type = input[i] == '<' ? TOK_LESSTHAN : input[i] == '>' ? TOK_GREATERTHAN :
+                         input[i] == '|' ? TOK_PIPE : TOK_AMPERSAND;
+            token.value = input[i] == '<' ? "<" : input[i] == '>' ? ">" : input[i] == '|' ? "|" : "&";
+            token.len = 1;
+            TV_append(tokens, token);
+            i++;
+            continue;
+        }
+
+        char *temp = text;
+        size_t temp_idx = 0;
+        int is_quoted = 0;
+        int had_quote = 0;
+        while (1) {
+            if (input[i] == '"') {
+                i++;
+                if (!is_quoted) {
+                    is_quoted = had_quote = 1;
+                    continue;
+                }
+                is_quoted = 0;
+                break;
+            }
+            if (input[i] == '\0' && is_quoted) {
+                snprintf(errmsg, errmsg_sz, "Unterminated quote");
+                return NULL;
+            }
+            if (input[i] == '\0' ||
+                (!is_quoted && (input[i] == '<' || input[i] == '>' || input[i] == '|' ||
+                                input[i] == '&' || isspace(input[i]))))
+                break;
+            if (input[i] == '\\') {
+                if (input[i + 1] == '\0') {
+                    snprintf(errmsg, errmsg_sz, "Illegal escape character");
+                    return NULL;
+                }
+                char escaped = handle_escape_sequence(input[i + 1], errmsg, errmsg_sz);
+                if (escaped == '\0') {
+                    if (is_quoted) {
+                        temp[temp_idx++] = input[i + 1];
+                        i += 2;
+                        continue;
+                    }
+                    snprintf(errmsg, errmsg_sz, "Illegal escape character '\\%c'", input[i + 1]);
+                    return NULL;
+                }
+                temp[temp_idx++] = escaped;
+                i += 2;
+            } else {
+                temp[temp_idx++] = input[i++];
+            }
+        }
+
+        if (temp_idx > 0) {
+            temp[temp_idx] = '\0';
+            text += temp_idx + 1;
+            token.type = (is_quoted || had_quote) ? TOK_QUOTED_WORD : TOK_WORD;
+            token.value = temp;
+            token.len = temp_idx;
+            TV_append(tokens, token);
+        }
+    }
+
+    Token end_token = {.type = TOK_END, .value = NULL};
+    TV_append(tokens, end_token);
+    return tokens;
+}
+
+// Test every scanner against the reference tokenizer on random lines,
+// at every alignment, with runs long enough to span many blocks
+int test_tokenizer_scanners() {
+    printf("Running tokenizer scanner test...\n");
+
+    // Plain bytes (high ones included) weighted over the special ones
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-_./*?"
+                                   "abcdefghijklmnopqrstuvwxyz\x80\xa0\xe9\xff"
+                                   "     \t\n\v\f\r<>|&\"\"\\\\ntr";
+    char errmsg[256], ref_errmsg[256];
+    Arena arena;
+    arena_init(&arena, 4096);
+    TokScanner best = TOK_get_scanner();
+    unsigned seed = 12345;
+    int scanners = 0;
+
+    for (TokScanner scanner = TOK_SCAN_BYTES; scanner <= TOK_SCAN_AVX2; scanner++) {
+        if (TOK_set_scanner(scanner) != 0)
+            continue;
+        scanners++;
+
+        for (int round = 0; round < 3000; round++) {
+            size_t len = (round % 100 == 0) ? 4000 + rand_r(&seed) % 2000 : rand_r(&seed) % 200;
+            size_t align = round % 64;
+            char *buffer = malloc(align + len + 1);
+            char *input = buffer + align;
+
+            // Sometimes long plain stretches, sometimes dense specials
+            int plain = rand_r(&seed) % 3 == 0;
+            for (size_t i = 0; i < len; i++)
+                input[i] = alphabet[rand_r(&seed) % (plain ? 60 : sizeof(alphabet) - 1)];
+            input[len] = '\0';
+
+            TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
+            TokVec expected = reference_tokenize(&arena, input, ref_errmsg, sizeof(ref_errmsg));
+            if ((tokens == NULL) != (expected == NULL)) {
+                printf("%s scanner: differs on \"%s\"\n", TOK_scanner_name(scanner), input);
+                assert(0);
+            }
+            if (tokens == NULL) {
+                assert(strcmp(errmsg, ref_errmsg) == 0);
+            } else {
+                assert(TV_length(tokens) == TV_length(expected));
+                for (int t = 0; t < TV_length(tokens); t++) {
+                    Token got = TV_nth(tokens, t), want = TV_nth(expected, t);
+                    assert(got.type == want.type && got.len == want.len);
+                    assert(want.value == NULL ? got.value == NULL : strcmp(got.value, want.value) == 0);
+                }
+            }
+
+            free(buffer);
+            arena_reset(&arena);
+        }
+    }
+    assert(scanners >= 1);
+    assert(TOK_set_scanner(best) == 0);
+
+    arena_free(&arena);
+    printf("Tokenizer scanner test passed (%d scanners).\n", scanners);
+    return 1;
+}
+
+int test_word_slices() {
+    printf("Running word slice test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 64);
+
+    // A word far longer than the old 255-byte buffer
+    const size_t long_len = 5000;
+    char *input = malloc(long_len + 64);
+    assert(input != NULL);
+    char *p = input + sprintf(input, "cat a\\ b\\|c \"x y\" ");
+    memset(p, 'z', long_len);
+    p[long_len] = '\0';
+
+    TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
+    assert(tokens != NULL);
+    assert(TV_length(tokens) == 5);
+
+    validate_token(tokens, 1, TOK_WORD, "a b|c");
+    assert(TV_nth(tokens, 1).len == 5);
+    validate_token(tokens, 2, TOK_QUOTED_WORD, "x y");
+    assert(TV_nth(tokens, 2).len == 3);
+
+    Token big = TV_nth(tokens, 3);
+    assert(big.type == TOK_WORD);
+    assert(big.len == long_len);
+    assert(strlen(big.value) == long_len);
+    assert(big.value[0] == 'z' && big.value[long_len - 1] == 'z');
+
+    // Values are slices of the arena, not pointers into the input
+    assert(big.value != p);
+
+    arena_free(&arena);
+    free(input);
+    printf("Word slice test passed.\n");
+    return 1;
+}
+
+// Test that once the line arena has warmed up, tokenizing and parsing
+// a line makes no further calls to malloc
+int test_arena_reuse() {
+    printf("Running arena reuse test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+    const char *input = "cat < in.txt | grep \"some pattern\" | sort -r | uniq -c";
+    size_t warm_allocs = 0;
+
+    for (int line = 0; line < 100; line++) {
+        TokVec tokens = TOK_tokenize_input(&arena, input, errmsg, sizeof(errmsg));
+        assert(tokens != NULL);
+        Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+        assert(plan != NULL);
+        assert(strcmp(plan_args(plan, &plan->stages[0])[0], "cat") == 0);
+        assert(plan_args(plan, &plan->stages[0])[plan->stages[0].argc] == NULL);
+
+        if (line == 0)
+            warm_allocs = arena.sys_allocs;
+        arena_reset(&arena);
+    }
+
+    printf("arena: %zu allocations, %zu mallocs\n", arena.alloc_calls, arena.sys_allocs);
+    assert(warm_allocs > 0);
+    assert(arena.sys_allocs == warm_allocs);
+
+    arena_free(&arena);
+    printf("Arena reuse test passed.\n");
+    return 1;
+}
+
+// Test the resolved-executable cache, including invalidation when
+// $PATH changes
+int test_path_cache() {
+    printf("Running path cache test...\n");
+
+    size_t hits, misses, hits0, misses0;
+    char *saved_path = strdup(getenv("PATH"));
+    assert(saved_path != NULL);
+
+    setenv("PATH", "/usr/bin:/bin", 1);
+    PC_counters(&hits0, &misses0);
+
+    const char *sh = PC_lookup("sh");
+    assert(sh != NULL);
+    assert(sh[0] == '/');
+    assert(strcmp(sh + strlen(sh) - 3, "/sh") == 0);
+
+    // Second lookup is served from the cache
+    sh = PC_lookup("sh");
+    assert(sh != NULL);
+    PC_counters(&hits, &misses);
+    assert(hits == hits0 + 1);
+    assert(misses == misses0 + 1);
+
+    // Names with a slash are not searched; unknown names are not found
+    assert(strcmp(PC_lookup("./local/tool"), "./local/tool") == 0);
+    assert(PC_lookup("no-such-command-for-plaidsh") == NULL);
+
+    // Changing $PATH drops the cache
+    setenv("PATH", "/bin:/usr/bin", 1);
+    PC_counters(&hits0, &misses0);
+    assert(PC_lookup("sh") != NULL);
+    PC_counters(&hits, &misses);
+    assert(misses == misses0 + 1);
+
+    // hash -r empties it too
+    PC_clear();
+    PC_counters(&hits0, &misses0);
+    assert(PC_lookup("sh") != NULL);
+    PC_counters(&hits, &misses);
+    assert(misses == misses0 + 1);
+
+    setenv("PATH", saved_path, 1);
+    free(saved_path);
+    PC_clear();
+    printf("Path cache test passed.\n");
+    return 1;
+}
+
+typedef struct {
+    int in_fd;
+    int out_fd;
+    int result;
+} CopyJob;
+
+static void *copy_thread(void *arg) {
+    CopyJob *job = arg;
+    job->result = fd_copy(job->in_fd, job->out_fd);
+    close(job->in_fd);
+    return NULL;
+}
+
+int test_fd_copy() {
+    printf("Running fd_copy test...\n");
+
+    // 3MB of non-repeating text, written to a file
+    const size_t size = 3 * 1024 * 1024;
+    char *data = malloc(size);
+    assert(data != NULL);
+    for (size_t i = 0; i < size; i++)
+        data[i] = 'a' + (i * 7 + i / 4096) % 26;
+
+    char src[] = "/tmp/plaidsh_copy_srcXXXXXX";
+    char dst[] = "/tmp/plaidsh_copy_dstXXXXXX";
+    int src_fd = mkstemp(src);
+    int dst_fd = mkstemp(dst);
+    assert(src_fd >= 0 && dst_fd >= 0);
+    assert(write(src_fd, data, size) == (ssize_t)size);
+    assert(lseek(src_fd, 0, SEEK_SET) == 0);
+
+    // file -> pipe -> file, as in "cat big | cat > out"
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    CopyJob reader = { pipe_fds[0], dst_fd, -1 };
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, copy_thread, &reader) == 0);
+
+    assert(fd_copy(src_fd, pipe_fds[1]) == 0);
+    assert(fcntl(pipe_fds[1], F_GETPIPE_SZ) > 64 * 1024);
+    close(pipe_fds[1]);
+    pthread_join(thread, NULL);
+    assert(reader.result == 0);
+
+    // The destination holds exactly the source bytes
+    char *copy = malloc(size + 1);
+    assert(copy != NULL);
+    assert(pread(dst_fd, copy, size + 1, 0) == (ssize_t)size);
+    assert(memcmp(copy, data, size) == 0);
+
+    close(src_fd);
+    close(dst_fd);
+    unlink(src);
+    unlink(dst);
+    free(copy);
+    free(data);
+    printf("fd_copy test passed.\n");
+    return 1;
+}
+
+int test_trace() {
+    printf("Running trace test...\n");
+
+    char buf[64];
+    assert(strcmp(trace_escape(buf, sizeof(buf), "a\"b\\c\n"), "a\\\"b\\\\c\\u000a") == 0);
+    assert(strlen(trace_escape(buf, 8, "0123456789")) == 7);
+
+    char path[] = "/tmp/plaidsh_traceXXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    assert(trace_begin() == 0);  // off: spans are not even timed
+    assert(trace_start(path) == 0);
+    assert(trace_enabled());
+    uint64_t start = trace_begin();
+    assert(start != 0);
+    trace_end("tokenize", start, "ls \"x\"");
+    trace_span(4242, "run", start, start + 1500, "\"status\":0");
+    trace_stop();
+    assert(!trace_enabled());
+
+    // A JSON array of events, closed on stop
+    char text[4096];
+    FILE *f = fopen(path, "r");
+    assert(f != NULL);
+    size_t len = fread(text, 1, sizeof(text) - 1, f);
+    text[len] = '\0';
+    fclose(f);
+    unlink(path);
+
+    assert(strncmp(text, "[\n", 2) == 0);
+    assert(strcmp(text + len - 3, "}\n]") == 0 || strcmp(text + len - 2, "]\n") == 0);
+    assert(strstr(text, "\"name\":\"tokenize\",\"ph\":\"X\"") != NULL);
+    assert(strstr(text, "\"detail\":\"ls \\\"x\\\"\"") != NULL);
+    assert(strstr(text, "\"tid\":4242,\"args\":{\"status\":0}") != NULL);
+    assert(strstr(text, "\"dur\":1.500") != NULL);
+
+    printf("Trace test passed.\n");
+    return 1;
+}
+
+// Test that & tokenizes and marks the pipeline as a background job
+int test_background() {
+    printf("Running background job test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+
+    TokVec tokens = TOK_tokenize_input(&arena, "sleep 1 | cat&", errmsg, sizeof(errmsg));
+    assert(tokens != NULL);
+    assert(TV_length(tokens) == 6);
+    validate_token(tokens, 3, TOK_WORD, "cat");
+    validate_token(tokens, 4, TOK_AMPERSAND, "&");
+
+    Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    assert(plan->background == 1);
+
+    // An escaped & is an ordinary character
+    tokens = TOK_tokenize_input(&arena, "echo a\\&b", errmsg, sizeof(errmsg));
+    assert(tokens != NULL);
+    validate_token(tokens, 1, TOK_WORD, "a&b");
+
+    // & must come last
+    tokens = TOK_tokenize_input(&arena, "echo a & echo b", errmsg, sizeof(errmsg));
+    assert(tokens != NULL);
+    assert(parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)) == NULL);
+
+    arena_free(&arena);
+    printf("Background job test passed.\n");
+    return 1;
+}
+
+// Test that a leading "timeout N" becomes the pipeline's time limit
+int test_timeout_prefix() {
+    printf("Running timeout prefix test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+
+    TokVec tokens = TOK_tokenize_input(&arena, "timeout 1.5m sleep 100 | cat", errmsg, sizeof(errmsg));
+    Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    assert(plan->timeout_ms == 90000);
+    assert(plan->stage_count == 2 && plan->stages[0].argc == 2);
+    assert(strcmp(plan_args(plan, &plan->stages[0])[0], "sleep") == 0);
+
+    // Options, bad durations and a missing command are for timeout(1)
+    const char *passed_on[] = { "timeout -s KILL 1 sleep 2", "timeout 1x sleep 2",
+                                "timeout 0 sleep 2", "timeout 5" };
+    for (int i = 0; i < 4; i++) {
+        tokens = TOK_tokenize_input(&arena, passed_on[i], errmsg, sizeof(errmsg));
+        plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+        assert(plan != NULL);
+        assert(plan->timeout_ms == 0);
+        assert(strcmp(plan_args(plan, &plan->stages[0])[0], "timeout") == 0);
+    }
+
+    // The command may itself be a prefix
+    tokens = TOK_tokenize_input(&arena, "timeout 5 batch -P 2 echo x", errmsg, sizeof(errmsg));
+    plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    assert(plan->timeout_ms == 5000);
+    assert(plan->stages[0].batch == 1 && plan->stages[0].batch_jobs == 2);
+    assert(strcmp(plan_args(plan, &plan->stages[0])[0], "echo") == 0);
+
+    arena_free(&arena);
+    printf("Timeout prefix test passed.\n");
+    return 1;
+}
+
+// Append path to a space-separated string
+static void collect_match(char *out, char *path) {
+    if (out[0] != '\0')
+        strcat(out, " ");
+    strcat(out, path);
+}
+
+// GC_expand callback collecting matches with collect_match
+static void collect_matches(void *ctx, char **paths, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        collect_match(ctx, paths[i]);
+}
+
+// Test the glob engine against glob(3), and its listing cache
+int test_glob_cache() {
+    printf("Running glob cache test...\n");
+
+    char dir[] = "/tmp/plaidsh_globXXXXXX";
+    char cwd[4096];
+    assert(mkdtemp(dir) != NULL);
+    assert(getcwd(cwd, sizeof(cwd)) != NULL);
+    assert(chdir(dir) == 0);
+
+    const char *files[] = { "a.c", "b.c", ".h.c", "x y.txt", "f1", "f2", "f10", "]",
+                            "B.c", "sub1/Makefile", "sub-2/Makefile", "sub1/deep/z.c" };
+    assert(mkdir("sub1", 0755) == 0 && mkdir("sub-2", 0755) == 0 && mkdir("sub1/deep", 0755) == 0);
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+        close(open(files[i], O_WRONLY | O_CREAT, 0644));
+
+    const char *patterns[] = { "*.c", ".*", "*/Makefile", "*/", "f[0-9]", "f[!1]*",
+                               "f?", "[[:upper:]]*", "*[[:space:]]*", "nomatch*", "[]]",
+                               "f[", "sub*/M*", "*/*/*.c", "sub1/../*.c", "/usr/b*",
+                               "[a-b].c", "*1*" };
+    Arena arena;
+    arena_init(&arena, 4096);
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char expected[1024] = "", got[1024] = "";
+        glob_t g;
+        if (glob(patterns[i], 0, NULL, &g) == 0) {
+            for (size_t j = 0; j < g.gl_pathc; j++)
+                collect_match(expected, g.gl_pathv[j]);
+            globfree(&g);
+        }
+        GC_expand(&arena, patterns[i], 0, collect_matches, got);
+        if (strcmp(expected, got) != 0)
+            printf("%s: expected \"%s\", got \"%s\"\n", patterns[i], expected, got);
+        assert(strcmp(expected, got) == 0);
+    }
+
+    // Listings are reused until the directory changes
+    size_t hits0, misses0, hits, misses;
+    char got[1024] = "";
+    GC_clear();
+    GC_counters(&hits0, &misses0);
+    GC_expand(&arena, "*.c", 0, collect_matches, got);
+    // Written too recently to be trusted, so read again
+    got[0] = '\0';
+    GC_expand(&arena, "*.c", 0, collect_matches, got);
+    GC_counters(&hits, &misses);
+    assert(misses == misses0 + 2 && hits == hits0);
+    usleep(100000);
+    GC_expand(&arena, "*.c", 0, collect_matches, got);
+    got[0] = '\0';
+    GC_expand(&arena, "*.c", 0, collect_matches, got);
+    GC_counters(&hits, &misses);
+    assert(misses == misses0 + 3 && hits == hits0 + 1);
+    assert(strcmp(got, "B.c a.c b.c") == 0);
+
+    close(open("c.c", O_WRONLY | O_CREAT, 0644));
+    got[0] = '\0';
+    GC_expand(&arena, "*.c", 0, collect_matches, got);
+    assert(strcmp(got, "B.c a.c b.c c.c") == 0);
+
+    // ~ expands whether or not the path exists
+    got[0] = '\0';
+    char *saved_home = getenv("HOME") ? strdup(getenv("HOME")) : NULL;
+    setenv("HOME", dir, 1);
+    GC_expand(&arena, "~/nonexistent", 0, collect_matches, got);
+    assert(strncmp(got, dir, strlen(dir)) == 0 && strcmp(got + strlen(dir), "/nonexistent") == 0);
+    if (saved_home != NULL)
+        setenv("HOME", saved_home, 1);
+    free(saved_home);
+
+    arena_free(&arena);
+    GC_clear();
+    assert(chdir(cwd) == 0);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    assert(system(cmd) == 0);
+    printf("Glob cache test passed.\n");
+    return 1;
+}
+
+// Test ** against a tree, with one walker thread and with several,
+// and the ARG_MAX limit
+int test_globstar() {
+    printf("Running globstar test...\n");
+
+    char dir[] = "/tmp/plaidsh_globstarXXXXXX";
+    char cwd[4096];
+    assert(mkdtemp(dir) != NULL);
+    assert(getcwd(cwd, sizeof(cwd)) != NULL);
+    assert(chdir(dir) == 0);
+
+    // a/0 .. a/9, each with b/0 .. b/4, each with one .c file; a
+    // hidden directory, and a link to a directory
+    char path[256];
+    assert(mkdir("a", 0755) == 0 && mkdir(".hid", 0755) == 0);
+    close(open(".hid/h.c", O_WRONLY | O_CREAT, 0644));
+    close(open("top.c", O_WRONLY | O_CREAT, 0644));
+    assert(symlink("a", "link") == 0);
+    for (int i = 0; i < 10; i++) {
+        snprintf(path, sizeof(path), "a/%d", i);
+        assert(mkdir(path, 0755) == 0);
+        for (int j = 0; j < 5; j++) {
+            snprintf(path, sizeof(path), "a/%d/%d", i, j);
+            assert(mkdir(path, 0755) == 0);
+            snprintf(path, sizeof(path), "a/%d/%d/f%d.c", i, j, j);
+            close(open(path, O_WRONLY | O_CREAT, 0644));
+        }
+    }
+
+    Arena arena;
+    arena_init(&arena, 4096);
+    static char one[16384], many[16384];
+    const char *patterns[] = { "**/*.c", "**", "**/", "a/**/f3.c", "a/**/2/*", "a/1/**",
+                               "**/nomatch", "a/**/.*" };
+    size_t counts[] = { 51, 113, 62, 10, 15, 11, 0, 0 };
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        one[0] = many[0] = '\0';
+        GC_set_walk_threads(1);
+        size_t n = GC_expand(&arena, patterns[i], 0, collect_matches, one);
+        GC_set_walk_threads(4);
+        assert(GC_expand(&arena, patterns[i], 0, collect_matches, many) == n);
+        if (n != counts[i])
+            printf("%s: expected %zu matches, got %zu\n", patterns[i], counts[i], n);
+        assert(n == counts[i]);
+        assert(strcmp(one, many) == 0);
+    }
+    one[0] = '\0';
+    GC_expand(&arena, "a/**/3/*.c", 0, collect_matches, one);
+    assert(strncmp(one, "a/0/3/f3.c a/1/3/f3.c ", 22) == 0);
+    GC_set_walk_threads(0);
+
+    // Past ARG_MAX the word is an error, not a huge argument list. The
+    // limit follows the stack limit, down to 128KiB.
+    struct rlimit saved, small;
+    assert(getrlimit(RLIMIT_STACK, &saved) == 0);
+    small = saved;
+    small.rlim_cur = 512 * 1024;
+    assert(setrlimit(RLIMIT_STACK, &small) == 0);
+    size_t limit = sysconf(_SC_ARG_MAX);
+    assert(mkdir("big", 0755) == 0);
+    char name[] = "big/0000_xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx";
+    for (size_t i = 0; i * (sizeof(name) + 8) < limit + 4096; i++) {
+        snprintf(name + 4, 5, "%04zu", i);
+        name[8] = '_';
+        close(open(name, O_WRONLY | O_CREAT, 0644));
+    }
+    assert(GC_expand(&arena, "big/*", 0, collect_matches, NULL) == GC_TOO_LONG);
+    assert(GC_expand(&arena, "big/**", 0, collect_matches, NULL) == GC_TOO_LONG);
+
+    char errmsg[256] = {0};
+    TokVec tokens = TOK_tokenize_input(&arena, "echo **/*_x*", errmsg, sizeof(errmsg));
+    assert(parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)) == NULL);
+    assert(strstr(errmsg, "ARG_MAX") != NULL);
+
+    // Under batch the same word is fine, and is what gets divided
+    tokens = TOK_tokenize_input(&arena, "batch rm -f **/*_x* big", errmsg, sizeof(errmsg));
+    Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL && plan->stages[0].batch);
+    Stage *rm = &plan->stages[0];
+    assert(rm->split_start == 2 && rm->split_end == rm->argc - 1);
+    assert(strcmp(plan_args(plan, rm)[rm->argc - 1], "big") == 0);
+    assert(setrlimit(RLIMIT_STACK, &saved) == 0);
+
+    arena_free(&arena);
+    GC_clear();
+    assert(chdir(cwd) == 0);
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    assert(system(cmd) == 0);
+    printf("Globstar test passed.\n");
+    return 1;
+}
+
+// Test the batch prefix: its options, and which arguments it divides
+int test_batch_prefix() {
+    printf("Running batch prefix test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+
+    // Without a glob, every argument is divided
+    TokVec tokens = TOK_tokenize_input(&arena, "batch -P 3 echo a b | cat", errmsg, sizeof(errmsg));
+    Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    Stage *cmd = &plan->stages[0];
+    assert(cmd->batch && cmd->batch_jobs == 3 && !cmd->batch_stdin);
+    assert(cmd->argc == 3 && strcmp(plan_args(plan, cmd)[0], "echo") == 0);
+    assert(cmd->split_start == 1 && cmd->split_end == 3);
+    assert(!plan->stages[1].batch);
+
+    // With -0, only what stdin adds
+    tokens = TOK_tokenize_input(&arena, "find . -print0 | batch -0 -P0 rm -f", errmsg, sizeof(errmsg));
+    plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    cmd = &plan->stages[1];
+    assert(cmd->batch && cmd->batch_stdin && cmd->batch_jobs == 0);
+    assert(cmd->split_start == 2 && cmd->split_end == 2);
+
+    // The largest glob expansion, wherever it is
+    tokens = TOK_tokenize_input(&arena, "batch cp /*bin /usr/* /tmp", errmsg, sizeof(errmsg));
+    plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    cmd = &plan->stages[0];
+    assert(cmd->split_start > 1 && strncmp(plan_args(plan, cmd)[cmd->split_start], "/usr/", 5) == 0);
+    assert(cmd->split_end == cmd->argc - 1);
+    assert(cmd->batch_jobs == 1);  // One run at a time unless -P says otherwise
+
+    const char *bad[] = { "batch", "batch -P", "batch -P x echo", "batch -0", "batch -q echo" };
+    for (int i = 0; i < 5; i++) {
+        tokens = TOK_tokenize_input(&arena, bad[i], errmsg, sizeof(errmsg));
+        assert(parse_tokens(&arena, tokens, errmsg, sizeof(errmsg)) == NULL);
+    }
+
+    arena_free(&arena);
+    printf("Batch prefix test passed.\n");
+    return 1;
+}
+
+// Test the plan layout: stages, argv pool and redirect table packed
+// into one block, with every stage's arguments NULL-terminated
+int test_plan_layout() {
+    printf("Running plan layout test...\n");
+
+    char errmsg[256] = {0};
+    Arena arena;
+    arena_init(&arena, 4096);
+
+    // 300 stages, every tenth reading a file, and a prefix to drop
+    size_t cap = 300 * 32;
+    char *line = malloc(cap);
+    size_t len = snprintf(line, cap, "timeout 5 cat a");
+    for (int i = 1; i < 300; i++)
+        len += snprintf(line + len, cap - len, (i % 10 == 0) ? " | wc -l < in%d" : " | tr x%d y", i);
+    snprintf(line + len, cap - len, " > out &");
+
+    TokVec tokens = TOK_tokenize_input(&arena, line, errmsg, sizeof(errmsg));
+    Plan *plan = parse_tokens(&arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    assert(plan->stage_count == 300 && plan->background && plan->timeout_ms == 5000);
+    assert(plan->redirect_count == 30);
+
+    // One block, in this order
+    assert(plan->argv == (char **)(plan + 1));
+    assert(plan->redirects == plan->argv + plan->argv_count);
+    assert(plan->stages == (Stage *)(plan->redirects + plan->redirect_count));
+
+    // The pool holds the stages back to back, the dropped words gone
+    int next = 0;
+    for (int i = 0; i < plan->stage_count; i++) {
+        Stage *stage = &plan->stages[i];
+        char **args = plan_args(plan, stage);
+        assert(stage->argv == next);
+        assert(args[stage->argc] == NULL);
+        next += stage->argc + 1;
+
+        if (i == 0) {
+            assert(stage->argc == 2 && strcmp(args[0], "cat") == 0 && stage->input == -1);
+        } else if (i % 10 == 0) {
+            char name[16];
+            snprintf(name, sizeof(name), "in%d", i);
+            assert(stage->argc == 2 && strcmp(args[0], "wc") == 0);
+            assert(strcmp(plan_input_file(plan, stage), name) == 0);
+            assert(plan_output_file(plan, stage) == NULL);
+        } else {
+            assert(stage->argc == 3 && strcmp(args[0], "tr") == 0);
+            assert(plan_input_file(plan, stage) == NULL);
+        }
+    }
+    assert(next == plan->argv_count);
+    assert(strcmp(plan_output_file(plan, &plan->stages[299]), "out") == 0);
+
+    free(line);
+    arena_free(&arena);
+    printf("Plan layout test passed.\n");
+    return 1;
+}
+
+// Test the plan cache: hits survive the line arena, globs are not
+// kept, and the least recently used line goes first
+int test_plan_cache() {
+    printf("Running plan cache test...\n");
+
+    char errmsg[256] = {0};
+    char line[64];
+    Arena parse_arena, run_arena;
+    arena_init(&parse_arena, 4096);
+    arena_init(&run_arena, 4096);
+    PLC_clear();
+
+    const char *input = "timeout 2 cat < \"in file\" | batch -P 2 wc -l > out &";
+    TokVec tokens = TOK_tokenize_input(&parse_arena, input, errmsg, sizeof(errmsg));
+    Plan *plan = parse_tokens(&parse_arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL);
+    size_t hits0, misses0, hits, misses;
+    PLC_counters(&hits0, &misses0);
+    assert(PLC_lookup(&run_arena, input) == NULL);
+    PLC_store(input, plan);
+    arena_reset(&parse_arena);
+
+    // The copy owns its strings, and comes back as a plan in the arena
+    Plan *cached = PLC_lookup(&run_arena, input);
+    assert(cached != NULL);
+    assert(cached->stage_count == 2 && cached->background && cached->timeout_ms == 2000);
+    assert(cached->argv == (char **)(cached + 1));
+    assert(strcmp(plan_args(cached, &cached->stages[0])[0], "cat") == 0);
+    assert(plan_args(cached, &cached->stages[0])[1] == NULL);
+    assert(strcmp(plan_input_file(cached, &cached->stages[0]), "in file") == 0);
+    assert(strcmp(plan_output_file(cached, &cached->stages[1]), "out") == 0);
+    Stage *wc = &cached->stages[1];
+    assert(wc->batch && wc->batch_jobs == 2 && wc->argc == 2);
+    assert(strcmp(plan_args(cached, wc)[1], "-l") == 0 && plan_args(cached, wc)[2] == NULL);
+    PLC_counters(&hits, &misses);
+    assert(hits == hits0 + 1 && misses == misses0 + 1);
+
+    // What a glob matched is only good for the moment
+    tokens = TOK_tokenize_input(&parse_arena, "ls /*", errmsg, sizeof(errmsg));
+    plan = parse_tokens(&parse_arena, tokens, errmsg, sizeof(errmsg));
+    assert(plan != NULL && plan->globs == 1);
+    PLC_store("ls /*", plan);
+    assert(PLC_lookup(&run_arena, "ls /*") == NULL);
+
+    // Fill the cache, use the first line again, then push one more in
+    PLC_clear();
+    for (int i = 0; i <= 64; i++) {
+        if (i == 64)
+            assert(PLC_lookup(&run_arena, "echo 0") != NULL);
+        snprintf(line, sizeof(line), "echo %d", i);
+        tokens = TOK_tokenize_input(&parse_arena, line, errmsg, sizeof(errmsg));
+        PLC_store(line, parse_tokens(&parse_arena, tokens, errmsg, sizeof(errmsg)));
+        arena_reset(&parse_arena);
+    }
+    assert(PLC_lookup(&run_arena, "echo 1") == NULL);
+    assert(PLC_lookup(&run_arena, "echo 0") != NULL);
+    cached = PLC_lookup(&run_arena, "echo 64");
+    assert(cached != NULL && strcmp(plan_args(cached, &cached->stages[0])[1], "64") == 0);
+
+    // Off means empty
+    PLC_set_enabled(0);
+    assert(PLC_lookup(&run_arena, "echo 0") == NULL);
+    PLC_set_enabled(1);
+    assert(PLC_lookup(&run_arena, "echo 0") == NULL);
+
+    arena_free(&parse_arena);
+    arena_free(&run_arena);
+    printf("Plan cache test passed.\n");
+    return 1;
+}
+
 int main() {
   int passed = 0;
   int num_tests = 0;
@@ -136,6 +1073,51 @@ int main() {
   
   num_tests++; 
   passed += test_error_tokenization();
+
+  num_tests++; 
+  passed += test_token_vector();
+
+  num_tests++; 
+  passed += test_word_slices();
+
+  num_tests++;
+  passed += test_tokenizer_scanners();
+
+  num_tests++;
+  passed += test_arg_vector();
+
+  num_tests++;
+  passed += test_plan_layout();
+
+  num_tests++;
+  passed += test_plan_cache();
+
+  num_tests++; 
+  passed += test_arena_reuse();
+
+  num_tests++; 
+  passed += test_path_cache();
+
+  num_tests++;
+  passed += test_fd_copy();
+
+  num_tests++;
+  passed += test_trace();
+
+  num_tests++;
+  passed += test_background();
+
+  num_tests++;
+  passed += test_timeout_prefix();
+
+  num_tests++;
+  passed += test_glob_cache();
+
+  num_tests++;
+  passed += test_globstar();
+
+  num_tests++;
+  passed += test_batch_prefix();
     
   printf("Passed %d/%d test cases\n", passed, num_tests);
   fflush(stdout);
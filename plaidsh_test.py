@@ -10,6 +10,8 @@ import pexpect
 import sys
 import re
 import os
+import subprocess
+import signal
 from pathlib import Path
 
 # re to match the prompt
@@ -45,6 +47,16 @@ if (a_file is None):
     print("No files found in cwd...")
     sys.exit(1)
 
+# For the conformance tests of plaidsh's in-process echo/cat/wc/true/false:
+# returns a regexp matching exactly what the real utilities print for
+# the pipeline cmdline. Each stage is run through env so that the
+# binaries are used rather than /bin/sh's own builtins.
+def coreutils(cmdline):
+    ref = " | ".join("env " + stage.strip() for stage in cmdline.split("|"))
+    out = subprocess.run(["/bin/sh", "-c", ref], capture_output=True,
+                         text=True).stdout
+    return "\r\n".join(re.escape(line) for line in out.rstrip("\n").split("\n"))
+
 #
 # The list below is of the form
 #    (input-string) (expected-output-regexp) (expect-empty) (points)
@@ -127,9 +139,149 @@ tests = [
     ("| grep", "No command (specified|found)", True, 1),
     ("echo || grep", "No command (specified|found)", True, 1),
     ("echo \\<\\|\\> | cat", "<\\|>", True, 1),
-    ("echo hello\\|grep ell", "hello\\|grep ell", True, 1)
+    ("echo hello\\|grep ell", "hello\\|grep ell", True, 1),
+
+    # in-process utilities must match coreutils byte for byte
+    ("echo \"one  two\"   three", coreutils("echo \"one  two\"   three"), True, 1),
+    ("echo -n -nn x | wc -c", coreutils("echo -n -nn x | wc -c"), True, 1),
+    ("printf \"a b\\nc\\n\" | wc", coreutils("printf \"a b\\nc\\n\" | wc"), True, 1),
+    ("printf \"a b\\nc\\nd\\n\" | wc -l", coreutils("printf \"a b\\nc\\nd\\n\" | wc -l"), True, 1),
+    (f"wc {setup_script}", coreutils(f"wc {setup_script}"), True, 1),
+    (f"wc -c {setup_script}", coreutils(f"wc -c {setup_script}"), True, 1),
+    (f"wc -lc {setup_script} {setup_script}",
+     coreutils(f"wc -lc {setup_script} {setup_script}"), True, 1),
+    (f"cat {setup_script} | wc -lw", coreutils(f"cat {setup_script} | wc -lw"), True, 1),
+    (f"cat < {setup_script} | cat - | wc -w",
+     coreutils(f"cat < {setup_script} | cat - | wc -w"), True, 1),
+    ("seq 1000 | cat | wc -c", coreutils("seq 1000 | cat | wc -c"), True, 1),
+    ("true", "", True, 1),
+    ("false", "", True, 1)
+]
+
+#
+# Non-interactive runs, without a terminal. Each entry is
+#    (extra-arguments) (stdin) (expected-stdout) (expected-status) (points)
+# where a script argument of None is replaced by a script file whose
+# contents are the stdin string (stdin itself is then empty), and an
+# argument of "<" makes that file the shell's stdin instead
+#
+batch_tests = [
+    (["-c", "echo hi | wc -c"], "", "3\n", 0, 1),
+    (["-c", "echo one\nfalse"], "", "one\n", 1, 1),
+    (["-c", "echo \"unterminated"], "", "", 2, 1),
+    ([], "echo a\n\nseq 3 | wc -l\n", "a\n3\n", 0, 1),
+    ([], "echo " + "x" * 200000 + "\n", "x" * 200000 + "\n", 0, 1),
+    ([], "echo last line without newline", "last line without newline\n", 0, 1),
+    ([None], "#!/usr/bin/env plaidsh\n  # comment\necho ran\nfalse\n", "ran\n", 1, 1),
+    ([None], "echo x\nexit 7\necho never\n", "x\n", 7, 1),
+    # ...but exit in a pipeline only ends its own stage
+    (["-c", "set -o pipefail\nexit 3 | cat"], "", "", 3, 1),
+    (["-c", "exit 3 | cat\necho next"], "", "next\n", 0, 1),
+    # Builtins that change the shell do so only as a lone stage
+    (["-c", "cd / | cat\npwd"], "", os.getcwd() + "\n", 0, 1),
+    (["-c", "set -o pipefail | cat\nfalse | true"], "", "", 0, 1),
+
+    # parallel: output grouped per job, in finishing or (-k) input order
+    (["-c", "parallel -j 2"], "sh -c \"sleep 0.5; echo a; echo b\"\necho c\n",
+     "c\na\nb\n", 0, 1),
+    (["-c", "parallel -k -j 3"], "sh -c \"sleep 0.3; echo a\"\necho b\nfalse\nseq 2\n",
+     "a\nb\n1\n2\n", 1, 1),
+
+    # Background jobs: the shell goes on at once; wait collects them
+    (["-c", "sh -c \"sleep 0.3; echo bg\" &\necho fg\nwait\necho done"], "",
+     "fg\nbg\ndone\n", 0, 1),
+    (["-c", "sh -c \"exit 3\" | cat &\nsh -c \"exit 4\" &\nwait %2"], "", "", 4, 1),
+    (["-c", "sleep 0.2 &\njobs"], "", "[1]+  Running                 sleep 0.2 &\n", 0, 1),
+    (["-c", "plaidsh_no_such_command &\njobs"], "", "", 0, 1),
+    (["-c", "true &\n" * 40 + "sleep 0.5\njobs | wc -l"], "", "32\n", 0, 1),
+
+    # timeout N: the whole pipeline is killed, with timeout(1)'s status
+    (["-c", "timeout 0.3 sh -c \"sleep 5; echo late\" | cat"], "", "", 124, 1),
+    (["-c", "timeout 5 echo fast | wc -l"], "", "1\n", 0, 1),
+    (["-c", "timeout 5 batch echo x y"], "", "x y\n", 0, 1),
+
+    # Upstream stages go when their reader does (else the timeout hits)
+    (["-c", "timeout 2 sh -c \"echo x; sleep 5; echo y\" | head -1"], "", "x\n", 0, 1),
+    # ...and so does what they started, which would hold stderr open
+    (["-c", "timeout 20 sh -c \"echo x; sleep 30\" | head -1"], "", "x\n", 0, 1),
+    (["-c", "set -o pipefail\nsh -c \"exit 3\" | cat"], "", "", 3, 1),
+    (["-c", "set -o pipefail\nyes | head -1"], "", "y\n", 141, 1),
+    (["-c", "batch -0 echo x < /dev/null"], "", "", 0, 1),
+    (["-c", "printf \"a b\\nc\" | tr \"\\\\n\" \"\\\\000\" | batch -0 -P 2 echo x"], "", "x a b c\n", 0, 1),
+    (["-c", "batch sh -c \"exit 3\" x"], "", "", 123, 1),
+
+    # Failed redirections and scripts without #! fare as they do under fork
+    (["-c", "cat < plaidsh_no_such_file"], "", "", 1, 1),
+    (["-c", "echo echo ran > plaidsh_nox.sh\nchmod +x plaidsh_nox.sh\n./plaidsh_nox.sh\nrm plaidsh_nox.sh"],
+     "", "ran\n", 0, 1),
+    (["-c", "launcher fork\nplaidsh_no_such_cmd"], "", "", 127, 1),
+    # ...and a forked child that fails leaves the shell's trace alone
+    (["-c", "trace plaidsh_trace.json\nlauncher fork\nsort < plaidsh_no_such_file\n"
+      "trace off\npython3 -c \"import json; json.load(open('plaidsh_trace.json')); print('ok')\"\n"
+      "rm plaidsh_trace.json"], "", "ok\n", 0, 1),
+
+    # A script on stdin leaves the lines after a command to that command
+    (["<"], "head -n 1\nline-for-child\necho after\n", "line-for-child\nafter\n", 0, 1),
+    ([], "sh -c \"read x; echo got $x\"\nline-for-child\necho after\n",
+     "got line-for-child\nafter\n", 0, 1),
 ]
 
+def run_batch_tests(executable):
+    score_pts=0
+    total_pts=0
+    script = "plaidsh_batch_test.psh"
+
+    for args, stdin, exp_out, exp_status, pts in batch_tests:
+        total_pts += pts
+        stdin_file = None
+        if None in args or "<" in args:
+            with open(script, "w") as f:
+                f.write(stdin)
+            if "<" in args:
+                stdin_file = open(script)
+            args = [script if a is None else a for a in args if a != "<"]
+            stdin = None if stdin_file else ""
+
+        try:
+            result = subprocess.run([executable] + args, input=stdin, stdin=stdin_file,
+                                    capture_output=True, text=True, timeout=10)
+        except subprocess.TimeoutExpired:
+            print(f"FAIL: Batch run {args} timed out")
+            continue
+        finally:
+            if stdin_file:
+                stdin_file.close()
+        if result.stdout != exp_out or result.returncode != exp_status:
+            print(f"FAIL: Batch run {args} with input {(stdin or '')[:40]!r}: "
+                  f"expected {exp_out[:40]!r} and status {exp_status}, "
+                  f"got {result.stdout[:40]!r} and status {result.returncode}")
+        else:
+            score_pts += pts
+
+    if os.path.exists(script):
+        os.remove(script)
+
+    # ^C stops a builtin running in the shell (cat waiting for input),
+    # and the script with it
+    total_pts += 1
+    shell = subprocess.Popen([executable, "-c", "cat\necho after"], stdin=subprocess.PIPE,
+                             stdout=subprocess.PIPE, text=True)
+    try:
+        shell.wait(timeout=0.5)
+    except subprocess.TimeoutExpired:
+        shell.send_signal(signal.SIGINT)
+    try:
+        out, _ = shell.communicate(timeout=5)
+        if out == "" and shell.returncode == 130:
+            score_pts += 1
+        else:
+            print(f"FAIL: ^C during cat: got {out!r} and status {shell.returncode}")
+    except subprocess.TimeoutExpired:
+        shell.kill()
+        shell.communicate()
+        print("FAIL: ^C did not stop cat")
+    return score_pts, total_pts
+
 def filter(line):
     # From https://stackoverflow.com/questions/14693701/how-can-i-remove-the-ansi-escape-sequences-from-a-string-in-python
     ansi_escape = re.compile(r'(?:\x1B[@-_]|[\x80-\x9F])[0-?]*[ -/]*[@-~]')
@@ -217,6 +369,10 @@ def run_tests(executable):
     else:
         print("FAIL: Memory leaks detected")
 
+    batch_score, batch_total = run_batch_tests(executable)
+    score_pts += batch_score
+    total_pts += batch_total
+
     print(f"Raw Score: {score_pts} out of {total_pts}")
     if (score_pts == total_pts):
         print("  ...plus 5 bonus points for passing all the tests!") #
@@ -0,0 +1,230 @@
+/*
+ * plancache.c
+ *
+ * LRU cache from command line text to its plan: a chained hash table
+ * over a fixed set of entries, which are also kept on a list in order
+ * of use
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "plancache.h"
+
+// Lines kept
+#define PLC_CAPACITY 64
+
+// Hash buckets; a power of two
+#define PLC_BUCKETS 128
+
+// Largest plan kept, strings included; larger ones are parsed each time
+#define PLC_MAX_PLAN_SIZE (64 * 1024)
+
+typedef struct PlanEntry
+{
+    char *line;                // The line, or NULL if the entry is unused
+    uint64_t hash;
+    Plan *plan;                // Self-contained (plan_copy), in one block with line
+    size_t size;               // Bytes of plan
+    unsigned long hits;        // Number of times this entry was used
+    struct PlanEntry *chain;   // Next entry in the same bucket
+    struct PlanEntry *newer;   // Neighbours in order of use
+    struct PlanEntry *older;
+} PlanEntry;
+
+static PlanEntry entries[PLC_CAPACITY];
+static PlanEntry *buckets[PLC_BUCKETS];
+static PlanEntry *newest = NULL;
+static PlanEntry *oldest = NULL;
+static size_t count = 0;
+static int enabled = 1;
+
+static size_t total_hits = 0;
+static size_t total_misses = 0;
+
+
+// FNV-1a string hash
+static uint64_t _PLC_hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *s != '\0'; s++)
+    {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+// Take entry off the list of use
+static void _PLC_unlink(PlanEntry *entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        newest = entry->older;
+
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        oldest = entry->newer;
+}
+
+
+// Put entry at the head of the list of use
+static void _PLC_push(PlanEntry *entry)
+{
+    entry->newer = NULL;
+    entry->older = newest;
+    if (newest != NULL)
+        newest->newer = entry;
+    newest = entry;
+    if (oldest == NULL)
+        oldest = entry;
+}
+
+
+/*
+ * Empty an entry, taking it out of its bucket and off the list of use
+ *
+ * Parameters:
+ *   entry   The entry
+ *
+ * Returns: None
+ */
+static void _PLC_remove(PlanEntry *entry)
+{
+    PlanEntry **link = &buckets[entry->hash & (PLC_BUCKETS - 1)];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    _PLC_unlink(entry);
+    free(entry->plan);
+    entry->plan = NULL;
+    entry->line = NULL;
+}
+
+
+// Documented in .h file
+Plan *PLC_lookup(Arena *arena, const char *line)
+{
+    if (!enabled)
+        return NULL;
+
+    uint64_t hash = _PLC_hash(line);
+    for (PlanEntry *entry = buckets[hash & (PLC_BUCKETS - 1)]; entry != NULL; entry = entry->chain)
+    {
+        if (entry->hash == hash && strcmp(entry->line, line) == 0)
+        {
+            if (entry != newest)
+            {
+                _PLC_unlink(entry);
+                _PLC_push(entry);
+            }
+            entry->hits++;
+            total_hits++;
+            return plan_clone(arena_alloc(arena, entry->size), entry->plan, entry->size);
+        }
+    }
+
+    total_misses++;
+    return NULL;
+}
+
+
+// Documented in .h file
+void PLC_store(const char *line, const Plan *plan)
+{
+    if (!enabled || plan->globs > 0)
+        return;
+
+    size_t size = plan_size(plan);
+    size_t line_len = strlen(line) + 1;
+    if (size > PLC_MAX_PLAN_SIZE)
+        return;
+
+    // The line goes after the plan, in the same allocation
+    Plan *copy = malloc(size + line_len);
+    if (copy == NULL)
+        return;
+    plan_copy(copy, plan);
+
+    PlanEntry *entry;
+    if (count < PLC_CAPACITY)
+    {
+        entry = &entries[count++];
+    }
+    else
+    {
+        entry = oldest;
+        _PLC_remove(entry);
+    }
+
+    entry->line = memcpy((char *)copy + size, line, line_len);
+    entry->hash = _PLC_hash(line);
+    entry->plan = copy;
+    entry->size = size;
+    entry->hits = 0;
+
+    PlanEntry **bucket = &buckets[entry->hash & (PLC_BUCKETS - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    _PLC_push(entry);
+}
+
+
+// Documented in .h file
+void PLC_set_enabled(int on)
+{
+    if (!on)
+        PLC_clear();
+    enabled = on;
+}
+
+
+// Documented in .h file
+int PLC_enabled(void)
+{
+    return enabled;
+}
+
+
+// Documented in .h file
+void PLC_clear(void)
+{
+    while (newest != NULL)
+        _PLC_remove(newest);
+
+    count = 0;
+}
+
+
+// Documented in .h file
+void PLC_print(int out_fd)
+{
+    if (count > 0)
+        dprintf(out_fd, "hits\tline\n");
+
+    for (PlanEntry *entry = newest; entry != NULL; entry = entry->older)
+        dprintf(out_fd, "%4lu\t%s\n", entry->hits, entry->line);
+
+    size_t lookups = total_hits + total_misses;
+    dprintf(out_fd, "%zu lookups: %zu hits, %zu misses (%.1f%% hit rate)\n",
+            lookups, total_hits, total_misses,
+            lookups > 0 ? 100.0 * total_hits / lookups : 0.0);
+}
+
+
+// Documented in .h file
+void PLC_counters(size_t *hits, size_t *misses)
+{
+    *hits = total_hits;
+    *misses = total_misses;
+}
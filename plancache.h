@@ -0,0 +1,94 @@
+/*
+ * plancache.h
+ *
+ * Cache of parsed command lines, so that a line that is run again
+ * (from history, or in a script's loop) is not tokenized and parsed
+ * again
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _PLANCACHE_H_
+#define _PLANCACHE_H_
+
+#include <stddef.h>
+#include "arena.h"
+#include "ast.h"
+
+/*
+ * Look up the plan for a line. The cache holds the most recently used
+ * lines, up to a fixed number; a hit makes the line the most recent.
+ *
+ * Parameters:
+ *   arena   Arena for the plan
+ *   line    The command line, exactly as it was read
+ *
+ * Returns: A copy of the cached plan, allocated from arena like one
+ *   from parse_tokens, or NULL if line is not cached (or the cache is
+ *   off)
+ */
+Plan *PLC_lookup(Arena *arena, const char *line);
+
+
+/*
+ * Remember the plan for a line, evicting the least recently used line
+ * if the cache is full. The plan is copied with its strings, so it may
+ * be in the line arena. A plan with globs is not kept, since what they
+ * match changes with the file system; nor is a very large one.
+ *
+ * Parameters:
+ *   line    The command line that was parsed
+ *   plan    Its plan, as parse_tokens returned it
+ *
+ * Returns: None
+ */
+void PLC_store(const char *line, const Plan *plan);
+
+
+/*
+ * Turn the cache on or off (plancache on|off). It starts on. Turning
+ * it off empties it.
+ *
+ * Parameters:
+ *   on      Nonzero to cache plans
+ *
+ * Returns: None
+ */
+void PLC_set_enabled(int on);
+
+int PLC_enabled(void);
+
+
+/*
+ * Forget every cached plan (plancache -r). The counters are kept.
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void PLC_clear(void);
+
+
+/*
+ * Print the cached lines, most recent first, and the counters
+ *
+ * Parameters:
+ *   out_fd  Descriptor to print to
+ *
+ * Returns: None
+ */
+void PLC_print(int out_fd);
+
+
+/*
+ * Retrieve the lookup counters
+ *
+ * Parameters:
+ *   hits      Return space for the number of lines served from the cache
+ *   misses    Return space for the number of lines that had to be parsed
+ *
+ * Returns: None
+ */
+void PLC_counters(size_t *hits, size_t *misses);
+
+#endif /* _PLANCACHE_H_ */
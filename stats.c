@@ -0,0 +1,120 @@
+/*
+ * stats.c
+ *
+ * Log2 histograms of per-phase timings
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+
+// Documented in .h file
+uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#ifdef PLAIDSH_STATS
+
+// Bucket b holds samples in [2^(b-1), 2^b); bucket 0 holds 0ns
+#define STAT_BUCKETS 65
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[STAT_BUCKETS];
+} Histogram;
+
+static Histogram histograms[STAT_NPHASES];
+
+static const char *phase_names[STAT_NPHASES] = {
+    "readline", "tokenize", "parse", "glob", "launch", "exec", "wait"
+};
+
+
+// Documented in .h file
+void stats_record(StatPhase phase, uint64_t ns)
+{
+    Histogram *h = &histograms[phase];
+    int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+
+    h->count++;
+    h->buckets[bucket]++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+
+// Upper bound of the bucket holding the sample at fraction q of the
+// way through h, capped at the largest sample seen
+static uint64_t _stats_percentile(const Histogram *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * (h->count - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (int b = 0; b < STAT_BUCKETS; b++)
+    {
+        seen += h->buckets[b];
+        if (seen >= rank)
+        {
+            uint64_t upper = (b == 0) ? 0 : (b == 64) ? UINT64_MAX : (1ull << b) - 1;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+
+// Documented in .h file
+int stats_print(int out_fd)
+{
+    dprintf(out_fd, "%-10s %10s %12s %12s %12s\n", "phase", "count",
+            "p50 us", "p99 us", "max us");
+    for (int p = 0; p < STAT_NPHASES; p++)
+    {
+        const Histogram *h = &histograms[p];
+        if (h->count == 0)
+        {
+            dprintf(out_fd, "%-10s %10d %12s %12s %12s\n", phase_names[p], 0, "-", "-", "-");
+            continue;
+        }
+        dprintf(out_fd, "%-10s %10llu %12.1f %12.1f %12.1f\n", phase_names[p],
+                (unsigned long long)h->count,
+                _stats_percentile(h, 0.50) / 1000.0,
+                _stats_percentile(h, 0.99) / 1000.0,
+                h->max / 1000.0);
+    }
+    return 0;
+}
+
+
+// Documented in .h file
+void stats_reset(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+}
+
+#else
+
+// Documented in .h file
+int stats_print(int out_fd)
+{
+    dprintf(out_fd, "stats: not compiled in (build with -DPLAIDSH_STATS)\n");
+    return 1;
+}
+
+
+// Documented in .h file
+void stats_reset(void)
+{
+}
+
+#endif // PLAIDSH_STATS
@@ -0,0 +1,95 @@
+/*
+ * stats.h
+ *
+ * Per-phase timing of the command-line hot path: how long readline,
+ * tokenizing, parsing, glob expansion, starting and exec'ing children
+ * and waiting for them take. Every sample goes into a log2 histogram
+ * for its phase; the stats builtin prints count, p50, p99 and max.
+ *
+ * Only compiled in when PLAIDSH_STATS is defined (the Makefile does
+ * this for the debug build, not the release one). Otherwise
+ * STAT_BEGIN/STAT_END expand to nothing, so instrumented code pays no
+ * cost at all.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+typedef enum
+{
+    STAT_READLINE,   // Waiting for and reading one input line
+    STAT_TOKENIZE,   // TOK_tokenize_input
+    STAT_PARSE,      // parse_tokens, glob expansion included
+    STAT_GLOB,       // Expanding one pattern
+    STAT_LAUNCH,     // fork() or posix_spawn() of one stage
+    STAT_EXEC,       // fork()ed child: from fork returning to exec done
+    STAT_WAIT,       // Reaping a pipeline's stages after launching them
+    STAT_NPHASES
+} StatPhase;
+
+#ifdef PLAIDSH_STATS
+
+// Start timing: declares the local timestamp variable 'var'
+#define STAT_BEGIN(var) uint64_t var = stats_now()
+
+// Stop timing and record the elapsed time under 'phase'
+#define STAT_END(phase, var) stats_record((phase), stats_now() - (var))
+
+#else
+
+#define STAT_BEGIN(var) do { } while (0)
+#define STAT_END(phase, var) do { } while (0)
+
+#endif // PLAIDSH_STATS
+
+
+/*
+ * Read the monotonic clock
+ *
+ * Parameters: None
+ *
+ * Returns: Nanoseconds since an arbitrary fixed point
+ */
+uint64_t stats_now(void);
+
+
+/*
+ * Add one sample to a phase's histogram. Not thread safe; only the
+ * shell's main thread records.
+ *
+ * Parameters:
+ *   phase   The phase the time was spent in
+ *   ns      Elapsed nanoseconds
+ *
+ * Returns: None
+ */
+void stats_record(StatPhase phase, uint64_t ns);
+
+
+/*
+ * Print a table of count, p50, p99 and max for every phase. The
+ * percentiles are accurate to within a factor of two (the histogram
+ * bucket), capped at the exact maximum.
+ *
+ * Parameters:
+ *   out_fd  Where to print
+ *
+ * Returns: 0 on success, 1 if statistics were not compiled in
+ */
+int stats_print(int out_fd);
+
+
+/*
+ * Discard every sample recorded so far
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void stats_reset(void);
+
+#endif // _STATS_H_
@@ -0,0 +1,101 @@
+/*
+ * tokvec.c
+ *
+ * Contiguous token vector implementation
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tokvec.h"
+#include "Token.h"
+#include "arena.h"
+
+struct _tokvec {
+    Arena *arena;     // Where items is reallocated from when it grows
+    Token *items;     // Points at inline_items until the vector grows
+    size_t length;    // Number of tokens appended
+    size_t capacity;  // Number of slots in items
+    size_t cursor;    // Index of the next unconsumed token
+    Token inline_items[];
+};
+
+
+// Documented in .h file
+TokVec TV_new(Arena *arena, size_t capacity)
+{
+    if (capacity == 0)
+        capacity = 1;
+
+    TokVec vec = arena_alloc(arena, sizeof(struct _tokvec) + capacity * sizeof(Token));
+
+    vec->arena = arena;
+    vec->items = vec->inline_items;
+    vec->length = 0;
+    vec->capacity = capacity;
+    vec->cursor = 0;
+
+    return vec;
+}
+
+
+// Documented in .h file
+void TV_append(TokVec vec, Token token)
+{
+    assert(vec);
+
+    if (vec->length == vec->capacity)
+    {
+        // Arena memory cannot be resized in place; move to a block
+        // twice the size and abandon the old one to the arena
+        size_t new_capacity = vec->capacity * 2;
+        Token *new_items = arena_alloc(vec->arena, new_capacity * sizeof(Token));
+
+        memcpy(new_items, vec->items, vec->length * sizeof(Token));
+        vec->items = new_items;
+        vec->capacity = new_capacity;
+    }
+
+    vec->items[vec->length++] = token;
+}
+
+
+// Documented in .h file
+int TV_length(TokVec vec)
+{
+    assert(vec);
+    assert(vec->cursor <= vec->length);
+
+    return (int)(vec->length - vec->cursor);
+}
+
+
+// Documented in .h file
+Token TV_nth(TokVec vec, int pos)
+{
+    assert(vec);
+
+    int remaining = (int)(vec->length - vec->cursor);
+
+    if (pos < -remaining || pos >= remaining)
+        return (Token){TOK_END};
+
+    if (pos < 0)
+        pos = remaining + pos;
+
+    return vec->items[vec->cursor + pos];
+}
+
+
+// Documented in .h file
+void TV_consume(TokVec vec)
+{
+    assert(vec);
+
+    if (vec->cursor < vec->length)
+        vec->cursor++;
+}
+
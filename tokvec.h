@@ -0,0 +1,88 @@
+/*
+ * tokvec.h
+ *
+ * Contiguous, index-based vector of tokens. Tokens are appended at
+ * the tail and consumed from the head by advancing a cursor, so
+ * every operation the tokenizer and parser need is O(1).
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _TOKVEC_H_
+#define _TOKVEC_H_
+
+#include <stddef.h>
+#include "Token.h"
+#include "arena.h"
+
+// struct _tokvec is defined in .c file
+typedef struct _tokvec *TokVec;
+
+
+/*
+ * Create a new TokVec in an arena. The header and the first
+ * 'capacity' slots are allocated together, so a vector that never
+ * outgrows its initial capacity costs exactly one allocation. The
+ * vector lives until the arena is reset; there is no free function.
+ *
+ * Parameters:
+ *   arena      The arena to allocate from
+ *   capacity   Number of tokens to reserve space for up front
+ *
+ * Returns: The new vector
+ */
+TokVec TV_new(Arena *arena, size_t capacity);
+
+
+/*
+ * Append a token to the tail of the vector, growing the storage
+ * geometrically if needed (amortized O(1)).
+ *
+ * Parameters:
+ *   vec      The vector
+ *   token    The token to append
+ *
+ * Returns: None
+ */
+void TV_append(TokVec vec, Token token);
+
+
+/*
+ * Number of tokens that have not yet been consumed
+ *
+ * Parameters:
+ *   vec    The vector
+ *
+ * Returns: The number of remaining tokens
+ */
+int TV_length(TokVec vec);
+
+
+/*
+ * Return the Nth remaining token, without modifying the vector.
+ *
+ * Parameters:
+ *   vec    The vector
+ *   pos    Position, counted from the cursor. As with CL_nth,
+ *          negative positions count back from the tail, so -1 is the
+ *          last token.
+ *
+ * Returns: The requested token, or a TOK_END token if pos is out of
+ *   range
+ */
+Token TV_nth(TokVec vec, int pos);
+
+
+/*
+ * Consume (skip) the token at the cursor. Has no effect if all
+ * tokens have been consumed.
+ *
+ * Parameters:
+ *   vec    The vector
+ *
+ * Returns: None
+ */
+void TV_consume(TokVec vec);
+
+
+#endif /* _TOKVEC_H_ */
@@ -0,0 +1,197 @@
+/*
+ * trace.c
+ *
+ * Trace-event JSON writer
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "trace.h"
+
+// Longest single event we write; longer "args" are cut short
+#define TRACE_EVENT_MAX 2048
+
+int trace_active = 0;
+
+static int trace_fd = -1;
+static char *trace_file = NULL;
+static pid_t shell_pid;
+
+
+// Append one event. Each event goes out in a single write() on an
+// O_APPEND descriptor, so builtin threads can emit concurrently.
+static void _trace_emit(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void _trace_emit(const char *fmt, ...)
+{
+    char event[TRACE_EVENT_MAX];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(event, sizeof(event) - 2, fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+    if (len > (int)sizeof(event) - 3)
+        len = sizeof(event) - 3;   // truncated; still one line
+    event[len++] = ',';
+    event[len++] = '\n';
+    if (write(trace_fd, event, len) < 0)
+        return;   // best effort; a full disk must not stop the shell
+}
+
+
+// Documented in .h file
+int trace_start(const char *path)
+{
+    trace_stop();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+
+    trace_fd = fd;
+    trace_file = strdup(path);
+    shell_pid = getpid();
+    trace_active = 1;
+
+    if (write(trace_fd, "[\n", 2) < 0)
+        return 0;
+    trace_name_track(shell_pid, "plaidsh");
+    return 0;
+}
+
+
+// Documented in .h file
+void trace_stop(void)
+{
+    if (!trace_active)
+        return;
+
+    // The last event carries no trailing comma and ends the array
+    char tail[128];
+    int len = snprintf(tail, sizeof(tail),
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                       "\"args\":{\"name\":\"plaidsh\"}}\n]\n", (int)shell_pid);
+    if (write(trace_fd, tail, len) < 0)
+        perror("trace");
+
+    close(trace_fd);
+    free(trace_file);
+    trace_fd = -1;
+    trace_file = NULL;
+    trace_active = 0;
+}
+
+
+// Documented in .h file
+const char *trace_path(void)
+{
+    return trace_file;
+}
+
+
+// Documented in .h file
+uint64_t trace_begin(void)
+{
+    return trace_active ? stats_now() : 0;
+}
+
+
+// Documented in .h file
+void trace_end(const char *name, uint64_t start, const char *detail)
+{
+    if (start == 0 || !trace_active)
+        return;
+
+    uint64_t end = stats_now();
+    if (detail == NULL)
+    {
+        trace_span(shell_pid, name, start, end, NULL);
+        return;
+    }
+
+    char escaped[TRACE_EVENT_MAX / 2];
+    char args[TRACE_EVENT_MAX / 2 + 16];
+    trace_escape(escaped, sizeof(escaped), detail);
+    snprintf(args, sizeof(args), "\"detail\":\"%s\"", escaped);
+    trace_span(shell_pid, name, start, end, args);
+}
+
+
+// Documented in .h file
+void trace_span(pid_t tid, const char *name, uint64_t start_ns,
+                uint64_t end_ns, const char *args)
+{
+    if (!trace_active)
+        return;
+
+    _trace_emit("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":%d,\"args\":{%s}}",
+                name, start_ns / 1000.0, (end_ns - start_ns) / 1000.0,
+                (int)shell_pid, (int)tid, args != NULL ? args : "");
+}
+
+
+// Documented in .h file
+void trace_instant(pid_t tid, const char *name, uint64_t ts_ns)
+{
+    if (!trace_active)
+        return;
+
+    _trace_emit("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                "\"pid\":%d,\"tid\":%d}",
+                name, ts_ns / 1000.0, (int)shell_pid, (int)tid);
+}
+
+
+// Documented in .h file
+void trace_name_track(pid_t tid, const char *name)
+{
+    if (!trace_active)
+        return;
+
+    char escaped[256];
+    _trace_emit("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}",
+                (int)shell_pid, (int)tid, trace_escape(escaped, sizeof(escaped), name));
+}
+
+
+// Documented in .h file
+char *trace_escape(char *buf, size_t size, const char *str)
+{
+    size_t j = 0;
+
+    for (const unsigned char *s = (const unsigned char *)str; *s != '\0'; s++)
+    {
+        char tmp[8];
+        size_t n;
+
+        if (*s == '"' || *s == '\\')
+            n = snprintf(tmp, sizeof(tmp), "\\%c", *s);
+        else if (*s < 0x20)
+            n = snprintf(tmp, sizeof(tmp), "\\u%04x", *s);
+        else
+        {
+            tmp[0] = *s;
+            n = 1;
+        }
+
+        if (j + n >= size)
+            break;
+        memcpy(buf + j, tmp, n);
+        j += n;
+    }
+    buf[j] = '\0';
+    return buf;
+}
@@ -0,0 +1,142 @@
+/*
+ * trace.h
+ *
+ * Opt-in trace of command-line execution in the Chrome trace-event
+ * JSON format, which opens directly in Perfetto (ui.perfetto.dev) or
+ * chrome://tracing.
+ *
+ * The shell's own work (tokenize, parse, glob, execute, wait) is drawn
+ * on the shell's track, one "line" span per command line. Every stage
+ * gets a track of its own, named after it: forked stages show the
+ * spawn (or fork and exec) and the run until the process was reaped,
+ * with its exit status and rusage; builtin stages show their run on
+ * the thread that executed them.
+ *
+ * Tracing is started by $PLAIDSH_TRACE=file or the trace builtin.
+ * Events are appended to the file as they happen, so a trace from a
+ * shell that was killed is still readable; a clean trace_stop also
+ * closes the JSON array.
+ *
+ * Author: <Uwase Pauline>
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Nonzero while a trace file is open; read through trace_enabled()
+extern int trace_active;
+
+static inline int trace_enabled(void)
+{
+    return trace_active;
+}
+
+
+/*
+ * Start writing a trace, replacing any trace already in progress
+ *
+ * Parameters:
+ *   path    File to write; created or truncated
+ *
+ * Returns: 0 on success, -1 with errno set if path can't be opened
+ */
+int trace_start(const char *path);
+
+
+/*
+ * Finish the trace in progress, if any, and close its file
+ *
+ * Parameters: None
+ *
+ * Returns: None
+ */
+void trace_stop(void);
+
+
+// Path of the trace in progress, or NULL
+const char *trace_path(void);
+
+
+/*
+ * Timestamp the start of a span
+ *
+ * Parameters: None
+ *
+ * Returns: The current time in ns, or 0 when tracing is off
+ */
+uint64_t trace_begin(void);
+
+
+/*
+ * Record a span on the shell's track, from start until now. Does
+ * nothing if start is 0 (tracing was off when it began).
+ *
+ * Parameters:
+ *   name    Name of the span
+ *   start   Value returned by trace_begin
+ *   detail  Shown as the span's "detail" argument, or NULL
+ *
+ * Returns: None
+ */
+void trace_end(const char *name, uint64_t start, const char *detail);
+
+
+/*
+ * Record a span with explicit times on the track tid. Thread safe.
+ *
+ * Parameters:
+ *   tid       Track: a process or thread id
+ *   name      Name of the span
+ *   start_ns  Start, from stats_now()
+ *   end_ns    End, from stats_now()
+ *   args      Body of the span's JSON "args" object (without braces,
+ *             already escaped), or NULL
+ *
+ * Returns: None
+ */
+void trace_span(pid_t tid, const char *name, uint64_t start_ns,
+                uint64_t end_ns, const char *args);
+
+
+/*
+ * Record a point in time on the track tid. Thread safe.
+ *
+ * Parameters:
+ *   tid     Track: a process or thread id
+ *   name    Name of the event
+ *   ts_ns   When, from stats_now()
+ *
+ * Returns: None
+ */
+void trace_instant(pid_t tid, const char *name, uint64_t ts_ns);
+
+
+/*
+ * Give the track tid a name. Thread safe.
+ *
+ * Parameters:
+ *   tid     Track: a process or thread id
+ *   name    Name shown for the track
+ *
+ * Returns: None
+ */
+void trace_name_track(pid_t tid, const char *name);
+
+
+/*
+ * Copy str into buf as the body of a JSON string: quotes, backslashes
+ * and control characters are escaped. The result is truncated to fit.
+ *
+ * Parameters:
+ *   buf     Return space
+ *   size    Size of buf
+ *   str     The string to escape
+ *
+ * Returns: buf
+ */
+char *trace_escape(char *buf, size_t size, const char *str);
+
+#endif // _TRACE_H_